@@ -17,6 +17,7 @@
 
 #define CONFIG_EXAMPLE_SIM_PIN "1234"
 #define CONFIG_USE_VFS_UART     1
+#define CONFIG_USE_KERNEL_PPP   0
 
 using namespace esp_modem;
 
@@ -37,6 +38,8 @@ int main()
         .dev_name = "/dev/ttyUSB0",
         .uart = {}
     };
+    uart_config.uart.baud_rate = 115200;     // Any rate the device supports, e.g. 921600 or 3000000
+    uart_config.uart.flow_control = ESP_MODEM_FLOW_CONTROL_NONE;    // ESP_MODEM_FLOW_CONTROL_HW for RTS/CTS
     assert(vfs_create_uart(&uart_config, &dte_config.vfs_config) == true);
 #else
     /**
@@ -51,10 +54,25 @@ int main()
 #endif
     auto dte = create_vfs_dte(&dte_config);
 
+#if CONFIG_USE_KERNEL_PPP == 1
+    /**
+     * @note: Kernel PPP (needs pppd and privileges to use /dev/ppp): pppd negotiates the link,
+     * the kernel frames the packets and creates the interface (with the default route and DNS servers)
+     */
+    esp_netif_config_t netif_config = {
+        .dev_name = "/dev/ppp",
+        .if_name = "ppp_modem",
+        .ppp_options = nullptr,
+        .multi_queue = false
+    };
+#else
     esp_netif_config_t netif_config = {
         .dev_name = "/dev/net/tun",
-        .if_name = "tun0"
+        .if_name = "tun0",
+        .ppp_options = nullptr,
+        .multi_queue = false
     };
+#endif
     esp_netif_t *tun_netif = esp_netif_new(&netif_config);
 
     esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("internet");
@@ -8,6 +8,7 @@
  * Modem console example
 */
 
+#include <cinttypes>
 #include <cstdio>
 #include <cstring>
 #include <map>
@@ -367,6 +368,36 @@ extern "C" void app_main(void)
         ESP_LOGI(TAG, "Resetting the module...");
         CHECK_ERR(dce->reset(), ESP_LOGI(TAG, "OK"));
     });
+    const ConsoleCommand GetStats("stats", "prints statistics of DTE, CMUX and commands", no_args, [&](ConsoleCommand * c) {
+        auto stats = dce->get_dte_stats();
+        ESP_LOGI(TAG, "command terminal: rx=%" PRIu64 " tx=%" PRIu64 ", data terminal: rx=%" PRIu64 " tx=%" PRIu64 ", recoveries=%" PRIu32,
+                 stats.command.rx_bytes, stats.command.tx_bytes, stats.data.rx_bytes, stats.data.tx_bytes, stats.recoveries);
+        ESP_LOGI(TAG, "errors: overflow=%" PRIu32 " checksum=%" PRIu32 " control_flow=%" PRIu32 " device_gone=%" PRIu32,
+                 stats.errors[0], stats.errors[1], stats.errors[2], stats.errors[3]);
+        for (size_t i = 0; i < stats.commands_num; ++i) {
+            const auto &cmd = stats.commands[i];
+            ESP_LOGI(TAG, "%-15s count=%" PRIu32 " fail=%" PRIu32 " timeout=%" PRIu32 " avg=%" PRIu64 "ms max=%" PRIu32 "ms", cmd.name, cmd.count, cmd.failures, cmd.timeouts,
+                     cmd.total_ms / cmd.count, cmd.max_ms);
+            std::string histogram;
+            for (int b = 0; b < ESP_MODEM_STATS_LATENCY_BUCKETS; ++b) {
+                bool last = b == ESP_MODEM_STATS_LATENCY_BUCKETS - 1;
+                histogram += (last ? ">=" : "<") + std::to_string(1 << (last ? b - 1 : b)) + "ms:" + std::to_string(cmd.latency[b]) + " ";
+            }
+            ESP_LOGI(TAG, "  %s", histogram.c_str());
+        }
+        auto cmux = dce->get_cmux_stats();
+        for (int dlci = 0; dlci < ESP_MODEM_STATS_CMUX_CHANNELS; ++dlci) {
+            const auto &ch = cmux.channels[dlci];
+            if (ch.rx_frames || ch.tx_frames) {
+                ESP_LOGI(TAG, "CMUX DLCI %d: rx=%" PRIu64 " bytes (%" PRIu32 " frames), tx=%" PRIu64 " bytes (%" PRIu32 " frames)", dlci,
+                         ch.rx_bytes, ch.rx_frames, ch.tx_bytes, ch.tx_frames);
+            }
+        }
+        ESP_LOGI(TAG, "CMUX FCS errors=%" PRIu32 ", recoveries: lead_sof=%" PRIu32 " trail_sof=%" PRIu32 " crc=%" PRIu32 " header=%" PRIu32 " data=%" PRIu32 " behind=%" PRIu32 " unknown=%" PRIu32,
+                 cmux.fcs_errors, cmux.recoveries[0], cmux.recoveries[1], cmux.recoveries[2], cmux.recoveries[3],
+                 cmux.recoveries[4], cmux.recoveries[5], cmux.recoveries[6]);
+        return 0;
+    });
 #ifdef CONFIG_EXAMPLE_MODEM_DEVICE_SHINY
     const ConsoleCommand HandleURC("urc", "toggle urc handling", no_args, [&](ConsoleCommand * c) {
         static int cnt = 0;
@@ -6,6 +6,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
 namespace esp_modem {
 
 /**
@@ -42,4 +47,90 @@ struct unique_buffer {
     size_t consumed{};
 };
 
+/**
+ * Single-producer/single-consumer ring buffer of a fixed size
+ *
+ * The producer (terminal reader) writes directly into the free space obtained by write_ptr()
+ * and publishes the data by commit(); the consumer scans pending data in place and discards it
+ * by consume(). The buffer never reallocates.
+ */
+class ring_buffer {
+public:
+    explicit ring_buffer(size_t size);
+    ring_buffer(ring_buffer const &) = delete;
+    ring_buffer &operator=(ring_buffer const &) = delete;
+
+    /**
+     * @brief Producer: Gets the contiguous free space to write to
+     * @param[out] len Size of the contiguous free space (zero if full)
+     */
+    uint8_t *write_ptr(size_t &len) const;
+
+    /**
+     * @brief Producer: Publishes `len` bytes written to write_ptr()
+     */
+    void commit(size_t len);
+
+    /**
+     * @brief Producer: Copies data to the buffer
+     * @return false if there's not enough space (nothing is copied)
+     */
+    bool push(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Consumer: Number of pending bytes
+     */
+    [[nodiscard]] size_t available() const;
+
+    /**
+     * @brief Consumer: Checks if the last `len` pending bytes contain the character (scans across the wrap point)
+     */
+    [[nodiscard]] bool contains(uint8_t c, size_t len) const;
+
+    /**
+     * @brief Consumer: Makes the pending data contiguous
+     *
+     * @return Pointer to available() bytes of pending data
+     * @note If the data wrap around, the storage is rotated in place, so the producer must not write concurrently
+     */
+    uint8_t *linearize();
+
+    /**
+     * @brief Consumer: Discards `len` pending bytes
+     */
+    void consume(size_t len);
+
+    /**
+     * @brief Consumer: Discards all pending data
+     */
+    void clear()
+    {
+        consume(available());
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return capacity;
+    }
+
+private:
+    /**
+     * Indices run in the range of <0, 2*capacity) to distinguish full and empty buffer
+     */
+    [[nodiscard]] size_t advance(size_t index, size_t len) const
+    {
+        index += len;
+        return index >= 2 * capacity ? index - 2 * capacity : index;
+    }
+    [[nodiscard]] size_t position(size_t index) const
+    {
+        return index >= capacity ? index - capacity : index;
+    }
+
+    std::unique_ptr<uint8_t[]> data;
+    size_t capacity;
+    std::atomic<size_t> head{0};    /*!< Written by the producer */
+    std::atomic<size_t> tail{0};    /*!< Written by the consumer */
+};
+
 }
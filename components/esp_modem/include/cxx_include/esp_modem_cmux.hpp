@@ -6,12 +6,21 @@
 
 #pragma once
 
+#include <vector>
 #include "esp_modem_terminal.hpp"
 #include "cxx_include/esp_modem_buffer.hpp"
+#include "cxx_include/esp_modem_stats.hpp"
+#include "esp_modem_config.h"
 
 namespace esp_modem {
 
-constexpr size_t MAX_TERMINALS_NUM = 2;
+constexpr size_t MAX_TERMINALS_NUM = 8;           /*!< Maximum number of virtual terminals (DLCIs 1..8) */
+constexpr size_t CMUX_DEFAULT_TERMINALS_NUM = 2;  /*!< Default number of virtual terminals (commands and data) */
+constexpr size_t MAX_FRAMES_PER_WRITE = 16;     /*!< Number of CMUX frames submitted to the terminal at once */
+constexpr size_t CMUX_DEFAULT_FRAME_SIZE = 127; /*!< Default N1 (fits the short, 1-byte length field) */
+constexpr size_t CMUX_MAX_FRAME_SIZE = 32767;   /*!< Maximum N1 (fits the long, 2-byte length field) */
+constexpr uint32_t CMUX_FLOW_CONTROL_TIMEOUT_MS = 1000;  /*!< Period of warnings (and detach checks) while a writer waits for the device to enable flow */
+constexpr uint32_t CMUX_FLOW_CONTROL_MAX_WAIT_MS = 10000;   /*!< Time a writer waits for the device to enable flow, the write fails then */
 /**
  * @defgroup ESP_MODEM_CMUX ESP_MODEM CMUX class
  * @brief Definition of CMUX terminal
@@ -31,6 +40,30 @@ enum class cmux_state {
     RECOVER,
 };
 
+/**
+ * @brief Reason of restarting the CMUX state machine (index of `cmux_stats::recoveries`)
+ */
+enum class protocol_mismatch_reason {
+    MISSED_LEAD_SOF,
+    MISSED_TRAIL_SOF,
+    WRONG_CRC,
+    UNEXPECTED_HEADER,
+    UNEXPECTED_DATA,
+    READ_BEHIND_BUFFER,
+    UNKNOWN
+};
+
+/**
+ * @brief DLC parameters of a CMUX virtual terminal
+ *
+ * These are the defaults, or the values agreed with the device using parameter negotiation (PN)
+ */
+struct cmux_dlci_params {
+    size_t frame_size;      /*!< Maximum frame size (N1) */
+    uint8_t priority;       /*!< Priority of the DLC (0-63) */
+    uint8_t window;         /*!< Window size (k), used only in error recovery mode */
+};
+
 /**
  * @brief CMUX terminal abstraction
  *
@@ -47,8 +80,14 @@ class CMuxInstance;
  */
 class CMux {
 public:
-    explicit CMux(std::shared_ptr<Terminal> t, unique_buffer &&b):
-        term(std::move(t)), payload_start(nullptr), total_payload_size(0), buffer(std::move(b))  {}
+    /**
+     * @param t The original terminal
+     * @param b Processing buffer
+     * @param config CMUX configuration (defaults if nullptr)
+     * @param stats Statistics to update (e.g. accumulated over CMUX sessions), nullptr to create own statistics
+     */
+    explicit CMux(std::shared_ptr<Terminal> t, unique_buffer &&b, const esp_modem_cmux_config *config = nullptr,
+                  std::shared_ptr<Stats<cmux_stats>> stats = nullptr);
     ~CMux() = default;
 
     /**
@@ -77,15 +116,51 @@ public:
      */
     void set_read_cb(int inst, std::function<bool(uint8_t *data, size_t len)> f);
 
+    /**
+     * @brief Gets the number of virtual terminals
+     */
+    size_t terminals_num() const
+    {
+        return channels.size();
+    }
+
+    /**
+     * @brief Gets DLC parameters of the appropriate terminal
+     * @param inst Index of the terminal
+     * @return Parameters used for this terminal (negotiated, if `negotiate_params` was configured and the device replied)
+     */
+    cmux_dlci_params get_params(int inst);
+
     /**
      * @brief Writes to the appropriate terminal
      * @param i Index of the terminal
      * @param data Data to write
      * @param len Data length to write
-     * @return The actual written length
+     * @return The actual written length, -1 on error
+     * @note Blocks while the device has disabled the flow on this terminal (data are not dropped)
      */
     int write(int i, uint8_t *data, size_t len);
 
+    /**
+     * @brief Enables or disables the flow of data from the device (sends FCon/FCoff command)
+     *
+     * Use this to stop the device from sending on all virtual terminals if we cannot keep up
+     * with processing the received data
+     *
+     * @param enable true to allow the device to send, false to stop it
+     * @return true on success
+     */
+    bool set_flow(bool enable);
+
+    /**
+     * @brief Calculates FCS CRC (table driven)
+     * @param data Data to calculate the CRC over
+     * @param len Data length
+     * @param crc Initial value, or CRC of the preceding data to continue with
+     * @return CRC value (FCS field of the frame is 0xFF - crc)
+     */
+    static uint8_t fcs_crc(const uint8_t *data, size_t len, uint8_t crc = 0xFF);
+
     /**
      * @brief Recovers the protocol
      *
@@ -96,23 +171,26 @@ public:
      */
     bool recover();
 
-private:
+    /**
+     * @brief Gets the statistics of traffic and protocol errors
+     */
+    cmux_stats get_stats()
+    {
+        return stats->get();
+    }
 
-    enum class protocol_mismatch_reason {
-        MISSED_LEAD_SOF,
-        MISSED_TRAIL_SOF,
-        WRONG_CRC,
-        UNEXPECTED_HEADER,
-        UNEXPECTED_DATA,
-        READ_BEHIND_BUFFER,
-        UNKNOWN
-    };
+private:
 
-    static uint8_t fcs_crc(const uint8_t frame[6]);     /*!< Utility to calculate FCS CRC */
     bool data_available(uint8_t *data, size_t len);     /*!< Called when valid data available (returns false on unexpected data format) */
     void send_sabm(size_t i);                           /*!< Sending initial SABM */
     void send_disconnect(size_t i);                     /*!< Sending closing request for each virtual or control terminal */
+    void send_pn(size_t i);                             /*!< Sending DLC parameter negotiation for a virtual terminal */
+    bool negotiate(size_t i);                           /*!< Negotiates DLC parameters of a virtual terminal (returns false if not supported) */
+    void on_control_message();                          /*!< Processes a complete message received on the control channel */
+    void send_control_message(const uint8_t *msg, size_t len);  /*!< Sends a message over the control channel */
+    void update_flow();                                 /*!< Updates the flow signal of virtual terminals (call with lock held) */
     bool on_cmux_data(uint8_t *data, size_t len);       /*!< Called from terminal layer when raw CMUX protocol data available */
+    void stash_payload();                               /*!< Copies the partially received payload to the terminal's buffer */
 
     struct CMuxFrame;                                   /*!< Forward declare the Frame struct, used in protocol decoders */
     /**
@@ -128,7 +206,22 @@ private:
     bool on_footer(CMuxFrame &frame);
     void recover_protocol(protocol_mismatch_reason reason);
 
-    std::function<bool(uint8_t *data, size_t len)> read_cb[MAX_TERMINALS_NUM];  /*!< Function pointers to read callbacks */
+    /**
+     * @brief Virtual terminal (channel) of CMUX
+     */
+    struct channel {
+        std::function<bool(uint8_t *data, size_t len)> read_cb;   /*!< Read callback */
+        cmux_dlci_params params;                                  /*!< DLC parameters */
+        bool tx_flow;                                             /*!< Device accepts data on this terminal (MSC) */
+        std::unique_ptr<uint8_t[]> rx_buffer;                     /*!< Buffer to defragment payload (taken from the pool) */
+        size_t rx_len;                                            /*!< Length of the defragmented payload */
+    };
+
+    void append_payload(channel &ch, const uint8_t *data, size_t len);    /*!< Defragments payload in the terminal's buffer */
+    void release_payload(channel &ch);                                   /*!< Returns the terminal's buffer to the pool */
+
+    std::vector<channel> channels;                    /*!< Virtual terminals, index = DLCI - 1 */
+    std::vector<std::unique_ptr<uint8_t[]>> rx_pool;  /*!< Pool of buffers to defragment payloads */
     std::shared_ptr<Terminal> term;                   /*!< The original terminal */
     cmux_state state;                                 /*!< CMux protocol state */
 
@@ -138,18 +231,28 @@ private:
     uint8_t dlci;
     uint8_t type;
     size_t payload_len;
+    uint8_t frame_crc;                                /*!< FCS CRC of the currently received frame */
     uint8_t frame_header[6];
     size_t frame_header_offset;
     uint8_t *payload_start;
     size_t total_payload_size;
     int instance;
     int sabm_ack;
+    size_t max_frame_size;                            /*!< Maximum payload size of a sent frame (N1) */
+    bool negotiate_params;                            /*!< Negotiate DLC parameters on init */
+    bool ui_frames;                                   /*!< Send UI frames instead of UIH */
+    int pn_ack;                                       /*!< DLCI of the last PN response (0 if PN not supported by the device) */
+    uint8_t control_msg[16];                          /*!< Message received on the control channel (DLCI=0) */
+    size_t control_msg_len;
+    bool tx_flow;                                     /*!< Device accepts data on all virtual terminals (FCon/FCoff) */
+    SignalGroup flow_signal;                          /*!< Bit per virtual terminal, set if we're allowed to send */
 
     /**
      * Processing unique buffer (reused and transferred from it's parent DTE)
      */
     unique_buffer buffer;
 
+    std::shared_ptr<Stats<cmux_stats>> stats;         /*!< Traffic and protocol errors */
     Lock lock;
 };
 
@@ -0,0 +1,117 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <functional>
+#include <string>
+#include <string_view>
+#include "cxx_include/esp_modem_types.hpp"
+
+namespace esp_modem {
+
+class CommandBatch;
+
+namespace dce_commands {
+command_result batch(CommandableIf *t, CommandBatch &queries);
+}
+
+/**
+ * @defgroup ESP_MODEM_COMMAND_BATCH
+ * @brief Batch of queries sent in one AT command line
+ */
+
+/** @addtogroup ESP_MODEM_COMMAND_BATCH
+* @{
+*/
+
+/**
+ * @brief Batch of queries sent to the device as one concatenated command, e.g. `AT+CSQ;+CGATT?;+COPS?`
+ *
+ * The combined reply is parsed into the output parameters of each query, so all of them take
+ * one round trip instead of one per query. Results are available per query after sending the batch.
+ * Usage:
+ * @code{.cpp}
+ *   CommandBatch status;
+ *   status.signal_quality(rssi, ber).network_attachment_state(state).operator_name(name, act);
+ *   if (dce->batch(status) == command_result::OK) { ... }
+ * @endcode
+ * @note The device stops executing the line on the first failure, so the following queries fail, too.
+ */
+class CommandBatch {
+public:
+    static constexpr size_t max_queries = 8;            /*!< Maximum number of queries in one batch */
+
+    /**
+     * @brief Parses the reply line of the query
+     */
+    using parser = std::function<command_result(std::string_view line)>;
+
+    /**
+     * @brief Adds a custom query
+     * @param command Command without the "AT" prefix and terminator, e.g. "+CSQ" (not copied, has to outlive the batch)
+     * @param prefix Prefix of the reply line, e.g. "+CSQ:" (not copied, either)
+     * @param parse Parser of the reply line
+     * @param timeout_ms Timeout of the query (the batch uses the longest one)
+     */
+    CommandBatch &add(std::string_view command, std::string_view prefix, parser parse, uint32_t timeout_ms = 500);
+
+    /**
+     * @brief Queries from the command library (same outputs as the commands of the same name)
+     */
+    CommandBatch &signal_quality(int &rssi, int &ber);
+    CommandBatch &network_attachment_state(int &state);
+    CommandBatch &radio_state(int &state);
+    CommandBatch &network_system_mode(int &mode);
+    CommandBatch &operator_name(std::string &name, int &act);
+    CommandBatch &operator_name(char_span &name, int &act);
+    CommandBatch &pin(bool &pin_ok);
+
+    /**
+     * @brief Number of queries in the batch
+     */
+    [[nodiscard]] size_t size() const
+    {
+        return count;
+    }
+
+    /**
+     * @brief Result of the query (in the order of adding) from the last time the batch was sent
+     */
+    [[nodiscard]] command_result result(size_t index) const
+    {
+        return index < count ? queries[index].result : command_result::FAIL;
+    }
+
+    /**
+     * @brief Removes all queries
+     */
+    void clear()
+    {
+        count = 0;
+        overflow = false;
+    }
+
+private:
+    friend command_result dce_commands::batch(CommandableIf *t, CommandBatch &queries);
+    struct query {
+        std::string_view command;
+        std::string_view prefix;
+        parser parse;
+        uint32_t timeout_ms;
+        command_result result;
+    };
+    std::array<query, max_queries> queries{};
+    size_t count{0};
+    bool overflow{false};                               /*!< Too many queries added, the batch fails */
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
@@ -9,6 +9,7 @@
 #include "esp_modem_dte.hpp"
 #include "esp_modem_dce_module.hpp"
 #include "esp_modem_types.hpp"
+#include "esp_modem_command_batch.hpp"
 #include "generate/esp_modem_command_declare.inc"
 
 namespace esp_modem {
@@ -56,6 +57,27 @@ command_result set_network_bands_sim76xx(CommandableIf *t, const std::string &mo
 command_result power_down_sim8xx(CommandableIf *t);
 command_result set_data_mode_alt(CommandableIf *t);
 command_result set_pdp_context(CommandableIf *t, PdpContext &pdp, uint32_t timeout_ms);
+command_result upload_file_quectel(CommandableIf *t, std::string_view name, const file_read_cb &source, size_t chunk_size);
+command_result download_file_quectel(CommandableIf *t, std::string_view name, const file_write_cb &sink, size_t chunk_size);
+
+/**
+ * @brief Following commands return the string in caller's buffer (without allocations)
+ */
+command_result get_operator_name(CommandableIf *t, char_span &name, int &act);
+command_result get_imsi(CommandableIf *t, char_span &imsi);
+command_result get_imei(CommandableIf *t, char_span &imei);
+command_result get_module_name(CommandableIf *t, char_span &name);
+command_result at(CommandableIf *t, std::string_view cmd, char_span &out, int timeout);
+command_result at_raw(CommandableIf *t, std::string_view cmd, char_span &out, std::string_view pass, std::string_view fail, int timeout);
+
+/**
+ * @brief Sends the batch of queries in one command line and parses the combined reply
+ *
+ * @param t Commandable object (anything that can accept commands)
+ * @param queries Batch of queries, results per query are available with CommandBatch::result()
+ * @return OK if all the queries succeeded, FAIL if any failed, TIMEOUT if the device didn't complete the line
+ */
+command_result batch(CommandableIf *t, CommandBatch &queries);
 
 /**
  * @}
@@ -6,8 +6,170 @@
 
 #pragma once
 
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <functional>
+#include <string_view>
+
 namespace esp_modem::dce_commands {
 
+/**
+ * @brief Formats AT commands in a fixed buffer (typically on stack) to avoid allocations
+ *
+ * Usage: `at_string<> cmd; cmd << "AT+CFUN=" << state << "\r";`
+ * @note If the command doesn't fit the buffer, the formatting stops and ok() returns false
+ * @tparam N Size of the buffer
+ */
+template<size_t N = 64>
+class at_string {
+public:
+    at_string &operator<<(std::string_view str)
+    {
+        if (!overflow && len + str.size() <= N) {
+            memcpy(buffer + len, str.data(), str.size());
+            len += str.size();
+        } else {
+            overflow = true;
+        }
+        return *this;
+    }
+
+    at_string &operator<<(char c)
+    {
+        return *this << std::string_view(&c, 1);
+    }
+
+    at_string &operator<<(int value)
+    {
+        auto res = std::to_chars(buffer + len, buffer + N, value);
+        if (!overflow && res.ec == std::errc()) {
+            len = res.ptr - buffer;
+        } else {
+            overflow = true;
+        }
+        return *this;
+    }
+
+    [[nodiscard]] bool ok() const
+    {
+        return !overflow;
+    }
+
+    [[nodiscard]] std::string_view view() const
+    {
+        return std::string_view(buffer, len);
+    }
+
+private:
+    char buffer[N];
+    size_t len{0};
+    bool overflow{false};
+};
+
+/**
+ * @brief Set of phrases to look for in command replies, compiled (constexpr) into a single-pass scanner
+ *
+ * The phrases are indexed by their first characters, so the reply is scanned only once for all of them.
+ * Since the reply is collected, the scanner continues where it stopped last time, i.e. it scans only the new data
+ * (overlapped by the longest phrase to find phrases received in fragments)
+ * @tparam Pass Number of phrases to pass the command
+ * @tparam Fail Number of phrases to fail the command
+ */
+template<size_t Pass, size_t Fail>
+class reply_phrases {
+public:
+    constexpr reply_phrases(const std::array<std::string_view, Pass> &pass, const std::array<std::string_view, Fail> &fail):
+        pass(pass), fail(fail)
+    {
+        for (auto &p : pass) {
+            add(p, PASS);
+        }
+        for (auto &f : fail) {
+            add(f, FAIL);
+        }
+    }
+
+    /**
+     * @brief Scans the reply
+     * @param data Reply collected so far
+     * @param len Length of the reply
+     * @param scanned Length of the reply scanned previously (updated), initialize to 0 for a new command
+     * @return OK if any pass phrase found, FAIL if any fail phrase found, TIMEOUT otherwise (need more data)
+     */
+    command_result scan(const uint8_t *data, size_t len, size_t &scanned) const
+    {
+        if (len < scanned) {
+            scanned = 0;    // not a continuation of the previous reply
+        }
+        size_t pos = scanned > max_len - 1 ? scanned - (max_len - 1) : 0;
+        scanned = len;
+        bool failed = false;
+        for (; pos < len; ++pos) {
+            auto kind = first[data[pos]];
+            if (kind == 0) {
+                continue;
+            }
+            if ((kind & PASS) && find(pass, data + pos, len - pos)) {
+                return command_result::OK;
+            }
+            if ((kind & FAIL) && find(fail, data + pos, len - pos)) {
+                failed = true;  // pass phrases take precedence, so keep scanning
+            }
+        }
+        return failed ? command_result::FAIL : command_result::TIMEOUT;
+    }
+
+private:
+    static constexpr uint8_t PASS = 1;
+    static constexpr uint8_t FAIL = 2;
+
+    constexpr void add(std::string_view phrase, uint8_t kind)
+    {
+        if (!phrase.empty()) {
+            first[static_cast<uint8_t>(phrase[0])] |= kind;
+            max_len = phrase.size() > max_len ? phrase.size() : max_len;
+        }
+    }
+
+    template<size_t N>
+    static bool find(const std::array<std::string_view, N> &phrases, const uint8_t *data, size_t len)
+    {
+        for (auto &p : phrases) {
+            if (!p.empty() && p.size() <= len && p[0] == data[0] && memcmp(p.data(), data, p.size()) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::array<std::string_view, Pass> pass;
+    std::array<std::string_view, Fail> fail;
+    std::array<uint8_t, 256> first{};       /*!< Kinds of phrases starting with the character */
+    size_t max_len{1};                      /*!< Length of the longest phrase */
+};
+
+/**
+ * @brief Generic command that passes on any of the pass phrases, and fails on any of the fail phrases
+ * @param t Any "Command-able" class that implements "command()" method
+ * @param command Command to issue
+ * @param phrases Phrases to look for in replies, typically constexpr, e.g. reply_phrases<1, 1>({"OK"}, {"ERROR"})
+ * @param timeout_ms Command timeout in ms
+ * @return Generic command return type (OK, FAIL, TIMEOUT)
+ */
+template<size_t Pass, size_t Fail>
+command_result generic_command(CommandableIf *t, std::string_view command,
+                               const reply_phrases<Pass, Fail> &phrases, uint32_t timeout_ms)
+{
+    size_t scanned = 0;
+    return t->command(command.data(), command.size(), [&](uint8_t *data, size_t len) {
+        if (data == nullptr || len == 0) {
+            return command_result::TIMEOUT;
+        }
+        return phrases.scan(data, len, scanned);
+    }, timeout_ms, '\n');
+}
+
 /**
  * @brief Generic command that passes on supplied pass_phrase, and fails on fail_phrase
  * @param t Any "Command-able" class that implements "command()" method
@@ -25,11 +187,11 @@ command_result generic_command(CommandableIf *t, const std::string &command,
  * @brief Utility command to send command and return reply (after DCE says OK)
  * @param t Anything that is "command-able"
  * @param command Command to issue
- * @param output String to return (could be either std::string& or std::string_view&)
+ * @param output String to return (either std::string& or char_span& to store the output in caller's buffer)
  * @param timeout_ms Command timeout in ms
  * @return Generic command return type (OK, FAIL, TIMEOUT)
  */
-template <typename T> command_result generic_get_string(CommandableIf *t, const std::string &command, T &output, uint32_t timeout_ms = 500);
+template <typename T> command_result generic_get_string(CommandableIf *t, std::string_view command, T &output, uint32_t timeout_ms = 500);
 
 /**
  * @brief Generic command that passes on "OK" and fails on "ERROR"
@@ -38,6 +200,20 @@ template <typename T> command_result generic_get_string(CommandableIf *t, const
  * @param timeout_ms Command timeout in ms
  * @return Generic command return type (OK, FAIL, TIMEOUT)
  */
-command_result generic_command_common(CommandableIf *t, const std::string &command, uint32_t timeout_ms = 500);
+command_result generic_command_common(CommandableIf *t, std::string_view command, uint32_t timeout_ms = 500);
+
+/**
+ * @brief Sends the command and streams the length-prefixed binary payload of the reply to the sink,
+ * e.g. `CONNECT 1024\r\n<1024 bytes>\r\nOK`, keeping the memory constant however long the payload is
+ * (plain `OK` without the length succeeds with no payload, `ERROR` fails)
+ * @param t Anything that is "command-able"
+ * @param command Command to issue
+ * @param sink Function to receive the payload in chunks (returns false to fail the command)
+ * @param timeout_ms Time in ms to wait for each chunk of the reply
+ * @param prefix Beginning of the line announcing the length of the payload
+ * @return Generic command return type (OK, FAIL, TIMEOUT)
+ */
+command_result generic_get_binary(CommandableIf *t, std::string_view command, const std::function<bool(uint8_t *data, size_t len)> &sink,
+                                  uint32_t timeout_ms, std::string_view prefix = "CONNECT");
 
 } // esp_modem::dce_commands
@@ -0,0 +1,121 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#if !defined(__cpp_impl_coroutine) || __cplusplus < 202002L
+#error "esp_modem coroutine API requires C++20 (with coroutines enabled)"
+#endif
+
+#include <coroutine>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include "cxx_include/esp_modem_dce.hpp"
+#include "generate/esp_modem_command_declare.inc"
+
+namespace esp_modem::coro {
+
+/**
+ * @defgroup ESP_MODEM_COROUTINE
+ * @brief Opt-in coroutine API of DCE commands (needs C++20 in the application, the library itself is C++17)
+ */
+
+/** @addtogroup ESP_MODEM_COROUTINE
+* @{
+*/
+
+/**
+ * @brief Resumes the awaiting coroutine, e.g. posts it to the application's event loop:
+ * `[&io](std::coroutine_handle<> h) { asio::post(io, h); }`
+ */
+using executor = std::function<void(std::coroutine_handle<>)>;
+
+/**
+ * @brief Awaitable result of a DCE command
+ *
+ * The command runs on the DTE's command task (in order with other queued commands), and the awaiting
+ * coroutine is resumed by the executor when the command completes.
+ * @note The command refers to its arguments, so it should be awaited right away: `co_await modem.get_imsi(imsi);`
+ */
+template<typename R>
+class awaitable {
+public:
+    awaitable(DCE &dce, const executor &exec, std::function<R()> job):
+        dce(dce), exec(exec), job(std::move(job)) {}
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        dce.post([this, h](bool cancelled) {
+            result = cancelled ? R{command_result::FAIL} : job();
+            if (exec) {
+                exec(h);
+            } else {
+                h.resume();     // resume on the DTE's command task
+            }
+        });
+    }
+
+    R await_resume()
+    {
+        return result;
+    }
+
+private:
+    DCE &dce;
+    const executor &exec;
+    std::function<R()> job;
+    R result{};
+};
+
+/**
+ * @brief DCE with awaitable commands, generated from the same command list as the DCE
+ *
+ * Usage:
+ * @code{.cpp}
+ *   AsyncDCE modem(*dce, [&io](std::coroutine_handle<> h) { asio::post(io, h); });
+ *   int rssi, ber;
+ *   if (co_await modem.get_signal_quality(rssi, ber) == command_result::OK) { ... }
+ * @endcode
+ */
+class AsyncDCE {
+public:
+    /**
+     * @param dce DCE to run the commands
+     * @param exec Executor resuming the coroutines, nullptr to resume them on the DTE's command task
+     */
+    explicit AsyncDCE(DCE &dce, executor exec = nullptr): dce(dce), exec(std::move(exec)) {}
+
+#define ESP_MODEM_DECLARE_DCE_COMMAND(name, return_type, num, ...) \
+    template <typename ...Args> \
+    awaitable<return_type> name(Args&&... args) \
+    { \
+        return awaitable<return_type>(dce, exec, [&dce = dce, params = std::forward_as_tuple(std::forward<Args>(args)...)]() mutable { \
+            return std::apply([&dce](auto &&... p) { \
+                return dce.name(std::forward<decltype(p)>(p)...); \
+            }, params); \
+        }); \
+    }
+
+    DECLARE_ALL_COMMAND_APIS(awaitable name(...) { dce.name(...) on the command task })
+
+#undef ESP_MODEM_DECLARE_DCE_COMMAND
+
+private:
+    DCE &dce;
+    executor exec;
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem::coro
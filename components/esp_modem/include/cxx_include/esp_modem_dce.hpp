@@ -7,6 +7,7 @@
 #pragma once
 
 #include <utility>
+#include <unistd.h>
 #include "cxx_include/esp_modem_netif.hpp"
 #include "cxx_include/esp_modem_dce_module.hpp"
 
@@ -79,6 +80,76 @@ public:
         return dte->command(command, std::move(got_line), time_ms);
     }
 
+    std::future<command_result> command_async(const std::string &command, got_line_cb got_line, uint32_t time_ms)
+    {
+        return dte->command_async(command, std::move(got_line), time_ms);
+    }
+
+    void post(std::function<void(bool cancelled)> job)
+    {
+        dte->post(std::move(job));
+    }
+
+    command_result batch(CommandBatch &queries)
+    {
+        return device->batch(queries);
+    }
+
+    /**
+     * @brief Uploads the file to the module's file system, reading the data from the callback
+     *
+     * The file is sent in chunks, each written as raw (binary) data of known length and acknowledged by the module.
+     * Other commands could be sent between the chunks (e.g. in CMUX mode, while the data channel is in use).
+     * @param name Name of the file in the module's file system
+     * @param source Callback providing the data (returns number of bytes, 0 at the end of file, -1 on error)
+     * @param chunk_size Size of the chunks
+     * @return OK, FAIL or TIMEOUT
+     */
+    command_result upload_file(std::string_view name, const file_read_cb &source, size_t chunk_size = 1024)
+    {
+        return device->upload_file(name, source, chunk_size);
+    }
+
+    /**
+     * @brief Uploads the file to the module's file system, reading the data from the file descriptor
+     */
+    command_result upload_file(std::string_view name, int fd, size_t chunk_size = 1024)
+    {
+        return device->upload_file(name, [fd](uint8_t *data, size_t len) {
+            return static_cast<int>(::read(fd, data, len));
+        }, chunk_size);
+    }
+
+    /**
+     * @brief Downloads the file from the module's file system, passing the data to the callback in chunks
+     * @param name Name of the file in the module's file system
+     * @param sink Callback receiving the data (returns false to abort the transfer)
+     * @param chunk_size Size of the chunks
+     * @return OK, FAIL or TIMEOUT
+     */
+    command_result download_file(std::string_view name, const file_write_cb &sink, size_t chunk_size = 1024)
+    {
+        return device->download_file(name, sink, chunk_size);
+    }
+
+    /**
+     * @brief Downloads the file from the module's file system, writing the data to the file descriptor
+     */
+    command_result download_file(std::string_view name, int fd, size_t chunk_size = 1024)
+    {
+        return device->download_file(name, [fd](uint8_t *data, size_t len) {
+            while (len > 0) {
+                auto written = ::write(fd, data, len);
+                if (written <= 0) {
+                    return false;
+                }
+                data += written;
+                len -= written;
+            }
+            return true;
+        }, chunk_size);
+    }
+
     bool set_mode(modem_mode m)
     {
         return mode.set(dte.get(), device.get(), netif, m);
@@ -89,6 +160,22 @@ public:
         return dte->recover();
     }
 
+    /**
+     * @brief Gets the statistics of the DTE (traffic, errors and latency of commands)
+     */
+    dte_stats get_dte_stats()
+    {
+        return dte->get_stats();
+    }
+
+    /**
+     * @brief Gets the statistics of CMUX (traffic per DLCI and protocol errors)
+     */
+    cmux_stats get_cmux_stats()
+    {
+        return dte->get_cmux_stats();
+    }
+
 protected:
     std::shared_ptr<DTE> dte;
     std::shared_ptr<SpecificModule> device;
@@ -11,6 +11,7 @@
 #include "generate/esp_modem_command_declare.inc"
 #include "cxx_include/esp_modem_command_library.hpp"
 #include "cxx_include/esp_modem_types.hpp"
+#include "cxx_include/esp_modem_response_cache.hpp"
 #include "esp_modem_dce_config.h"
 
 namespace esp_modem {
@@ -65,6 +66,9 @@ public:
      */
     bool set_mode(modem_mode mode) override
     {
+        if (cache) {
+            cache->invalidate(false);
+        }
         if (mode == modem_mode::DATA_MODE) {
             if (set_data_mode() != command_result::OK) {
                 return resume_data_mode() == command_result::OK;
@@ -98,6 +102,20 @@ public:
         pdp = std::move(new_pdp);
     }
 
+    /**
+     * @brief Enables caching of replies to commands querying static or slow-changing state (IMEI, operator, ...)
+     * @note Should be called before issuing commands, it waits for the command being sent (takes the DTE command lock)
+     * @return Cache object to configure other commands, invalidate replies or read the statistics
+     */
+    ResponseCache *enable_cache(const cache_config &config = cache_config());
+
+    void disable_cache();
+
+    ResponseCache *get_cache()
+    {
+        return cache.get();
+    }
+
     /**
      * @brief Simplified version of operator name (without the ACT, which is included in the command library)
      */
@@ -107,6 +125,31 @@ public:
         return get_operator_name(name, dummy_act);
     }
 
+    /**
+     * @brief Commands returning strings in caller's buffer (to avoid allocations)
+     */
+    command_result get_operator_name(char_span &name, int &act);
+    command_result get_imsi(char_span &imsi);
+    command_result get_imei(char_span &imei);
+    command_result get_module_name(char_span &name);
+    command_result at(std::string_view cmd, char_span &out, int timeout);
+    command_result at_raw(std::string_view cmd, char_span &out, std::string_view pass, std::string_view fail, int timeout);
+
+    /**
+     * @brief Sends the batch of queries in one command line (e.g. `AT+CSQ;+CGATT?;+COPS?`)
+     */
+    command_result batch(CommandBatch &queries);
+
+    /**
+     * @brief Transfers files to and from the module's file system in chunks
+     * (not part of the generic AT command set, so these fail unless implemented by the specific module)
+     * @param name Name of the file in the module's file system
+     * @param source/sink Callback providing/receiving the file data
+     * @param chunk_size Size of the chunks (each is acknowledged by the module)
+     */
+    virtual command_result upload_file(std::string_view name, const file_read_cb &source, size_t chunk_size);
+    virtual command_result download_file(std::string_view name, const file_write_cb &sink, size_t chunk_size);
+
     /**
      * @brief Common DCE commands generated from the API AT list
      */
@@ -121,6 +164,15 @@ public:
 protected:
     std::shared_ptr<DTE> dte;         /*!< Generic device needs the DTE as a channel talk to the module using AT commands */
     std::unique_ptr<PdpContext> pdp;  /*!< It also needs a PDP data, const information used for setting up cellular network */
+    std::unique_ptr<ResponseCache> cache;   /*!< Optional cache of replies */
+
+    /**
+     * @brief Commands are sent through the cache if enabled
+     */
+    CommandableIf *commandable()
+    {
+        return cache ? static_cast<CommandableIf *>(cache.get()) : dte.get();
+    }
 };
 
 // Definitions of other supported modules with some specific commands overwritten
@@ -173,6 +225,8 @@ class BG96: public GenericModule {
     using GenericModule::GenericModule;
 public:
     command_result set_pdp_context(PdpContext &pdp) override;
+    command_result upload_file(std::string_view name, const file_read_cb &source, size_t chunk_size) override;
+    command_result download_file(std::string_view name, const file_write_cb &sink, size_t chunk_size) override;
 };
 
 /**
@@ -6,16 +6,22 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <utility>
+#include <deque>
+#include <future>
+#include <string>
+#include <string_view>
+#include <vector>
 #include <cstddef>
 #include <cstdint>
 #include "cxx_include/esp_modem_primitives.hpp"
 #include "cxx_include/esp_modem_terminal.hpp"
 #include "cxx_include/esp_modem_types.hpp"
 #include "cxx_include/esp_modem_buffer.hpp"
-
-struct esp_modem_dte_config;
+#include "cxx_include/esp_modem_stats.hpp"
+#include "esp_modem_config.h"
 
 namespace esp_modem {
 
@@ -53,7 +59,7 @@ public:
     explicit DTE(const esp_modem_dte_config *config, std::unique_ptr<Terminal> t, std::unique_ptr<Terminal> s);
     explicit DTE(std::unique_ptr<Terminal> t, std::unique_ptr<Terminal> s);
 
-    ~DTE() = default;
+    ~DTE();
 
     /**
      * @brief Writing to the underlying terminal
@@ -115,6 +121,62 @@ public:
      */
     command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms, char separator) override;
 
+    /**
+     * @brief Sends the command (same as above) without copying it to std::string
+     */
+    command_result command(const char *command, size_t len, got_line_cb got_line, uint32_t time_ms, char separator) override;
+
+    /**
+     * @brief Sends the command and passes the reply to the callback in chunks, as they arrive from the terminal
+     *
+     * The reply is not collected, so the memory stays constant however long the reply is: only the data the callback
+     * doesn't consume (e.g. an incomplete line) is kept in the DTE buffer and passed again with the next chunk.
+     * URC handlers are not applied while the reply is streamed, so the reply could contain binary data.
+     * @param command Command to be sent
+     * @param len Length of the command
+     * @param on_chunk Callback processing the chunks of the reply
+     * @param time_ms Time in ms to wait for the next chunk of the reply
+     * @return OK, FAIL or TIMEOUT
+     */
+    command_result stream_command(const char *command, size_t len, stream_cb on_chunk, uint32_t time_ms) override;
+
+    /**
+     * @brief Queues the command to be sent without blocking the caller
+     *
+     * Queued commands are sent one after another from the DTE's command task, each as soon as
+     * the previous one completes, so a single thread could issue many commands without waiting.
+     * @param command String parameter representing command
+     * @param got_line Function to be called after line available as a response (from the DTE's tasks)
+     * @param time_ms Time in ms to wait for the answer (since the command has been sent)
+     * @param separator Command reply separator
+     * @return Future of the command result (OK, FAIL, TIMEOUT), FAIL if the DTE is destroyed before sending the command
+     */
+    std::future<command_result> command_async(const std::string &command, got_line_cb got_line, uint32_t time_ms, char separator = '\n');
+
+    /**
+     * @brief Runs the job from the DTE's command task, in order with the queued commands
+     *
+     * This is used to run blocking commands (e.g. of the DCE) without blocking the caller
+     * @param job Function to run, called with `cancelled=true` (from the destructor) if the DTE is destroyed before running it
+     */
+    void post(std::function<void(bool cancelled)> job);
+
+    /**
+     * @brief Sets handler of unsolicited result codes (URC) starting with the prefix
+     *
+     * Lines starting with the prefix are passed to the handler instead of the command parser, even if a command
+     * is in progress, unless the command contains the prefix (e.g. "+CREG" in AT+CREG?, which expects the same line as a reply).
+     * The handler is called from the DTE's command task (in order with the asynchronous commands and posted jobs),
+     * so it doesn't block reading the terminal and could send commands.
+     * @note The handler waits for the asynchronous command or job in progress, so a URC could be delivered
+     * as late as the longest queued command's timeout (or the longest job) after it's been received.
+     * Keep the posted jobs short, or don't rely on the URC timing while long commands are queued.
+     * @param prefix URC prefix, e.g. "+CREG:" or "RING"
+     * @param f Function to be called with the complete line, nullptr to remove the handler
+     * @return false if the prefix is empty or too long
+     */
+    bool set_urc_cb(const std::string &prefix, urc_cb f);
+
     /**
      * @brief Allows this DTE to recover from a generic connection issue
      *
@@ -122,6 +184,54 @@ public:
      */
     bool recover();
 
+    /**
+     * @brief Stops or resumes the flow of data from the device in CMUX modes
+     *
+     * Use this to assert flow-off if the data cannot be processed fast enough,
+     * instead of overflowing the buffers (and recovering the protocol).
+     * The DTE does this on its own when the buffer of command replies fills up (above 75%)
+     * and resumes the flow once it's processed (below 25%).
+     *
+     * @param enable true to allow the device to send, false to stop it
+     * @return true on success, false if not in CMUX mode
+     */
+    bool set_cmux_flow(bool enable);
+
+    /**
+     * @brief Opens another CMUX virtual terminal
+     *
+     * The first two virtual terminals are used by this DTE for commands and data, others
+     * (configured by `esp_modem_cmux_config::terminals_num`) could be used by the application,
+     * e.g. to read GNSS data, so they don't block each other.
+     *
+     * @param index Index of the virtual terminal (from 2 to `terminals_num - 1`)
+     * @return Terminal to use for reading and writing, nullptr if not in CMUX mode or on invalid index
+     * @note The terminal could be used only until the DTE exits CMUX mode
+     */
+    std::shared_ptr<Terminal> open_cmux_terminal(size_t index);
+
+    /**
+     * @brief Gets the statistics of this DTE: traffic of its terminals, errors and latency of commands
+     */
+    dte_stats get_stats()
+    {
+        return stats.get();
+    }
+
+    /**
+     * @brief Gets the statistics of CMUX, accumulated over all CMUX sessions of this DTE
+     * @return Traffic per DLCI and protocol errors (zeroes if CMUX has not been used)
+     */
+    cmux_stats get_cmux_stats()
+    {
+        return cmux_counters->get();
+    }
+
+    /**
+     * @brief Resets the DTE and CMUX statistics
+     */
+    void reset_stats();
+
 protected:
     /**
      * @brief Allows for locking the DTE
@@ -141,45 +251,29 @@ private:
     [[nodiscard]] bool setup_cmux();                        /*!< Internal setup of CMUX mode */
     [[nodiscard]] bool exit_cmux();                         /*!< Exit of CMUX mode and cleanup  */
     void exit_cmux_internal();                              /*!< Cleanup CMUX */
+    void command_task();                                    /*!< Sends the queued asynchronous commands */
+    void start_command_task();                              /*!< Creates the command task on first use */
+    bool read_command(uint8_t *data, size_t len);           /*!< Collects reply to the command in progress */
+    bool read_stream(uint8_t *data, size_t len);            /*!< Passes reply to the streamed command in progress */
+    void discard(uint8_t *data, size_t len);                /*!< Reads out data received while no command is in progress */
+    void on_error(terminal_error err);                      /*!< Handles error reported by the terminals */
+    void update_rx_flow();                                  /*!< Stops or resumes the device (CMUX flow control) by the fill level of the Rx ring (streamed replies) */
 
     Lock internal_lock{};                                   /*!< Locks DTE operations */
     unique_buffer buffer;                                   /*!< DTE buffer */
+    ring_buffer rx_ring;                                    /*!< Ring buffer to collect command replies */
+    std::atomic<bool> rx_flow_off{false};                   /*!< Flow-off sent to the device as the Rx ring filled up */
     std::shared_ptr<CMux> cmux_term;                        /*!< Primary terminal for this DTE */
     std::shared_ptr<Terminal> primary_term;                 /*!< Reference to the primary terminal (mostly for sending commands) */
     std::shared_ptr<Terminal> secondary_term;               /*!< Secondary terminal for this DTE */
     modem_mode mode;                                        /*!< DTE operation mode */
+    esp_modem_cmux_config cmux_config{};                    /*!< CMUX configuration used when entering CMUX mode */
+    uint32_t task_stack_size;                               /*!< Stack size of the command task */
+    unsigned task_priority;                                 /*!< Priority of the command task */
     std::function<bool(uint8_t *data, size_t len)> on_data; /*!< on data callback for current terminal */
     std::function<void(terminal_error err)> user_error_cb;  /*!< user callback on error event from attached terminals */
-
-#ifdef CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
-    /**
-     * @brief Implements an extra buffer that is used to capture partial reads from underlying terminals
-     * when we run out of the standard buffer
-     */
-    struct extra_buffer {
-        extra_buffer(): buffer(nullptr) {}
-        ~extra_buffer()
-        {
-            delete buffer;
-        }
-        std::vector<uint8_t> *buffer;
-        size_t consumed{0};
-        void grow(size_t need_size);
-        void deflate()
-        {
-            grow(0);
-            consumed = 0;
-        }
-        [[nodiscard]] uint8_t *begin() const
-        {
-            return &buffer->at(0);
-        }
-        [[nodiscard]] uint8_t *current() const
-        {
-            return &buffer->at(0) + consumed;
-        }
-    } inflatable;
-#endif // CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
+    Stats<dte_stats> stats;                                 /*!< Traffic, errors and commands of this DTE */
+    std::shared_ptr<Stats<cmux_stats>> cmux_counters{std::make_shared<Stats<cmux_stats>>()};   /*!< CMUX statistics, shared with the CMux instances */
 
     /**
      * @brief Set internal command callbacks to the underlying terminal.
@@ -192,17 +286,25 @@ private:
      */
     struct command_cb {
         static const size_t GOT_LINE = SignalGroup::bit0;       /*!< Bit indicating response available */
+        static const size_t GOT_DATA = SignalGroup::bit1;       /*!< Bit indicating a chunk of streamed reply received */
         got_line_cb got_line;                                   /*!< Supplied command callback */
+        stream_cb stream;                                       /*!< Supplied callback of streamed command */
+        stream_state state{};                                   /*!< Continuation state of the streamed reply */
         Lock line_lock{};                                       /*!< Command callback locking mechanism */
         char separator{};                                       /*!< Command reply separator (end of line/processing unit) */
+        std::string_view command{};                             /*!< Command in progress */
         command_result result{};                                /*!< Command return code */
         SignalGroup signal;                                     /*!< Event group used to signal request-response operations */
         bool process_line(uint8_t *data, size_t consumed, size_t len);  /*!< Lets the processing callback handle one line (processing unit) */
+        bool process_line(ring_buffer &ring, size_t len);       /*!< Handles the line collected in the ring buffer (`len` bytes just added) */
+        bool process_chunk(ring_buffer &ring, uint8_t *data, size_t len);  /*!< Passes the chunk to the stream callback, keeps the rest in the ring */
+        bool process_chunk(ring_buffer &ring);                  /*!< Passes the data kept in the ring buffer to the stream callback */
+        bool feed(uint8_t *data, size_t len);                   /*!< Calls the stream callback, returns true if the command completed */
         bool wait_for_line(uint32_t time_ms)                    /*!< Waiting for command processing */
         {
             return signal.wait_any(command_cb::GOT_LINE, time_ms);
         }
-        void set(got_line_cb l, char s = '\n')                  /*!< Sets the command callback atomically */
+        void set(got_line_cb l, char s = '\n', std::string_view cmd = {})  /*!< Sets the command callback atomically */
         {
             Scoped<Lock> lock(line_lock);
             if (l) {
@@ -216,7 +318,18 @@ private:
                 }
             }
             got_line = std::move(l);
+            stream = nullptr;
             separator = s;
+            command = cmd;
+        }
+        void set_stream(stream_cb cb, std::string_view cmd)    /*!< Sets the stream callback atomically */
+        {
+            Scoped<Lock> lock(line_lock);
+            signal.clear(GOT_LINE | GOT_DATA);
+            result = command_result::TIMEOUT;
+            state = {};
+            stream = std::move(cb);
+            command = cmd;
         }
         void give_up()                                          /*!< Reports other than timeout error when processing replies (out of buffer) */
         {
@@ -224,6 +337,51 @@ private:
             signal.set(GOT_LINE);
         }
     } command_cb;                                               /*!< Command callback utility class */
+
+    /**
+     * @brief Queue of asynchronous commands, which are sent from the command task (created on first use)
+     */
+    struct command_queue {
+        static const size_t REQUEST = SignalGroup::bit0;        /*!< Bit indicating queued commands */
+        static const size_t EXIT = SignalGroup::bit1;           /*!< Bit requesting the command task to exit */
+        static const size_t EXITED = SignalGroup::bit2;         /*!< Bit indicating the command task has finished */
+        struct request {
+            std::string command;
+            got_line_cb got_line;
+            uint32_t time_ms;
+            char separator;
+            std::promise<command_result> result;
+            std::function<void(bool cancelled)> job;            /*!< Job to run instead of the command, if set */
+        };
+        Lock lock{};                                            /*!< Locks the queue */
+        std::deque<request> requests;                           /*!< Pending commands */
+        SignalGroup signal;                                     /*!< Event group to wake up and stop the command task */
+        std::unique_ptr<Task> task;                             /*!< Command task */
+    } async_commands;                                           /*!< Asynchronous commands */
+
+    /**
+     * @brief Splits lines of unsolicited result codes (URC) out of the command terminal's stream (created on first use)
+     */
+    struct urc_router {
+        static const size_t max_line = 128;                     /*!< Maximum length of URC line (longer lines are truncated) */
+        static const size_t pending_size = 512;                 /*!< Size of the buffer of URC lines waiting for dispatch */
+        enum class line_state { LINE_START, SOLICITED, URC } state{line_state::LINE_START};
+        struct entry {
+            std::string prefix;
+            std::string key;                                    /*!< Prefix without trailing ": " to match the command in progress */
+            urc_cb cb;
+        };
+        std::vector<entry> entries;                             /*!< Handlers sorted by prefix */
+        uint8_t line[max_line]{};                               /*!< Beginning of the current line (or the entire URC line) */
+        size_t line_len{0};
+        ring_buffer pending{pending_size};                      /*!< Complete URC lines to be dispatched */
+        bool posted{false};                                     /*!< Dispatch of the pending lines posted to the command task */
+        const entry *find(const uint8_t *data, size_t len, bool &partial) const;   /*!< Finds the handler, `partial` if the data could still match */
+    };
+    std::unique_ptr<urc_router> urc;                            /*!< URC router, if any handler set */
+    bool read_urc(urc_router &router, uint8_t *data, size_t len);
+    bool route_urc(urc_router &router, uint8_t *data, size_t len);
+    void dispatch_urc();                                        /*!< Calls the handlers of the pending URC lines (from the command task) */
 };
 
 /**
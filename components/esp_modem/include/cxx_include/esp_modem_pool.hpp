@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cxx_include/esp_modem_dce.hpp"
+#include "cxx_include/esp_modem_primitives.hpp"
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_POOL
+ * @brief Pool of modems served by a fixed number of worker tasks
+ */
+
+/** @addtogroup ESP_MODEM_POOL
+* @{
+*/
+
+/**
+ * @brief Configuration of the modem pool
+ */
+struct modem_pool_config {
+    size_t workers = 2;                     /*!< Worker tasks running the jobs and health checks of all modems */
+    size_t task_stack_size = 4096;          /*!< Stack size of the workers */
+    size_t task_priority = 5;               /*!< Priority of the workers */
+    uint32_t health_period_ms = 30000;      /*!< Period of health checks of each modem, 0 to disable them */
+    uint32_t max_checks_per_second = 10;    /*!< Health checks started per second across the pool (spreads them over the period) */
+    uint32_t failures_to_down = 3;          /*!< Consecutive failed checks to consider the modem down */
+    uint32_t job_timeout_ms = 0;            /*!< Time a worker waits for a job (or check), 0 to run the jobs on the workers.
+                                                 Otherwise, the jobs run on the command tasks of their DCEs (see DTE::post())
+                                                 and a worker continues with other modems after the timeout,
+                                                 while the modem stays busy until its job completes */
+};
+
+/**
+ * @brief Health of a modem in the pool
+ */
+enum class modem_health {
+    UNKNOWN,        /*!< Not checked yet */
+    UP,             /*!< The last health check succeeded */
+    DEGRADED,       /*!< The last check(s) failed, but less than `failures_to_down` in a row */
+    DOWN,           /*!< `failures_to_down` or more checks failed in a row */
+};
+
+/**
+ * @brief Status of a modem, updated by its health checks
+ */
+struct modem_status {
+    int id{-1};                             /*!< Identifier of the modem in the pool */
+    std::string name;                       /*!< Name given when adding the modem */
+    modem_health health{modem_health::UNKNOWN};
+    int rssi{99};                           /*!< Signal quality (AT+CSQ) of the last successful check, 99 if unknown */
+    int ber{99};
+    int attached{-1};                       /*!< Network attachment state (AT+CGATT?), -1 if unknown */
+    command_result last_result{command_result::TIMEOUT};    /*!< Result of the last check */
+    uint32_t checks{0};                     /*!< Health checks done */
+    uint32_t failures{0};                   /*!< Consecutive failed checks */
+    uint32_t jobs{0};                       /*!< Jobs run */
+    uint32_t late{0};                       /*!< Jobs and checks which exceeded `job_timeout_ms` */
+    size_t pending{0};                      /*!< Jobs waiting to run */
+};
+
+/**
+ * @brief Aggregate status of the pool
+ */
+struct modem_pool_status {
+    size_t modems{0};
+    size_t up{0};
+    size_t degraded{0};
+    size_t down{0};
+    size_t unknown{0};
+    size_t busy{0};                         /*!< Modems running a job or a check now */
+    size_t pending{0};                      /*!< Jobs waiting to run (all modems) */
+};
+
+/**
+ * @brief Pool owning many DCEs, which serves their jobs and periodic health checks by a fixed number of worker tasks
+ *
+ * Each modem runs one job (or check) at a time, in order, so the jobs of one modem could use its blocking
+ * commands as usual, while the workers interleave the modems. The terminals of the DTEs are read by
+ * their own tasks or, on linux, by the shared reactor threads, so the number of threads doesn't grow
+ * with the number of modems. Health checks are spread over time (`max_checks_per_second`) to avoid
+ * bursts of commands, and a slow or dead modem blocks only the worker checking it (up to the command timeouts,
+ * or up to `job_timeout_ms`, if set).
+ * Usage:
+ * @code{.cpp}
+ *   ModemPool pool(config);
+ *   for (auto &dev : devices) {
+ *       pool.add(dev.name, create_SIM7600_dce(&dce_config, create_vfs_dte(&dev.dte_config), dev.netif));
+ *   }
+ *   pool.post_all([](DCE &dce) { dce.set_mode(modem_mode::DATA_MODE); });
+ *   auto summary = pool.get_summary();
+ * @endcode
+ */
+class ModemPool {
+public:
+    /**
+     * @brief Job run on a modem of the pool (from a worker task)
+     */
+    using job = std::function<void(DCE &dce)>;
+
+    /**
+     * @brief Health check, which updates the status (`rssi`, `ber`, `attached`) and returns the result of the check
+     */
+    using health_check = std::function<command_result(DCE &dce, modem_status &status)>;
+
+    explicit ModemPool(const modem_pool_config &config = {});
+
+    /**
+     * @brief Stops the workers (after their current jobs) and destroys the modems, pending jobs are not run
+     */
+    ~ModemPool();
+
+    ModemPool(const ModemPool &) = delete;
+    ModemPool &operator=(const ModemPool &) = delete;
+
+    /**
+     * @brief Adds the modem to the pool, its first health check is scheduled right away
+     * @param name Name of the modem (for status reporting)
+     * @param dce DCE (with its DTE) owned by the pool from now on
+     * @return Identifier of the modem, -1 if `dce` is null
+     */
+    int add(const std::string &name, std::unique_ptr<DCE> dce);
+
+    /**
+     * @brief Removes the modem and destroys its DCE, waiting for the job it runs (pending jobs are dropped)
+     * @note Must not be called from a job of the same modem
+     * @return false if no such modem (or it's being removed)
+     */
+    bool remove(int id);
+
+    /**
+     * @brief Queues the job to run on the modem (after its previous jobs)
+     * @return false if no such modem
+     */
+    bool post(int id, job j);
+
+    /**
+     * @brief Queues the job to run on each modem of the pool
+     */
+    void post_all(const job &j);
+
+    /**
+     * @brief Replaces the health check (by default, AT+CSQ and AT+CGATT? in one command line)
+     */
+    void set_health_check(health_check check);
+
+    /**
+     * @brief Status of all the modems
+     */
+    std::vector<modem_status> get_status();
+
+    /**
+     * @brief Aggregate status of the pool
+     */
+    modem_pool_status get_summary();
+
+private:
+    static const size_t WORK = SignalGroup::bit0;       /*!< Bit indicating new jobs, completed jobs or changed modems */
+    static const size_t EXIT = SignalGroup::bit1;       /*!< Bit requesting the workers to exit */
+    static const size_t EXITED = SignalGroup::bit2;     /*!< Bit indicating all the workers have finished */
+    static const size_t IDLE = SignalGroup::bit3;       /*!< Bit indicating the modem has completed its job (`modem::idle`) */
+    static const size_t DONE = SignalGroup::bit0;       /*!< Bit indicating the job posted to the DCE has completed (in a signal group of the job) */
+
+    struct modem {
+        std::unique_ptr<DCE> dce;
+        modem_status status;
+        std::deque<job> jobs;
+        int64_t next_check_ms{0};
+        bool busy{false};
+        bool removed{false};
+        SignalGroup *idle{nullptr};                     /*!< Signalled when the busy modem completes its job (to remove it) */
+    };
+
+    void worker();
+    modem *pick(int64_t now, job &j, uint32_t &wait_ms);
+    void run(modem &m, const job &j);
+    void check(modem &m);
+    void wait_idle(int id);
+
+    modem_pool_config config;
+    health_check check_cb;
+    Lock lock;                                          /*!< Locks the modems and their queues (not the DCEs) */
+    std::map<int, std::unique_ptr<modem>> modems;
+    int next_id{0};
+    int cursor{0};                                      /*!< Modem to look at first for jobs, so that all modems take turns */
+    int64_t next_check_allowed_ms{0};                   /*!< Rate limit of health checks */
+    bool exit{false};
+    size_t running{0};                                  /*!< Workers which haven't finished yet */
+    SignalGroup signal;
+    std::vector<std::unique_ptr<Task>> workers;
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
@@ -10,6 +10,7 @@
 #include "esp_modem_exception.hpp"
 
 #if defined(CONFIG_IDF_TARGET_LINUX)
+#include <atomic>
 #include <mutex>
 #include <thread>
 
@@ -38,7 +39,19 @@ private:
 using TaskT = TaskHandle_t;
 using SignalT = EventGroupHandle_t;
 #else
-using Lock = std::recursive_mutex;
+/**
+ * @brief Recursive lock on a futex: locking and unlocking without contention doesn't enter the kernel,
+ * contended lock spins shortly before sleeping (critical sections of the DTE are short)
+ */
+struct Lock {
+    Lock() = default;
+    void lock();
+    void unlock();
+private:
+    std::atomic<uint32_t> state{0};             /*!< 0: unlocked, 1: locked, 2: locked with (possible) waiters */
+    std::atomic<std::thread::id> owner{};
+    uint32_t count{0};                          /*!< Recursion depth, accessed by the owner only */
+};
 struct SignalGroupInternal;
 using SignalT = std::unique_ptr<SignalGroupInternal>;
 using TaskT = std::thread;
@@ -66,6 +79,12 @@ public:
     explicit Task(size_t stack_size, size_t priority, void *task_param, TaskFunction_t task_function);
     ~Task();
 
+    /**
+     * @brief Forgets the task, which has deleted itself (or is about to, by Delete()), so that the destructor doesn't delete it again
+     * (the destructor still joins the thread on linux)
+     */
+    void release();
+
     static void Delete();
     static void Relinquish();
     static void Delay(uint32_t delay);
@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "cxx_include/esp_modem_types.hpp"
+#include "cxx_include/esp_modem_primitives.hpp"
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_RESPONSE_CACHE
+ * @brief Cache of replies to commands querying static or slow-changing state of the modem
+ */
+
+/** @addtogroup ESP_MODEM_RESPONSE_CACHE
+* @{
+*/
+
+/**
+ * @brief Time to live of cached replies per command (in ms), 0 disables caching of the command
+ */
+struct cache_config {
+    static constexpr uint32_t infinite = UINT32_MAX;    /*!< Replies valid until invalidated */
+    uint32_t imei_ttl_ms = infinite;
+    uint32_t imsi_ttl_ms = infinite;
+    uint32_t module_name_ttl_ms = infinite;
+    uint32_t operator_name_ttl_ms = 10000;
+    uint32_t signal_quality_ttl_ms = 2000;
+};
+
+/**
+ * @brief Commandable object caching the replies to configured commands
+ *
+ * It's placed between the module and its DTE, so the commands of the module which hit the cache
+ * are completed with the stored reply without talking to the device.
+ * Replies with infinite TTL are kept until invalidate() is called for all (e.g. on SIM events), replies with
+ * finite TTL are also invalidated on mode switching. Commands which reset the device or change the SIM state
+ * (AT+CRESET, AT+CFUN=, AT+CPIN=, power down) invalidate all the replies.
+ */
+class ResponseCache: public CommandableIf {
+public:
+    struct stats {
+        uint32_t hits;      /*!< Commands completed from the cache */
+        uint32_t misses;    /*!< Cacheable commands sent to the device */
+    };
+
+    ResponseCache(CommandableIf *t, const cache_config &config);
+
+    /**
+     * @brief Sets time to live of the reply to the command (0 to disable caching)
+     * @param command Command as sent to the device, e.g. "AT+CGSN\r"
+     */
+    void set_ttl(std::string_view command, uint32_t ttl_ms);
+
+    /**
+     * @brief Invalidates cached replies
+     * @param all Invalidate all replies, or only those with finite TTL
+     */
+    void invalidate(bool all = true);
+
+    [[nodiscard]] stats get_stats();
+
+    command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms, char separator) override;
+    command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms) override;
+    command_result command(const char *command, size_t len, got_line_cb got_line, uint32_t time_ms, char separator) override;
+    command_result stream_command(const char *command, size_t len, stream_cb on_chunk, uint32_t time_ms) override;
+    int write(uint8_t *data, size_t len) override;
+    void on_read(got_line_cb on_data) override;
+
+private:
+    using clock = std::chrono::steady_clock;
+    struct entry {
+        std::string command;
+        uint32_t ttl_ms;
+        bool valid{false};
+        clock::time_point stored{};
+        std::string reply;                  /*!< Reply which completed the command */
+    };
+    entry *find(std::string_view command);
+    CommandableIf *t;
+    Lock lock{};
+    std::vector<entry> entries;
+    stats counters{};
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
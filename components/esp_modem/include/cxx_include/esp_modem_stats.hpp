@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <string_view>
+#include "cxx_include/esp_modem_types.hpp"
+#include "cxx_include/esp_modem_primitives.hpp"
+#include "esp_modem_stats.h"
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_STATS
+ * @brief Runtime statistics of DTE and CMUX
+ */
+
+/** @addtogroup ESP_MODEM_STATS
+* @{
+*/
+
+using dte_stats = esp_modem_dte_stats;
+using cmux_stats = esp_modem_cmux_stats;
+
+/**
+ * @brief Statistics updated from several tasks (terminal's and user's)
+ *
+ * Updates are short and only lock the statistics, not the object they belong to
+ */
+template<class T>
+class Stats {
+public:
+    template<class F>
+    void update(F &&f)
+    {
+        Scoped<Lock> l(lock);
+        f(data);
+    }
+
+    T get()
+    {
+        Scoped<Lock> l(lock);
+        return data;
+    }
+
+    void reset()
+    {
+        Scoped<Lock> l(lock);
+        data = T{};
+    }
+
+private:
+    Lock lock;
+    T data{};
+};
+
+/**
+ * @brief Adds the completed command to the statistics of its name
+ * @param stats DTE statistics
+ * @param command Command as sent to the device, e.g. "AT+CSQ\r"
+ * @param result Result of the command
+ * @param time_ms Latency of the command (from sending it to the final reply or timeout)
+ */
+void add_command_stats(dte_stats &stats, std::string_view command, command_result result, uint32_t time_ms);
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
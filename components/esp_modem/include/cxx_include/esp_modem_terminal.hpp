@@ -12,6 +12,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <utility>
+#include <sys/uio.h>
 #include "esp_err.h"
 #include "esp_modem_primitives.hpp"
 
@@ -61,6 +62,33 @@ public:
      */
     virtual int write(uint8_t *data, size_t len) = 0;
 
+    /**
+     * @brief Writes multiple buffers to the terminal in one submission (scatter-gather)
+     *
+     * Default implementation writes the buffers one by one, terminals which are able
+     * to submit the entire vector at once (e.g. file descriptor based) should override it.
+     *
+     * @param iov Array of buffers to write
+     * @param iovcnt Number of buffers in the array
+     * @return total length of data written (less than the total length of the buffers if the write was incomplete),
+     *         -1 on error
+     */
+    virtual int writev(const struct iovec *iov, int iovcnt)
+    {
+        int total = 0;
+        for (int i = 0; i < iovcnt; ++i) {
+            int len = write(static_cast<uint8_t *>(iov[i].iov_base), iov[i].iov_len);
+            if (len < 0) {
+                return -1;
+            }
+            total += len;
+            if (static_cast<size_t>(len) < iov[i].iov_len) {
+                break;      // the following buffers must not be written after an incomplete one
+            }
+        }
+        return total;
+    }
+
     /**
      * @brief Read from the terminal. This function doesn't block, but return all available data.
      * @param data Data pointer to store the read payload
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <functional>
 #include <string>
 #include <cstddef>
@@ -50,6 +51,47 @@ enum class command_result {
 
 typedef std::function<command_result(uint8_t *data, size_t len)> got_line_cb;
 
+/**
+ * @brief Continuation state of a streamed reply, kept between the chunks passed to the callback
+ */
+struct stream_state {
+    size_t offset{0};       /*!< Bytes of the reply consumed before this chunk */
+    size_t consumed{0};     /*!< Set by the callback: bytes of this chunk consumed (all by default), the rest is passed again with more data */
+    int step{0};            /*!< Parsing step of the callback */
+    size_t remaining{0};    /*!< Bytes left in the current step of the callback (e.g. of a binary payload) */
+};
+
+/**
+ * @brief Callback to process the reply in chunks (returns TIMEOUT to continue, OK or FAIL to complete the command)
+ */
+typedef std::function<command_result(uint8_t *data, size_t len, stream_state &state)> stream_cb;
+
+/**
+ * @brief Caller's buffer for string outputs of commands, to avoid allocations
+ * (a simple alternative to std::span<char>, as the library is C++17)
+ * @note Longer outputs are truncated (as with strlcpy), zero sized buffer discards the output
+ */
+struct char_span {
+    char *data;         /*!< Buffer to store the output (null terminated) */
+    size_t size;        /*!< Size of the buffer */
+    size_t len{0};      /*!< Length of the output stored in the buffer */
+};
+
+/**
+ * @brief Callback providing data of the uploaded file (returns number of bytes, 0 at the end of file, -1 on error)
+ */
+typedef std::function<int(uint8_t *data, size_t len)> file_read_cb;
+
+/**
+ * @brief Callback receiving data of the downloaded file (returns false to abort the transfer)
+ */
+typedef std::function<bool(uint8_t *data, size_t len)> file_write_cb;
+
+/**
+ * @brief Callback to receive a line of unsolicited result code (URC)
+ */
+typedef std::function<void(uint8_t *line, size_t len)> urc_cb;
+
 /**
  * @brief PDP context used for configuring and setting the data mode up
  */
@@ -82,6 +124,40 @@ public:
     virtual command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms, const char separator) = 0;
     virtual command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms) = 0;
 
+    /**
+     * @brief Sends custom AT command without copying it to std::string
+     *
+     * @note The default implementation copies the command, override to avoid allocations
+     */
+    virtual command_result command(const char *command, size_t len, got_line_cb got_line, uint32_t time_ms, const char separator)
+    {
+        return this->command(std::string(command, len), std::move(got_line), time_ms, separator);
+    }
+
+    /**
+     * @brief Sends custom AT command and passes the reply in chunks to the callback, as it arrives
+     *
+     * @param command Command to be sent
+     * @param len Length of the command
+     * @param on_chunk Callback processing the chunks of the reply
+     * @param time_ms Timeout in milliseconds
+     * @return OK, FAIL or TIMEOUT
+     * @note The default implementation collects the whole reply, override to keep the memory constant
+     */
+    virtual command_result stream_command(const char *command, size_t len, stream_cb on_chunk, uint32_t time_ms)
+    {
+        stream_state state;
+        return this->command(command, len, [&](uint8_t *data, size_t data_len) {
+            if (data == nullptr || data_len <= state.offset) {
+                return command_result::TIMEOUT;
+            }
+            state.consumed = data_len - state.offset;
+            auto result = on_chunk(data + state.offset, data_len - state.offset, state);
+            state.offset += std::min(state.consumed, data_len - state.offset);
+            return result;
+        }, time_ms, '\n');
+    }
+
     virtual int write(uint8_t *data, size_t len) = 0;
     virtual void on_read(got_line_cb on_data) = 0;
 };
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "esp_modem_config.h"
+#include "esp_modem_stats.h"
 #include "esp_netif.h"
 
 #ifdef __cplusplus
@@ -140,6 +141,32 @@ esp_err_t esp_modem_command(esp_modem_dce_t *dce, const char *command, esp_err_t
  */
 esp_err_t esp_modem_set_apn(esp_modem_dce_t *dce, const char *apn);
 
+/**
+ * @brief Gets the statistics of the DTE: traffic of its terminals, errors and latency of commands
+ *
+ * @param dce Modem DCE handle
+ * @param[out] stats Statistics
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid arguments
+ */
+esp_err_t esp_modem_get_dte_stats(esp_modem_dce_t *dce, esp_modem_dte_stats_t *stats);
+
+/**
+ * @brief Gets the statistics of CMUX (traffic per DLCI and protocol errors), accumulated over all CMUX sessions
+ *
+ * @param dce Modem DCE handle
+ * @param[out] stats Statistics
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid arguments
+ */
+esp_err_t esp_modem_get_cmux_stats(esp_modem_dce_t *dce, esp_modem_cmux_stats_t *stats);
+
+/**
+ * @brief Resets the DTE and CMUX statistics
+ *
+ * @param dce Modem DCE handle
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid arguments
+ */
+esp_err_t esp_modem_reset_stats(esp_modem_dce_t *dce);
+
 /**
  * @}
  */
@@ -53,6 +53,23 @@ struct esp_modem_uart_term_config {
     int event_queue_size;           /*!< UART Event Queue Size, set to 0 if no event queue needed */
 };
 
+/**
+ * @brief CMUX configuration structure
+ *
+ */
+struct esp_modem_cmux_config {
+    size_t terminals_num;           /*!< Number of CMUX virtual terminals (DLCIs), 0 for default (2), maximum is 8.
+                                     *   The first two are used by DTE for commands and data, others could be opened
+                                     *   by the application (e.g. for GNSS or file transfer) */
+    size_t max_frame_size;          /*!< Maximum size of CMUX frame payload (N1) used for sending, 0 for default (127)
+                                     *   Sizes over 127 bytes are sent with 2-byte length field, so the device must support it */
+    bool negotiate_params;          /*!< Negotiate DLC parameters (PN) of each virtual terminal with the device when entering CMUX mode,
+                                     *   the frame size agreed with the device is then used for sending. Defaults are kept if the device
+                                     *   does not reply */
+    bool ui_frames;                 /*!< Send UI frames (FCS calculated over the entire frame) instead of UIH frames,
+                                     *   the device must support UI frames */
+};
+
 // Forward declare the resource struct
 struct esp_modem_vfs_resource;
 
@@ -82,6 +99,8 @@ struct esp_modem_dte_config {
         struct esp_modem_vfs_term_config vfs_config;        /*!< Configuration for VFS Terminal */
         void *extension_config;                             /*!< Configuration for app specific Terminal */
     };
+    struct esp_modem_cmux_config cmux_config;           /*!< Configuration of CMUX protocol (used only in CMUX modes) */
+    size_t reply_buffer_size;                           /*!< Size of the buffer collecting replies to AT commands (0 to use dte_buffer_size) */
 };
 
 #if ESP_IDF_VERSION_MAJOR >= 5
@@ -115,6 +134,13 @@ struct esp_modem_dte_config {
             .tx_buffer_size = 512,                  \
             .event_queue_size = 30,                 \
        },                                           \
+        .cmux_config = {               \
+            .terminals_num = 2,        \
+            .max_frame_size = 127,     \
+            .negotiate_params = false, \
+            .ui_frames = false,        \
+        },                             \
+        .reply_buffer_size = 0,        \
     }
 
 typedef struct esp_modem_dte_config esp_modem_dte_config_t;
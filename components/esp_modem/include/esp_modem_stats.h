@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup ESP_MODEM_STATS
+ * @brief Runtime statistics of DTE and CMUX
+ */
+
+/** @addtogroup ESP_MODEM_STATS
+ * @{
+ */
+
+#define ESP_MODEM_STATS_COMMANDS_NUM        16  /*!< Commands with separate statistics (others are counted as "other") */
+#define ESP_MODEM_STATS_COMMAND_NAME_LEN    16  /*!< Maximum length of the command name (incl. terminating zero) */
+#define ESP_MODEM_STATS_LATENCY_BUCKETS     12  /*!< Latency buckets: <1ms, <2ms, <4ms, ... <1024ms, >=1024ms */
+#define ESP_MODEM_STATS_TERMINAL_ERRORS     4   /*!< Number of terminal errors (esp_modem_terminal_error_t) */
+#define ESP_MODEM_STATS_CMUX_CHANNELS       9   /*!< CMUX channels: control (DLCI 0) and virtual terminals (DLCI 1..8) */
+#define ESP_MODEM_STATS_CMUX_RECOVERY_REASONS 7 /*!< Reasons of CMUX protocol recovery */
+
+/**
+ * @brief Traffic of a channel (DTE terminal or CMUX DLCI)
+ */
+struct esp_modem_channel_stats {
+    uint64_t rx_bytes;          /*!< Received bytes (payload) */
+    uint64_t tx_bytes;          /*!< Sent bytes (payload) */
+    uint32_t rx_frames;         /*!< Received CMUX frames (0 on DTE terminals) */
+    uint32_t tx_frames;         /*!< Sent CMUX frames (0 on DTE terminals) */
+};
+
+/**
+ * @brief Statistics of AT commands of the same name (the command up to the first of "=?;")
+ */
+struct esp_modem_command_stats {
+    char name[ESP_MODEM_STATS_COMMAND_NAME_LEN];    /*!< Command name, e.g. "AT+CSQ" */
+    uint32_t count;             /*!< Commands sent */
+    uint32_t failures;          /*!< Commands which failed (ERROR reply) */
+    uint32_t timeouts;          /*!< Commands which timed out */
+    uint32_t max_ms;            /*!< Maximum latency */
+    uint64_t total_ms;          /*!< Sum of the latencies (to calculate the average) */
+    uint32_t latency[ESP_MODEM_STATS_LATENCY_BUCKETS];  /*!< Histogram: bucket i counts commands completed within 2^i ms, the last one the slower ones */
+};
+
+/**
+ * @brief Statistics of DTE
+ */
+struct esp_modem_dte_stats {
+    struct esp_modem_channel_stats command;     /*!< Command terminal (commands, replies and URCs) */
+    struct esp_modem_channel_stats data;        /*!< Data terminal (data mode) */
+    uint32_t errors[ESP_MODEM_STATS_TERMINAL_ERRORS];  /*!< Terminal errors, indexed by esp_modem_terminal_error_t */
+    uint32_t recoveries;                        /*!< Recoveries requested on the DTE */
+    size_t commands_num;                        /*!< Valid entries in `commands` */
+    struct esp_modem_command_stats commands[ESP_MODEM_STATS_COMMANDS_NUM];     /*!< Statistics per command name */
+};
+
+/**
+ * @brief Statistics of CMUX (accumulated over all CMUX sessions of the DTE)
+ */
+struct esp_modem_cmux_stats {
+    struct esp_modem_channel_stats channels[ESP_MODEM_STATS_CMUX_CHANNELS];    /*!< Traffic per DLCI */
+    uint32_t fcs_errors;        /*!< Frames dropped due to wrong FCS */
+    /**
+     * Protocol recoveries, indexed by the reason: missed leading SOF, missed trailing SOF, wrong CRC,
+     * unexpected header, unexpected data, read behind buffer, unknown (requested by the DTE)
+     */
+    uint32_t recoveries[ESP_MODEM_STATS_CMUX_RECOVERY_REASONS];
+};
+
+typedef struct esp_modem_dte_stats esp_modem_dte_stats_t;
+typedef struct esp_modem_cmux_stats esp_modem_cmux_stats_t;
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
@@ -14,30 +14,57 @@
 #include <thread>
 #include <atomic>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cerrno>
 #include <cstring>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <termios.h>
 #include <unistd.h>
 #include <linux/if_tun.h>
 #include "esp_netif.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "tun_io.h"
 
-#define BUF_SIZE 1518
+#define PPP_BUF_SIZE 4096       // HDLC frames could be up to twice the MTU due to escaping
+#define PPP_DEFAULT_OPTIONS "nodetach noauth local defaultroute usepeerdns"
 
 static const char *TAG = "esp_netif_linux";
 
-extern "C" int ppp_netif_init(esp_netif_t *netif);
-extern "C" int tun_read(void);
+extern char **environ;
 
-class NetifStorage;
+/**
+ * @brief Network interface, i.e. the data path of PPP received from the modem
+ */
+class NetifStorage: public esp_netif_obj {
+public:
+    NetifStorage(): esp_netif_obj() {}
+    virtual ~NetifStorage() = default;
 
-void read_task(NetifStorage *netif);
+    /**
+     * @brief Processes PPP data received from the modem
+     */
+    virtual int receive(uint8_t *data, size_t len) = 0;
+};
 
-class NetifStorage: public esp_netif_obj {
+/**
+ * @brief User space PPP (lwIP) relaying IP packets to a TUN interface
+ *
+ * Packets are read from the TUN device in batches directly to pbufs and written to it
+ * gathered from the pbuf chains. With `multi_queue`, several sessions attach to the same
+ * interface as separate queues, each with its own reader thread.
+ */
+class TunNetif: public NetifStorage {
 public:
-    explicit NetifStorage(const esp_netif_config_t *config) : esp_netif_obj(), exit(false)
+    explicit TunNetif(const esp_netif_config_t *config) : exit(false)
     {
         if ((fd = open(config->dev_name, O_RDWR)) == -1) {
             ESP_LOGE(TAG, "Cannot open %s", config->dev_name);
@@ -45,51 +72,220 @@ public:
         }
         struct ifreq ifr = { };
         ifr.ifr_flags = IFF_TUN;
-        strncpy(ifr.ifr_name, config->if_name, IFNAMSIZ);
+        if (config->multi_queue) {
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        }
+        strncpy(ifr.ifr_name, config->if_name, IFNAMSIZ - 1);
 
         if (ioctl(fd, TUNSETIFF, (void *)&ifr) == -1) {
             ESP_LOGE(TAG, "Cannot set ioctl TUNSETIFF %m");
+            close(fd);
             throw std::runtime_error("Failed to set tun device interface name");
         }
         ioctl(fd, TUNSETNOCSUM, 1);
+        // packets are read in batches until EAGAIN
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-        in_buf = new uint8_t[BUF_SIZE];
-        out_buf = new uint8_t[BUF_SIZE];
-
-        if (!ppp_netif_init(this)) {
+        if ((tun = tun_ppp_create(this)) == nullptr) {
             ESP_LOGE(TAG, "Cannot initialize pppos lwip netif %m");
+            close(fd);
             throw std::runtime_error("Failed setup ppp interface");
         }
 
         task = std::thread(read_task, this);
     }
 
-    ~NetifStorage()
+    ~TunNetif() override
     {
         exit = true;
         task.join();
+        tun_ppp_destroy(tun);
         close(fd);
-        delete[] in_buf;
-        delete[] out_buf;
     }
 
-    std::thread task;
-    std::atomic<bool> exit;
+    int receive(uint8_t *data, size_t len) override
+    {
+        return tun_ppp_input(tun, data, len);
+    }
 
-    static void read_task(NetifStorage *netif)
+private:
+    static void read_task(TunNetif *netif)
     {
         while (!netif->exit.load()) {
-            tun_read();
+            tun_ppp_read(netif->tun);
         }
     }
+
+    struct tun_ppp *tun;
+    std::thread task;
+    std::atomic<bool> exit;
 };
 
+/**
+ * @brief Kernel PPP
+ *
+ * PPP data are bridged to a pseudo terminal, which pppd attaches to the kernel PPP line discipline (N_PPP)
+ * and to a /dev/ppp unit. pppd only negotiates the link, the kernel does the HDLC framing and routes
+ * the packets via the `pppN` interface.
+ */
+class KernelPppNetif: public NetifStorage {
+public:
+    explicit KernelPppNetif(const esp_netif_config_t *config) : exit(false)
+    {
+        if (access(config->dev_name, R_OK | W_OK) != 0) {
+            ESP_LOGE(TAG, "Cannot access %s %m (is ppp_generic loaded, are we privileged?)", config->dev_name);
+            throw std::runtime_error("Kernel PPP not available");
+        }
+        fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+            ESP_LOGE(TAG, "Cannot open a pseudo terminal %m");
+            release();
+            throw std::runtime_error("Failed to open pseudo terminal");
+        }
+        std::string tty = ptsname(fd);
+        // keep the slave open, so that the master doesn't hang up before pppd opens it
+        slave = open(tty.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (slave < 0) {
+            ESP_LOGE(TAG, "Cannot open %s %m", tty.c_str());
+            release();
+            throw std::runtime_error("Failed to open pseudo terminal");
+        }
+        struct termios tio = { };
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        // don't block the DTE if nobody reads the link (PPP retransmits what we drop)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        buf = std::make_unique<uint8_t[]>(PPP_BUF_SIZE);
+
+        if (!spawn_pppd(tty, config)) {
+            release();
+            throw std::runtime_error("Failed to start pppd");
+        }
+        task = std::thread(read_task, this);
+    }
 
+    ~KernelPppNetif() override
+    {
+        exit = true;
+        task.join();
+        release();
+    }
 
+    int receive(uint8_t *data, size_t len) override
+    {
+        while (len > 0) {
+            auto written = write(fd, data, len);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ESP_LOGW(TAG, "Dropping %d bytes of PPP data (%m)", (int)len);
+                return 0;
+            }
+            data += written;
+            len -= written;
+        }
+        return 1;
+    }
+
+private:
+    bool spawn_pppd(const std::string &tty, const esp_netif_config_t *config)
+    {
+        std::vector<std::string> args = { "pppd", tty };
+        std::string options = config->ppp_options ? config->ppp_options : PPP_DEFAULT_OPTIONS;
+        for (size_t pos = options.find_first_not_of(' '); pos != std::string::npos; pos = options.find_first_not_of(' ', pos)) {
+            auto end = options.find(' ', pos);
+            args.emplace_back(options.substr(pos, end - pos));
+            pos = end;
+        }
+        if (config->if_name) {
+            args.emplace_back("ifname");
+            args.emplace_back(config->if_name);
+        }
+        std::vector<char *> argv;
+        for (auto &arg : args) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+        int err = posix_spawnp(&pppd, "pppd", nullptr, nullptr, argv.data(), environ);
+        if (err != 0) {
+            ESP_LOGE(TAG, "Cannot start pppd: %s", strerror(err));
+            pppd = -1;
+            return false;
+        }
+        ESP_LOGI(TAG, "pppd (pid %d) started on %s", pppd, tty.c_str());
+        return true;
+    }
+
+    void stop_pppd()
+    {
+        if (pppd <= 0) {
+            return;
+        }
+        kill(pppd, SIGTERM);
+        // give pppd time to terminate the link
+        for (int i = 0; i < 30; ++i) {
+            if (waitpid(pppd, nullptr, WNOHANG) == pppd) {
+                pppd = -1;
+                return;
+            }
+            usleep(100'000);
+        }
+        kill(pppd, SIGKILL);
+        waitpid(pppd, nullptr, 0);
+        pppd = -1;
+    }
+
+    void release()
+    {
+        stop_pppd();
+        if (slave >= 0) {
+            close(slave);
+            slave = -1;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    static void read_task(KernelPppNetif *netif)
+    {
+        while (!netif->exit.load()) {
+            struct pollfd pfd = { netif->fd, POLLIN, 0 };
+            if (poll(&pfd, 1, 1000) > 0 && (pfd.revents & POLLIN)) {
+                auto len = read(netif->fd, netif->buf.get(), PPP_BUF_SIZE);
+                if (len > 0 && netif->transmit) {
+                    netif->transmit(netif->ctx, netif->buf.get(), len);
+                }
+            }
+            int status;
+            if (netif->pppd > 0 && waitpid(netif->pppd, &status, WNOHANG) == netif->pppd) {
+                ESP_LOGW(TAG, "pppd exited (status %d)", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+                netif->pppd = -1;
+            }
+        }
+    }
+
+    std::unique_ptr<uint8_t[]> buf;
+    int slave = -1;
+    pid_t pppd = -1;
+    std::thread task;
+    std::atomic<bool> exit;
+};
 
 extern "C" esp_netif_t *esp_netif_new(const esp_netif_config_t *config)
 {
-    return new NetifStorage(config);
+    if (config->dev_name && strcmp(config->dev_name, "/dev/ppp") == 0) {
+        return new KernelPppNetif(config);
+    }
+    return new TunNetif(config);
+}
+
+extern "C" int esp_netif_receive(esp_netif_t *netif, uint8_t *data, size_t len)
+{
+    return static_cast<NetifStorage *>(netif)->receive(data, len);
 }
 
 void esp_netif_destroy(esp_netif_t *netif)
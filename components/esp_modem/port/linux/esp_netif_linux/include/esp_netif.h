@@ -38,14 +38,27 @@ struct esp_netif_driver_ifconfig {
     void (*driver_free_rx_buffer)(void *h, void *buffer);
 };
 
+/**
+ * @brief Configuration of the network interface
+ *
+ * `dev_name` selects the data path:
+ * - "/dev/net/tun" (or another TUN device): PPP runs in user space (lwIP) and IP packets are relayed to the TUN interface
+ * - "/dev/ppp": kernel PPP, the PPP data are bridged to a pseudo terminal with the kernel PPP line discipline (N_PPP)
+ *   attached by pppd, which negotiates the link and creates the `pppN` interface. The kernel does the framing and routing.
+ *
+ * @note Neither of the data paths posts IP_EVENT_PPP_GOT_IP/IP_EVENT_PPP_LOST_IP (the linux port has no event loop,
+ * registering event handlers has no effect), so don't wait for these events. Check the state of the interface
+ * in the system instead (e.g. its address), or the PPP status in lwIP (TUN).
+ */
 struct esp_netif_config {
     const char *dev_name;  /**< Name of the file device */
-    const char *if_name;   /**< Network interface name */
+    const char *if_name;   /**< Network interface name (kernel PPP: passed as pppd `ifname`, NULL for the default `pppN`) */
+    const char *ppp_options; /**< Kernel PPP only: pppd options (NULL for "nodetach noauth local defaultroute usepeerdns") */
+    bool multi_queue;      /**< TUN only: attach as a queue of a multi-queue interface (IFF_MULTI_QUEUE), so that several
+                                sessions with the same `if_name` share it, each served by its own thread */
 };
 
 struct esp_netif_obj {
-    uint8_t *in_buf;
-    uint8_t *out_buf;
     int fd;
     esp_err_t (*transmit)(void *h, void *buffer, size_t len);
     void *ctx;
@@ -0,0 +1,36 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TUN_HEADER_LEN  4       // Flags and protocol preceding each packet on the TUN device (no IFF_NO_PI)
+#define TUN_MAX_IOV     32      // Maximum buffers in one packet (including the header)
+
+/**
+ * @brief Writes one packet to the TUN device, gathering the payload from the buffers behind the header (one writev())
+ * @param count Number of the payload buffers, up to TUN_MAX_IOV - 1
+ * @return 0 if the whole packet was written, -1 otherwise
+ */
+int tun_write_packet(int fd, const uint8_t header[TUN_HEADER_LEN], const struct iovec *payload, int count);
+
+/**
+ * @brief Reads one packet from the TUN device, scattering the payload to the buffers behind the header (one readv())
+ * @param count Number of the payload buffers, up to TUN_MAX_IOV - 1
+ * @return Length of the payload, 0 if the packet was too short, -1 if no packet was read (EAGAIN on a non-blocking device)
+ */
+ssize_t tun_read_packet(int fd, uint8_t header[TUN_HEADER_LEN], const struct iovec *payload, int count);
+
+#ifdef __cplusplus
+}
+#endif
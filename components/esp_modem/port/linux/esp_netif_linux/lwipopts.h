@@ -176,8 +176,9 @@ a lot of data that needs to be copied, this should be set high. */
 /* PBUF_POOL_SIZE: the number of buffers in the pbuf pool. */
 #define PBUF_POOL_SIZE          120
 
-/* PBUF_POOL_BUFSIZE: the size of each pbuf in the pbuf pool. */
-#define PBUF_POOL_BUFSIZE       256
+/* PBUF_POOL_BUFSIZE: the size of each pbuf in the pbuf pool.
+   Holds a whole packet (MTU), so that TUN reads and writes need just one iovec per packet */
+#define PBUF_POOL_BUFSIZE       1536
 
 /** SYS_LIGHTWEIGHT_PROT
  * define SYS_LIGHTWEIGHT_PROT in lwipopts.h if you want inter-task protection
@@ -304,7 +305,7 @@ a lot of data that needs to be copied, this should be set high. */
 
 #if PPP_SUPPORT
 
-#define NUM_PPP                 1      /* Max PPP sessions. */
+#define NUM_PPP                 4      /* Max PPP sessions (e.g. queues of a multi-queue TUN). */
 
 
 /* Select modules to enable.  Ideally these would be set in the makefile but
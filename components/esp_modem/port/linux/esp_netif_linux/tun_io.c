@@ -1,22 +1,40 @@
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <sys/select.h>
 #include "netif/ppp/pppos.h"
 #include "lwip/ip6.h"
 #include "lwip/tcpip.h"
-#include "netif/ppp/pppos.h"
 #include "lwip/dns.h"
 #include "esp_netif.h"
+#include "tun_io.h"
+#include "tun_packet.h"
 
-#define BUF_SIZE 1518
+#define TUN_MTU         1500
+#define TUN_READ_BATCH  16      // Maximum packets read from the TUN device per wake-up
 
 void ppp_init(void);
 
-static const unsigned char ip6_header[4] = { 0, 0, 0x86, 0xdd };  // Ethernet (IPv6)
-static const unsigned char ip4_header[4] = { 0, 0, 0x08, 0 };     // Ethernet (IPv4)
+static const uint8_t ip6_header[TUN_HEADER_LEN] = { 0, 0, 0x86, 0xdd };  // Ethernet (IPv6)
+static const uint8_t ip4_header[TUN_HEADER_LEN] = { 0, 0, 0x08, 0 };     // Ethernet (IPv4)
+
+/**
+ * PPP session relayed to a TUN device (or a queue of a multi-queue TUN device)
+ */
+struct tun_ppp {
+    esp_netif_t *esp_netif;
+    struct netif netif;
+    ppp_pcb *ppp;
+};
 
-static esp_netif_t *esp_netif = NULL;
-static struct netif pppos_netif;
-static ppp_pcb *ppp;
+/**
+ * lwIP runs without the tcpip thread, its core is called from the DTE's and TUN reader threads
+ * of all sessions, so these calls are serialized (TUN reads and writes are done without the lock)
+ */
+static pthread_mutex_t lwip_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t lwip_once = PTHREAD_ONCE_INIT;
 
 static void ppp_link_status_cb(ppp_pcb *pcb, int err_code, void *ctx)
 {
@@ -113,13 +131,7 @@ static u32_t ppp_output_cb(struct ppp_pcb_s *pcb, const void *data, u32_t len, v
     return  0;
 }
 
-int esp_netif_receive(esp_netif_t *netif, uint8_t *data, size_t len)
-{
-    pppos_input(ppp, data, len);
-    return 1;
-}
-
-int ppp_netif_init(esp_netif_t *netif)
+static void lwip_init_once(void)
 {
     // Init necessary units of lwip (no need for the tcpip thread)
     sys_init();
@@ -129,81 +141,144 @@ int ppp_netif_init(esp_netif_t *netif)
     dns_init();
     ppp_init();
     sys_timeouts_init();
+}
 
+struct tun_ppp *tun_ppp_create(esp_netif_t *netif)
+{
+    pthread_once(&lwip_once, lwip_init_once);
+    struct tun_ppp *tun = calloc(1, sizeof(struct tun_ppp));
+    if (tun == NULL) {
+        return NULL;
+    }
+    tun->esp_netif = netif;
     // init and start connection attempts on PPP interface
-    ppp = pppos_create(&pppos_netif, ppp_output_cb, ppp_link_status_cb, (void *)netif);
-    if (ppp == NULL) {
-        return 0;
+    pthread_mutex_lock(&lwip_lock);
+    tun->ppp = pppos_create(&tun->netif, ppp_output_cb, ppp_link_status_cb, (void *)netif);
+    if (tun->ppp) {
+        ppp_set_usepeerdns(tun->ppp, 1);
+        ppp_connect(tun->ppp, 0);
     }
-    ppp_connect(ppp, 0);
-    ppp_set_usepeerdns(ppp, 1);
-    esp_netif = netif;
-    return 1;
+    pthread_mutex_unlock(&lwip_lock);
+    if (tun->ppp == NULL) {
+        free(tun);
+        return NULL;
+    }
+    return tun;
 }
 
-static err_t tun_input(struct pbuf *p, const unsigned char tun_header[4])
+void tun_ppp_destroy(struct tun_ppp *tun)
 {
-    struct pbuf *n;
-    size_t offset = 4;
-    memcpy(esp_netif->in_buf, tun_header, offset);
-    for (n = p; n; n = n->next) {
-        memcpy(esp_netif->in_buf + offset, n->payload, n->len);
-        offset += n->len;
+    pthread_mutex_lock(&lwip_lock);
+    ppp_close(tun->ppp, 1);
+    if (ppp_free(tun->ppp) != ERR_OK) {
+        // the session hasn't terminated yet, at least unlink the netif we're about to free
+        netif_remove(&tun->netif);
     }
-    if (write(esp_netif->fd, esp_netif->in_buf, offset) != offset) {
+    pthread_mutex_unlock(&lwip_lock);
+    free(tun);
+}
+
+int tun_ppp_input(struct tun_ppp *tun, uint8_t *data, size_t len)
+{
+    pthread_mutex_lock(&lwip_lock);
+    pppos_input(tun->ppp, data, len);
+    pthread_mutex_unlock(&lwip_lock);
+    return 1;
+}
+
+/**
+ * @brief Writes the packet to the TUN device, gathering the pbuf chain behind the TUN header
+ */
+static err_t tun_input(struct pbuf *p, struct netif *inp, const uint8_t tun_header[TUN_HEADER_LEN])
+{
+    struct tun_ppp *tun = (struct tun_ppp *)((char *)inp - offsetof(struct tun_ppp, netif));
+    if (pbuf_clen(p) > TUN_MAX_IOV - 1) {
+        // too fragmented to gather, flatten it
+        struct pbuf *flat = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
         pbuf_free(p);
-        return ERR_ABRT;
+        if (flat == NULL) {
+            return ERR_MEM;
+        }
+        p = flat;
     }
+    struct iovec iov[TUN_MAX_IOV - 1];
+    int iovcnt = 0;
+    for (struct pbuf *q = p; q; q = q->next) {
+        iov[iovcnt].iov_base = q->payload;
+        iov[iovcnt++].iov_len = q->len;
+    }
+    err_t err = tun_write_packet(tun->esp_netif->fd, tun_header, iov, iovcnt) == 0 ? ERR_OK : ERR_ABRT;
     pbuf_free(p);
-    return ERR_OK;
+    return err;
 }
 
 err_t ip6_input(struct pbuf *p, struct netif *inp)
 {
-    return tun_input(p, ip6_header);
+    return tun_input(p, inp, ip6_header);
 }
 
 err_t ip4_input(struct pbuf *p, struct netif *inp)
 {
-    return tun_input(p, ip4_header);
+    return tun_input(p, inp, ip4_header);
 }
 
-int tun_read(void)
+int tun_ppp_read(struct tun_ppp *tun)
 {
+    int fd = tun->esp_netif->fd;
     fd_set fds;
     FD_ZERO(&fds);
-    FD_SET(esp_netif->fd, &fds);
+    FD_SET(fd, &fds);
     struct timeval tv = { .tv_usec = 0, .tv_sec = 1 };
 
-    if (select(esp_netif->fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+    if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+        pthread_mutex_lock(&lwip_lock);
         sys_check_timeouts();
+        pthread_mutex_unlock(&lwip_lock);
         return 0;
     }
 
-    struct pbuf *p;
-    ssize_t len = read(esp_netif->fd, esp_netif->out_buf, BUF_SIZE);
-    if (len < 0) {
-        perror("read returned -1");
-        return -1;
+    // read the pending packets directly to the pbufs (the device is non-blocking), scattering the TUN header
+    struct pbuf *packets[TUN_READ_BATCH];
+    uint8_t headers[TUN_READ_BATCH][TUN_HEADER_LEN];
+    int count = 0;
+    while (count < TUN_READ_BATCH) {
+        struct pbuf *p = pbuf_alloc(PBUF_RAW, TUN_MTU, PBUF_POOL);
+        if (p == NULL) {
+            perror("Cannot allocate pbuf");
+            break;
+        }
+        struct iovec iov[TUN_MAX_IOV - 1];
+        int iovcnt = 0;
+        for (struct pbuf *q = p; q && iovcnt < TUN_MAX_IOV - 1; q = q->next) {
+            iov[iovcnt].iov_base = q->payload;
+            iov[iovcnt++].iov_len = q->len;
+        }
+        ssize_t len = tun_read_packet(fd, headers[count], iov, iovcnt);
+        if (len < 0) {
+            pbuf_free(p);
+            break;      // EAGAIN: all pending packets read
+        }
+        if (len == 0) {
+            pbuf_free(p);
+            continue;
+        }
+        pbuf_realloc(p, len);
+        packets[count++] = p;
     }
 
-    if (len <= 4) {
-        return -1;
-    }
-    len -= 4;
-    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
-    if (p == NULL) {
-        perror("Cannot allocate pbuf");
-        return -1;
-    }
-    pbuf_take(p, esp_netif->out_buf + 4, len);
-    if (memcmp(esp_netif->out_buf, ip6_header, 4) == 0) {
-        pppos_netif.output_ip6(&pppos_netif, p, NULL);
-    } else if (memcmp(esp_netif->out_buf, ip4_header, 4) == 0) {
-        pppos_netif.output(&pppos_netif, p, NULL);
-    } else {
-        printf("Unknown protocol %x %x\n", esp_netif->out_buf[2], esp_netif->out_buf[3]);
+    pthread_mutex_lock(&lwip_lock);
+    for (int i = 0; i < count; ++i) {
+        struct pbuf *p = packets[i];
+        if (memcmp(headers[i], ip6_header, TUN_HEADER_LEN) == 0) {
+            tun->netif.output_ip6(&tun->netif, p, NULL);
+        } else if (memcmp(headers[i], ip4_header, TUN_HEADER_LEN) == 0) {
+            tun->netif.output(&tun->netif, p, NULL);
+        } else {
+            printf("Unknown protocol %x %x\n", headers[i][2], headers[i][3]);
+        }
+        pbuf_free(p);
     }
-    pbuf_free(p);
-    return 1;
+    sys_check_timeouts();
+    pthread_mutex_unlock(&lwip_lock);
+    return count;
 }
@@ -0,0 +1,44 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief PPP session (lwIP) relaying IP packets to a TUN device
+ */
+struct tun_ppp;
+
+/**
+ * @brief Creates the PPP session and starts connecting
+ * @param netif Network interface with the TUN device (`fd`, non-blocking) and the transmit callback to the DTE
+ * @return The session, NULL on failure
+ */
+struct tun_ppp *tun_ppp_create(esp_netif_t *netif);
+
+void tun_ppp_destroy(struct tun_ppp *tun);
+
+/**
+ * @brief Processes PPP data received from the modem, writing the IP packets to the TUN device
+ */
+int tun_ppp_input(struct tun_ppp *tun, uint8_t *data, size_t len);
+
+/**
+ * @brief Waits (up to 1s) for packets on the TUN device and sends them over PPP
+ * @return Number of packets sent, 0 on timeout
+ */
+int tun_ppp_read(struct tun_ppp *tun);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "tun_packet.h"
+
+static int prepend_header(struct iovec iov[TUN_MAX_IOV], void *header, const struct iovec *payload, int count)
+{
+    if (count < 0 || count > TUN_MAX_IOV - 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    iov[0].iov_base = header;
+    iov[0].iov_len = TUN_HEADER_LEN;
+    memcpy(&iov[1], payload, count * sizeof(struct iovec));
+    return count + 1;
+}
+
+int tun_write_packet(int fd, const uint8_t header[TUN_HEADER_LEN], const struct iovec *payload, int count)
+{
+    struct iovec iov[TUN_MAX_IOV];
+    int iovcnt = prepend_header(iov, (void *)header, payload, count);
+    if (iovcnt < 0) {
+        return -1;
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    // a packet is written at once or not at all, short writes are errors
+    return writev(fd, iov, iovcnt) == (ssize_t)total ? 0 : -1;
+}
+
+ssize_t tun_read_packet(int fd, uint8_t header[TUN_HEADER_LEN], const struct iovec *payload, int count)
+{
+    struct iovec iov[TUN_MAX_IOV];
+    int iovcnt = prepend_header(iov, header, payload, count);
+    if (iovcnt < 0) {
+        return -1;
+    }
+    ssize_t len = readv(fd, iov, iovcnt);
+    if (len <= 0) {
+        return -1;
+    }
+    return len > TUN_HEADER_LEN ? len - TUN_HEADER_LEN : 0;
+}
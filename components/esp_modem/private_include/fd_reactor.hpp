@@ -0,0 +1,68 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace esp_modem {
+
+/**
+ * @brief Serves file descriptors of many terminals from one thread (linux target only)
+ *
+ * Readable descriptors are reported by epoll and their callbacks run on the reactor's thread.
+ * Descriptors are distributed among a small pool of reactors (CONFIG_ESP_MODEM_LINUX_REACTOR_THREADS).
+ */
+class FdReactor {
+public:
+    using read_cb = std::function<void()>;
+
+    /**
+     * @brief Gets the reactor serving the file descriptor (reactors are created on first use)
+     */
+    static FdReactor &get(int fd);
+
+    /**
+     * @brief Calls the callback from the reactor thread whenever the descriptor is readable
+     * (replaces the callback if the descriptor has been already added)
+     */
+    void add(int fd, read_cb f);
+
+    /**
+     * @brief Stops serving the descriptor
+     *
+     * @note When called from another thread, it waits until the running callback completes,
+     * so the callback could be safely destroyed after returning
+     */
+    void remove(int fd);
+
+    /**
+     * @brief Checks whether the caller runs on one of the reactor threads (i.e. from a read callback)
+     */
+    static bool in_reactor_thread();
+
+    FdReactor(const FdReactor &) = delete;
+    FdReactor &operator=(const FdReactor &) = delete;
+    ~FdReactor();
+
+private:
+    FdReactor();
+    void run();
+
+    int epoll_fd;
+    int wake_fd;                                            /*!< eventfd to wake up the reactor (on exit) */
+    std::atomic<bool> running{true};
+    std::recursive_mutex dispatch_lock;                     /*!< Held while dispatching events to callbacks */
+    std::unordered_map<int, std::shared_ptr<read_cb>> handlers;
+    std::thread thread;
+};
+
+} // namespace esp_modem
@@ -176,13 +176,8 @@ extern "C" esp_err_t esp_modem_at(esp_modem_dce_t *dce_wrap, const char *at, cha
     if (dce_wrap == nullptr || dce_wrap->dce == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
-    std::string out;
-    std::string at_str(at);
-    auto ret = command_response_to_esp_err(dce_wrap->dce->at(at_str, out, timeout));
-    if ((p_out != NULL) && (!out.empty())) {
-        strlcpy(p_out, out.c_str(), ESP_MODEM_C_API_STR_MAX);
-    }
-    return ret;
+    char_span out{p_out, p_out ? size_t(ESP_MODEM_C_API_STR_MAX) : 0};
+    return command_response_to_esp_err(dce_wrap->dce->at(std::string_view(at), out, timeout));
 }
 
 extern "C" esp_err_t esp_modem_get_signal_quality(esp_modem_dce_t *dce_wrap, int *rssi, int *ber)
@@ -198,12 +193,8 @@ extern "C" esp_err_t esp_modem_get_imsi(esp_modem_dce_t *dce_wrap, char *p_imsi)
     if (dce_wrap == nullptr || dce_wrap->dce == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
-    std::string imsi;
-    auto ret = command_response_to_esp_err(dce_wrap->dce->get_imsi(imsi));
-    if (ret == ESP_OK && !imsi.empty()) {
-        strlcpy(p_imsi, imsi.c_str(), ESP_MODEM_C_API_STR_MAX);
-    }
-    return ret;
+    char_span imsi{p_imsi, ESP_MODEM_C_API_STR_MAX};
+    return command_response_to_esp_err(dce_wrap->dce->get_imsi(imsi));
 }
 
 extern "C" esp_err_t esp_modem_at_raw(esp_modem_dce_t *dce_wrap, const char *cmd, char *p_out, const char *pass, const char *fail, int timeout)
@@ -211,12 +202,8 @@ extern "C" esp_err_t esp_modem_at_raw(esp_modem_dce_t *dce_wrap, const char *cmd
     if (dce_wrap == nullptr || dce_wrap->dce == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
-    std::string out;
-    auto ret = command_response_to_esp_err(dce_wrap->dce->at_raw(cmd, out, pass, fail, timeout));
-    if ((p_out != NULL) && (!out.empty())) {
-        strlcpy(p_out, out.c_str(), ESP_MODEM_C_API_STR_MAX);
-    }
-    return ret;
+    char_span out{p_out, p_out ? size_t(ESP_MODEM_C_API_STR_MAX) : 0};
+    return command_response_to_esp_err(dce_wrap->dce->at_raw(std::string_view(cmd), out, pass, fail, timeout));
 }
 
 
@@ -241,12 +228,8 @@ extern "C" esp_err_t esp_modem_get_imei(esp_modem_dce_t *dce_wrap, char *p_imei)
     if (dce_wrap == nullptr || dce_wrap->dce == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
-    std::string imei;
-    auto ret = command_response_to_esp_err(dce_wrap->dce->get_imei(imei));
-    if (ret == ESP_OK && !imei.empty()) {
-        strlcpy(p_imei, imei.c_str(), ESP_MODEM_C_API_STR_MAX);
-    }
-    return ret;
+    char_span imei{p_imei, ESP_MODEM_C_API_STR_MAX};
+    return command_response_to_esp_err(dce_wrap->dce->get_imei(imei));
 }
 
 extern "C" esp_err_t esp_modem_get_operator_name(esp_modem_dce_t *dce_wrap, char *p_name, int *p_act)
@@ -254,11 +237,10 @@ extern "C" esp_err_t esp_modem_get_operator_name(esp_modem_dce_t *dce_wrap, char
     if (dce_wrap == nullptr || dce_wrap->dce == nullptr || p_name == nullptr || p_act == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
-    std::string name;
+    char_span name{p_name, ESP_MODEM_C_API_STR_MAX};
     int act;
     auto ret = command_response_to_esp_err(dce_wrap->dce->get_operator_name(name, act));
-    if (ret == ESP_OK && !name.empty()) {
-        strlcpy(p_name, name.c_str(), ESP_MODEM_C_API_STR_MAX);
+    if (ret == ESP_OK) {
         *p_act = act;
     }
     return ret;
@@ -269,12 +251,8 @@ extern "C" esp_err_t esp_modem_get_module_name(esp_modem_dce_t *dce_wrap, char *
     if (dce_wrap == nullptr || dce_wrap->dce == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
-    std::string name;
-    auto ret = command_response_to_esp_err(dce_wrap->dce->get_module_name(name));
-    if (ret == ESP_OK && !name.empty()) {
-        strlcpy(p_name, name.c_str(), ESP_MODEM_C_API_STR_MAX);
-    }
-    return ret;
+    char_span name{p_name, ESP_MODEM_C_API_STR_MAX};
+    return command_response_to_esp_err(dce_wrap->dce->get_module_name(name));
 }
 
 extern "C" esp_err_t esp_modem_get_battery_status(esp_modem_dce_t *dce_wrap, int *p_volt, int *p_bcs, int *p_bcl)
@@ -455,3 +433,30 @@ extern "C" esp_err_t esp_modem_set_apn(esp_modem_dce_t *dce_wrap, const char *ap
     dce_wrap->dce->get_module()->configure_pdp_context(std::move(new_pdp));
     return ESP_OK;
 }
+
+extern "C" esp_err_t esp_modem_get_dte_stats(esp_modem_dce_t *dce_wrap, esp_modem_dte_stats_t *stats)
+{
+    if (dce_wrap == nullptr || dce_wrap->dte == nullptr || stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = dce_wrap->dte->get_stats();
+    return ESP_OK;
+}
+
+extern "C" esp_err_t esp_modem_get_cmux_stats(esp_modem_dce_t *dce_wrap, esp_modem_cmux_stats_t *stats)
+{
+    if (dce_wrap == nullptr || dce_wrap->dte == nullptr || stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = dce_wrap->dte->get_cmux_stats();
+    return ESP_OK;
+}
+
+extern "C" esp_err_t esp_modem_reset_stats(esp_modem_dce_t *dce_wrap)
+{
+    if (dce_wrap == nullptr || dce_wrap->dte == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dce_wrap->dte->reset_stats();
+    return ESP_OK;
+}
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <array>
 #include <cstring>
 #include <unistd.h>
 #include <cxx_include/esp_modem_cmux.hpp>
@@ -22,6 +23,13 @@ using namespace esp_modem;
 #define DEFRAGMENT_CMUX_PAYLOAD
 #endif
 
+#ifdef CONFIG_ESP_MODEM_CMUX_USE_SHORT_PAYLOADS_ONLY
+/**
+ * @brief Define this to use (and accept) only 1-byte CMUX payload length
+ */
+#define ESP_MODEM_CMUX_USE_SHORT_PAYLOADS_ONLY
+#endif
+
 #define EA 0x01  /* Extension bit      */
 #define CR 0x02  /* Command / Response */
 #define PF 0x10  /* Poll / Final       */
@@ -50,17 +58,50 @@ using namespace esp_modem;
 #define CMD_SNC    0x68  /* Service Negotiation Command              */
 #define CMD_MSC    0x70  /* Modem Status Command                     */
 
+/* Modem status (MSC) signals */
+#define MSC_FC     0x02  /* Flow Control                             */
+
 /* Flag sequence field between messages (start of frame) */
 #define SOF_MARKER 0xF9
 
-uint8_t CMux::fcs_crc(const uint8_t frame[6])
-{
-    //    #define FCS_GOOD_VALUE 0xCF
-    uint8_t crc = 0xFF; // FCS_INIT_VALUE
+static_assert(static_cast<size_t>(protocol_mismatch_reason::UNKNOWN) + 1 == ESP_MODEM_STATS_CMUX_RECOVERY_REASONS);
+static_assert(MAX_TERMINALS_NUM + 1 == ESP_MODEM_STATS_CMUX_CHANNELS);
 
-    for (int i = 1; i < 4; i++) {
-        crc ^= frame[i];
+CMux::CMux(std::shared_ptr<Terminal> t, unique_buffer &&b, const esp_modem_cmux_config *config, std::shared_ptr<Stats<cmux_stats>> s):
+    term(std::move(t)), payload_start(nullptr), total_payload_size(0),
+    max_frame_size(CMUX_DEFAULT_FRAME_SIZE), negotiate_params(false), ui_frames(false), pn_ack(-1), control_msg_len(0), tx_flow(false), buffer(std::move(b)),
+    stats(s ? std::move(s) : std::make_shared<Stats<cmux_stats>>())
+{
+    if (config && config->max_frame_size > 0) {
+        max_frame_size = std::min(config->max_frame_size, CMUX_MAX_FRAME_SIZE);
+    }
+#ifdef ESP_MODEM_CMUX_USE_SHORT_PAYLOADS_ONLY
+    max_frame_size = std::min(max_frame_size, CMUX_DEFAULT_FRAME_SIZE);
+#endif
+    size_t terminals = CMUX_DEFAULT_TERMINALS_NUM;
+    if (config) {
+        negotiate_params = config->negotiate_params;
+        ui_frames = config->ui_frames;
+        if (config->terminals_num > 0) {
+            terminals = std::min(config->terminals_num, MAX_TERMINALS_NUM);
+        }
+    }
+    channels.resize(terminals);
+    for (auto &ch : channels) {
+        ch.params = { .frame_size = max_frame_size, .priority = 7, .window = 2 };   // default DLC parameters
+        ch.tx_flow = true;
+        ch.rx_len = 0;
+    }
+}
 
+/**
+ * @brief Lookup table of the FCS (reversed CRC-8, polynomial x^8 + x^2 + x + 1)
+ *        generated at compile time
+ */
+static constexpr std::array<uint8_t, 256> fcs_table = [] {
+    std::array<uint8_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        uint8_t crc = i;
         for (int j = 0; j < 8; j++) {
             if (crc & 0x01) {
                 crc = (crc >> 1) ^ 0xe0; // FCS_POLYNOMIAL
@@ -68,13 +109,33 @@ uint8_t CMux::fcs_crc(const uint8_t frame[6])
                 crc >>= 1;
             }
         }
+        table[i] = crc;
     }
+    return table;
+}();
 
+uint8_t CMux::fcs_crc(const uint8_t *data, size_t len, uint8_t crc)
+{
+    //    #define FCS_GOOD_VALUE 0xCF
+    for (size_t i = 0; i < len; i++) {
+        crc = fcs_table[crc ^ data[i]];
+    }
     return crc;
 }
 
+/**
+ * @brief Checks if the frame carries information (UIH or UI frame, regardless of the P/F bit)
+ */
+static inline bool is_info_frame(uint8_t type)
+{
+    return (type & ~PF) == FT_UIH || (type & ~PF) == FT_UI;
+}
+
 void CMux::send_disconnect(size_t i)
 {
+    stats->update([i](cmux_stats & s) {
+        s.channels[i].tx_frames++;
+    });
     if (i == 0) {   // control terminal
         uint8_t frame[] = {
             SOF_MARKER, 0x3, 0xEF, 0x5, 0xC3, 0x1, 0xF2, SOF_MARKER
@@ -85,7 +146,7 @@ void CMux::send_disconnect(size_t i)
             SOF_MARKER, 0x3, FT_DISC | PF, 0x1, 0, SOF_MARKER
         };
         frame[1] |= i << 2;
-        frame[4] = 0xFF - fcs_crc(frame);
+        frame[4] = 0xFF - fcs_crc(frame + 1, 3);
         term->write(frame, sizeof(frame));
     }
 }
@@ -97,12 +158,65 @@ void CMux::send_sabm(size_t i)
     frame[1] = (i << 2) | 0x3;
     frame[2] = FT_SABM | PF;
     frame[3] = 1;
-    frame[4] = 0xFF - fcs_crc(frame);
+    frame[4] = 0xFF - fcs_crc(frame + 1, 3);
     frame[5] = SOF_MARKER;
+    stats->update([i](cmux_stats & s) {
+        s.channels[i].tx_frames++;
+    });
     term->write(frame, 6);
 }
 
 
+void CMux::send_control_message(const uint8_t *msg, size_t len)
+{
+    uint8_t header[4] = { SOF_MARKER, 0x3, FT_UIH, static_cast<uint8_t>((len << 1) | EA) };
+    uint8_t footer[2] = { static_cast<uint8_t>(0xFF - fcs_crc(header + 1, 3)), SOF_MARKER };
+    struct iovec iov[3] = { { header, sizeof(header) }, { const_cast<uint8_t *>(msg), len }, { footer, sizeof(footer) } };
+    stats->update([len](cmux_stats & s) {
+        s.channels[0].tx_frames++;
+        s.channels[0].tx_bytes += len;
+    });
+    Scoped<Lock> l(lock);
+    if (term->writev(iov, 3) != static_cast<int>(sizeof(header) + len + sizeof(footer))) {
+        ESP_LOGE("CMUX", "Failed to write control message");
+    }
+}
+
+void CMux::send_pn(size_t i)
+{
+    const auto &p = channels[i - 1].params;
+    uint8_t msg[10];
+    msg[0] = (CMD_PN << 1) | CR | EA;       // PN command
+    msg[1] = (8 << 1) | EA;                 // 8 value octets
+    msg[2] = i;                             // DLCI
+    msg[3] = ui_frames ? 1 : 0;             // UIH or UI frames, convergence layer type 1
+    msg[4] = p.priority;
+    msg[5] = 10;                            // T1 (acknowledgement timer) in units of 10ms
+    msg[6] = p.frame_size & 0xFF;           // N1 (maximum frame size)
+    msg[7] = p.frame_size >> 8;
+    msg[8] = 3;                             // N2 (maximum number of retransmissions)
+    msg[9] = p.window;                      // k (window size)
+    send_control_message(msg, sizeof(msg));
+}
+
+void CMux::update_flow()
+{
+    for (size_t i = 0; i < channels.size(); ++i) {
+        if (tx_flow && channels[i].tx_flow) {
+            flow_signal.set(1 << i);
+        } else {
+            flow_signal.clear(1 << i);
+        }
+    }
+}
+
+bool CMux::set_flow(bool enable)
+{
+    uint8_t msg[] = { static_cast<uint8_t>(((enable ? CMD_FCON : CMD_FCOFF) << 1) | CR | EA), EA };
+    send_control_message(msg, sizeof(msg));
+    return true;
+}
+
 struct CMux::CMuxFrame {
     uint8_t *ptr;     /*!< pointer to the currently processing byte of the CMUX frame */
     size_t len;       /*!< length of available data in the current CMUX frame */
@@ -115,47 +229,163 @@ struct CMux::CMuxFrame {
 
 bool CMux::data_available(uint8_t *data, size_t len)
 {
-    if (data && (type & FT_UIH) == FT_UIH && len > 0 && dlci > 0) { // valid payload on a virtual term
-        int virtual_term = dlci - 1;
-        if (virtual_term < MAX_TERMINALS_NUM && read_cb[virtual_term]) {
-            // Post partial data (or defragment to post on CMUX footer)
+    if (data && is_info_frame(type) && len > 0) {
+        stats->update([this, len](cmux_stats & s) {
+            s.channels[dlci].rx_bytes += len;
+        });
+    }
+    if (data && is_info_frame(type) && len > 0 && dlci > 0) { // valid payload on a virtual term
+        auto &ch = channels[dlci - 1];
+        if (!ch.read_cb) {  // nobody reads this terminal, drop the payload
+            return true;
+        }
+        // Post partial data (or defragment to post on CMUX footer)
 #ifdef DEFRAGMENT_CMUX_PAYLOAD
-            if (payload_start == nullptr) {
-                payload_start = data;
-                total_payload_size = 0;
-            }
-            total_payload_size += len;
-#else
-            read_cb[virtual_term](data, len);
-#endif
+        if (payload_start == nullptr && ch.rx_len == 0) {
+            // keep the payload in place, it's stashed to the terminal's buffer if the frame doesn't complete
+            payload_start = data;
+            total_payload_size = len;
         } else {
-            return false;
+            append_payload(ch, data, len);
         }
+#else
+        ch.read_cb(data, len);
+#endif
     } else if (data == nullptr && type == (FT_UA | PF) && len == 0) { // notify the initial SABM command
         Scoped<Lock> l(lock);
         sabm_ack = dlci;
     } else if (data == nullptr && dlci > 0) {
-        int virtual_term = dlci - 1;
-        if (virtual_term < MAX_TERMINALS_NUM && read_cb[virtual_term]) {
 #ifdef DEFRAGMENT_CMUX_PAYLOAD
-            read_cb[virtual_term](payload_start, total_payload_size);
-#endif
-        } else {
-            return false;
+        auto &ch = channels[dlci - 1];
+        if (payload_start && ch.read_cb) {  // entire payload available in place
+            ch.read_cb(payload_start, total_payload_size);
+        } else if (ch.rx_len > 0) {
+            if (ch.read_cb) {
+                ch.read_cb(ch.rx_buffer.get(), ch.rx_len);
+            }
+            release_payload(ch);
         }
-    } else if ((type & FT_UIH) == FT_UIH && dlci == 0) { // notify the internal DISC command
-        if ((len > 0 && (data[0] & 0xE1) == 0xE1) || (data == nullptr)) {
-            // Not a DISC, ignore (MSC frame)
+#endif
+    } else if (is_info_frame(type) && dlci == 0) { // control channel message
+        if (data == nullptr) {  // complete, process it on footer
+            on_control_message();
+            control_msg_len = 0;
             return true;
         }
-        Scoped<Lock> l(lock);
-        sabm_ack = dlci;
+        size_t copy_len = std::min(len, sizeof(control_msg) - control_msg_len);
+        memcpy(control_msg + control_msg_len, data, copy_len);
+        control_msg_len += copy_len;
     } else {
         return false;
     }
     return true;
 }
 
+void CMux::append_payload(channel &ch, const uint8_t *data, size_t len)
+{
+    if (!ch.rx_buffer) {    // take a buffer from the pool
+        if (rx_pool.empty()) {
+            ch.rx_buffer = std::make_unique<uint8_t[]>(buffer.size);
+        } else {
+            ch.rx_buffer = std::move(rx_pool.back());
+            rx_pool.pop_back();
+        }
+    }
+    if (ch.rx_len + len > buffer.size) {
+        ESP_LOGW("CMUX", "Failed to defragment longer payload (payload=%d)", ch.rx_len + len);
+        // If you experience this error, your device uses longer payloads while
+        // the configured buffer is too small to defragment the payload properly.
+        // To resolve this issue you can:
+        // * Either increase `dte_buffer_size`
+        // * Or disable `ESP_MODEM_CMUX_DEFRAGMENT_PAYLOAD` in menuconfig
+
+        // Post the data accumulated so far (rely on upper layers to process correctly)
+        ch.read_cb(ch.rx_buffer.get(), ch.rx_len);
+        ch.rx_len = 0;
+        if (len > buffer.size) {
+            ch.read_cb(const_cast<uint8_t *>(data), len);
+            return;
+        }
+    }
+    memcpy(ch.rx_buffer.get() + ch.rx_len, data, len);
+    ch.rx_len += len;
+}
+
+void CMux::release_payload(channel &ch)
+{
+    ch.rx_len = 0;
+    if (ch.rx_buffer) {     // return the buffer to the pool
+        rx_pool.push_back(std::move(ch.rx_buffer));
+    }
+}
+
+void CMux::stash_payload()
+{
+    if (payload_start && dlci > 0 && dlci <= channels.size()) {
+        append_payload(channels[dlci - 1], payload_start, total_payload_size);
+    }
+    payload_start = nullptr;
+    total_payload_size = 0;
+}
+
+void CMux::on_control_message()
+{
+    if (control_msg_len < 2) {
+        return;
+    }
+    const uint8_t msg_type = control_msg[0] & ~(CR | EA);
+    const bool is_command = control_msg[0] & CR;
+    const uint8_t *value = control_msg + 2;
+    const size_t value_len = std::min<size_t>(control_msg[1] >> 1, control_msg_len - 2);
+    if (msg_type == (CMD_PN << 1)) {
+        size_t pn_dlci = value_len >= 8 ? value[0] & 0x3F : 0;
+        if (is_command || pn_dlci == 0 || pn_dlci > channels.size()) {
+            // We only initiate the negotiation, keep our parameters if the device proposes its own
+            return;
+        }
+        size_t frame_size = value[4] | (value[5] << 8);
+        Scoped<Lock> l(lock);
+        auto &p = channels[pn_dlci - 1].params;
+        if (frame_size > 0) {   // the device could only decrease the proposed frame size
+            p.frame_size = std::min(p.frame_size, frame_size);
+        }
+        p.priority = value[2] & 0x3F;
+        p.window = value[7] & 0x07;
+        pn_ack = pn_dlci;
+    } else if (msg_type == (CMD_NSC << 1)) {
+        if (value_len > 0 && (value[0] & ~(CR | EA)) == (CMD_PN << 1)) {
+            Scoped<Lock> l(lock);
+            pn_ack = 0;
+        }
+    } else if (msg_type == (CMD_FCON << 1) || msg_type == (CMD_FCOFF << 1)) {
+        if (is_command) {   // device enables/disables our sending on all virtual terminals
+            Scoped<Lock> l(lock);
+            tx_flow = msg_type == (CMD_FCON << 1);
+            ESP_LOGD("CMUX", "Flow %s", tx_flow ? "on" : "off");
+            update_flow();
+            uint8_t reply[] = { static_cast<uint8_t>(control_msg[0] & ~CR), EA };
+            send_control_message(reply, sizeof(reply));
+        }
+    } else if (msg_type == (CMD_MSC << 1)) {
+        if (is_command && value_len >= 2) {  // device reports its status on a virtual terminal
+            size_t msc_dlci = value[0] >> 2;
+            Scoped<Lock> l(lock);
+            if (msc_dlci > 0 && msc_dlci <= channels.size()) {
+                channels[msc_dlci - 1].tx_flow = (value[1] & MSC_FC) == 0;
+                ESP_LOGD("CMUX", "DLCI %d: flow %s", msc_dlci, channels[msc_dlci - 1].tx_flow ? "on" : "off");
+                update_flow();
+            }
+            // acknowledge with the same values
+            control_msg[0] &= ~CR;
+            send_control_message(control_msg, 2 + value_len);
+        }
+    } else {
+        // Other messages notify the internal DISC command (multiplexer close down)
+        Scoped<Lock> l(lock);
+        sabm_ack = 0;
+    }
+}
+
 bool CMux::on_init(CMuxFrame &frame)
 {
     if (frame.ptr[0] != SOF_MARKER) {
@@ -221,19 +451,21 @@ bool CMux::on_header(CMuxFrame &frame)
         payload_offset = std::min(frame.len, 5 - frame_header_offset);
         memcpy(frame_header + frame_header_offset, frame.ptr, payload_offset);
         payload_len = frame_header[4] << 7;
+        frame_crc = fcs_crc(frame_header + 1, 4);
         frame_header_offset += payload_offset - 1; // rewind frame_header back to hold only 6 bytes size
     } else
 #endif // ! ESP_MODEM_CMUX_USE_SHORT_PAYLOADS_ONLY
     {
         payload_len = 0;
+        frame_crc = fcs_crc(frame_header + 1, 3);
         frame_header_offset += payload_offset;
     }
     dlci = frame_header[1] >> 2;
     type = frame_header[2];
     // Sanity check for expected values of DLCI and type,
     // since CRC could be evaluated after the frame payload gets received
-    if (dlci > MAX_TERMINALS_NUM || (frame_header[1] & 0x01) == 0 ||
-            (((type & FT_UIH) != FT_UIH) &&  type != (FT_UA | PF) ) ) {
+    if (dlci > channels.size() || (frame_header[1] & 0x01) == 0 ||
+            (!is_info_frame(type) &&  type != (FT_UA | PF) ) ) {
         recover_protocol(protocol_mismatch_reason::UNEXPECTED_HEADER);
         return true;
     }
@@ -246,6 +478,9 @@ bool CMux::on_header(CMuxFrame &frame)
 bool CMux::on_payload(CMuxFrame &frame)
 {
     ESP_LOGD("CMUX", "Payload frame: dlci:%02x type:%02x payload:%d available:%d", dlci, type, payload_len, frame.len);
+    if ((type & ~PF) == FT_UI) {    // FCS of UI frames covers the payload, too
+        frame_crc = fcs_crc(frame.ptr, std::min(frame.len, payload_len), frame_crc);
+    }
     if (frame.len < payload_len) { // payload
         state = cmux_state::PAYLOAD;
         if (!data_available(frame.ptr, frame.len)) { // partial read
@@ -282,16 +517,18 @@ bool CMux::on_footer(CMuxFrame &frame)
             recover_protocol(protocol_mismatch_reason::MISSED_TRAIL_SOF);
             return true;
         }
-#ifdef ESP_MODEM_CMUX_USE_SHORT_PAYLOADS_ONLY
-        uint8_t crc = 0xFF - fcs_crc(frame_header);
-        if (crc != frame_header[4]) {
+        // frame_header[4] holds the FCS for both short and long frames, drop the frame if it doesn't match
+        // (the payload is posted on the footer only if defragmented, otherwise it's been already passed on)
+        if (0xFF - frame_crc != frame_header[4]) {
             recover_protocol(protocol_mismatch_reason::WRONG_CRC);
             return true;
         }
-#endif
         frame.advance(footer_offset);
         state = cmux_state::INIT;
         frame_header_offset = 0;
+        stats->update([this](cmux_stats & s) {
+            s.channels[dlci].rx_frames++;
+        });
         if (!data_available(nullptr, 0)) {
             recover_protocol(protocol_mismatch_reason::UNEXPECTED_DATA);
             return true;
@@ -305,81 +542,44 @@ bool CMux::on_footer(CMuxFrame &frame)
 bool CMux::on_cmux_data(uint8_t *data, size_t actual_len)
 {
     if (!data) {
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-        auto data_to_read = buffer.size - 128; // keep 128 (max CMUX payload) backup buffer)
-        if (payload_start) {
-            data = payload_start + total_payload_size;
-            auto data_end = buffer.get() + buffer.size;
-            data_to_read = payload_len + 2; // 2 -- CMUX protocol footer
-            if (data + data_to_read >= data_end) {
-                ESP_LOGW("CUMX", "Failed to defragment longer payload (payload=%d)", payload_len);
-                // If you experience this error, your device uses longer payloads while
-                // the configured buffer is too small to defragment the payload properly.
-                // To resolve this issue you can:
-                // * Either increase `dte_buffer_size`
-                // * Or disable `ESP_MODEM_CMUX_DEFRAGMENT_PAYLOAD` in menuconfig
-
-                // Attempts to process the data accumulated so far (rely on upper layers to process correctly)
-                data_available(nullptr, 0);
-                if (payload_len > total_payload_size) {
-                    payload_start = nullptr;
-                    total_payload_size = 0;
-                } else {
-                    // cannot continue with this payload, give-up and recover the protocol
-                    recover_protocol(protocol_mismatch_reason::READ_BEHIND_BUFFER);
-                }
-                data_to_read = buffer.size;
-                data = buffer.get();
-            }
-        } else {
-            data = buffer.get();
-        }
-        actual_len = term->read(data, data_to_read);
-#else
         data = buffer.get();
         actual_len = term->read(data, buffer.size);
-#endif
     }
     ESP_LOG_BUFFER_HEXDUMP("CMUX Received", data, actual_len, ESP_LOG_VERBOSE);
     CMuxFrame frame = { .ptr = data, .len = actual_len };
-    while (frame.len > 0) {
+    bool processed = true;
+    while (frame.len > 0 && processed) {
         switch (state) {
         case cmux_state::RECOVER:
-            if (!on_recovery(frame)) {
-                return false;
-            }
+            processed = on_recovery(frame);
             break;
         case cmux_state::INIT:
-            if (!on_init(frame)) {
-                return false;
-            }
+            processed = on_init(frame);
             break;
         case cmux_state::HEADER:
-            if (!on_header(frame)) {
-                return false;
-            }
+            processed = on_header(frame);
             break;
         case cmux_state::PAYLOAD:
-            if (!on_payload(frame)) {
-                return false;
-            }
+            processed = on_payload(frame);
             break;
         case cmux_state::FOOTER:
-            if (!on_footer(frame)) {
-                return false;
-            }
+            processed = on_footer(frame);
             break;
         }
     }
-    return true;
+#ifdef DEFRAGMENT_CMUX_PAYLOAD
+    // The frame hasn't been completed in this chunk of data, which would be overwritten by the next read
+    stash_payload();
+#endif
+    return processed;
 }
 
 bool CMux::deinit()
 {
     int timeout;
     sabm_ack = -1;
-    // First disconnect all (2) virtual terminals
-    for (size_t i = 1; i < 3; i++) {
+    // First disconnect all virtual terminals
+    for (size_t i = 1; i <= channels.size(); i++) {
         send_disconnect(i);
         timeout = 0;
         while (true) {
@@ -412,18 +612,52 @@ bool CMux::deinit()
     return true;
 }
 
+bool CMux::negotiate(size_t i)
+{
+    int timeout = 0;
+    {
+        Scoped<Lock> l(lock);
+        pn_ack = -1;
+    }
+    send_pn(i);
+    while (true) {
+        usleep(10'000);
+        Scoped<Lock> l(lock);
+        if (pn_ack == static_cast<int>(i)) {
+            ESP_LOGD("CMUX", "DLCI %d: frame size %d, priority %d", i, channels[i - 1].params.frame_size, channels[i - 1].params.priority);
+            return true;
+        }
+        if (pn_ack == 0 || timeout++ > 100) {
+            return false;
+        }
+    }
+}
+
 bool CMux::init()
 {
     frame_header_offset = 0;
     state = cmux_state::INIT;
+    {
+        Scoped<Lock> l(lock);
+        tx_flow = true;
+        for (auto &ch : channels) {
+            ch.tx_flow = true;
+        }
+        update_flow();
+    }
     term->set_read_cb([this](uint8_t *data, size_t len) {
         this->on_cmux_data(data, len);
         return false;
     });
 
     sabm_ack = -1;
-    for (size_t i = 0; i < 3; i++) {
+    bool negotiating = negotiate_params;
+    for (size_t i = 0; i <= channels.size(); i++) {
         int timeout = 0;
+        if (i > 0 && negotiating && !negotiate(i)) {
+            ESP_LOGW("CMUX", "DLC parameter negotiation not supported, using defaults");
+            negotiating = false;
+        }
         send_sabm(i);
         while (true) {
             usleep(10'000);
@@ -445,40 +679,104 @@ bool CMux::init()
 
 int CMux::write(int virtual_term, uint8_t *data, size_t len)
 {
-    const size_t cmux_max_len = 127;
+    {
+        Scoped<Lock> l(lock);
+        if (!term || virtual_term < 0 || static_cast<size_t>(virtual_term) >= channels.size()) {  // already detached or invalid terminal
+            return -1;
+        }
+    }
+    // Wait (without holding the lock) while the device has disabled the flow on this terminal
+    for (uint32_t waited = CMUX_FLOW_CONTROL_TIMEOUT_MS; !flow_signal.wait_any(1 << virtual_term, CMUX_FLOW_CONTROL_TIMEOUT_MS);
+            waited += CMUX_FLOW_CONTROL_TIMEOUT_MS) {
+        Scoped<Lock> l(lock);
+        if (!term) {
+            return -1;
+        }
+        if (waited >= CMUX_FLOW_CONTROL_MAX_WAIT_MS) {
+            ESP_LOGE("CMUX", "Flow disabled by the device for %d ms, failed to write %d bytes", (int)waited, (int)len);
+            return -1;
+        }
+        ESP_LOGW("CMUX", "Flow disabled by the device, waiting to write %d bytes", (int)len);
+    }
     Scoped<Lock> l(lock);
+    if (!term) {   // detached while waiting
+        return -1;
+    }
     int i = virtual_term + 1;
     size_t need_write = len;
+    const size_t frame_size = channels[virtual_term].params.frame_size;
+    // Compose the entire packet as a scatter-gather list of frames (header, payload, footer)
+    // and submit it to the terminal at once, flushing only if we run out of prepared frames
+    uint8_t frames[MAX_FRAMES_PER_WRITE][7];
+    struct iovec iov[3 * MAX_FRAMES_PER_WRITE];
+    size_t frame_nr = 0;
+    size_t frames_num = 0;
+    size_t iov_len = 0;
     while (need_write > 0) {
         size_t batch_len = need_write;
-        if (batch_len > cmux_max_len) {
-            batch_len = cmux_max_len;
+        if (batch_len > frame_size) {
+            batch_len = frame_size;
         }
-        uint8_t frame[6];
+        uint8_t *frame = frames[frame_nr];
+        size_t header_len = 4;
         frame[0] = SOF_MARKER;
         frame[1] = (i << 2) + 1;
-        frame[2] = FT_UIH;
-        frame[3] = (batch_len << 1) + 1;
-        frame[4] = 0xFF - fcs_crc(frame);
-        frame[5] = SOF_MARKER;
-
-        term->write(frame, 4);
-        term->write(data, batch_len);
-        term->write(frame + 4, 2);
-        ESP_LOG_BUFFER_HEXDUMP("Send", frame, 4, ESP_LOG_VERBOSE);
+        frame[2] = ui_frames ? FT_UI : FT_UIH;
+        if (batch_len > CMUX_DEFAULT_FRAME_SIZE) {  // 2-byte length: EA bit cleared in the first byte
+            frame[3] = (batch_len & 0x7F) << 1;
+            frame[4] = batch_len >> 7;
+            header_len = 5;
+        } else {
+            frame[3] = (batch_len << 1) + 1;
+        }
+        uint8_t crc = fcs_crc(frame + 1, header_len - 1);
+        if (ui_frames) {
+            crc = fcs_crc(data, batch_len, crc);
+        }
+        frame[header_len] = 0xFF - crc;
+        frame[header_len + 1] = SOF_MARKER;
+
+        iov[3 * frame_nr] = { frame, header_len };
+        iov[3 * frame_nr + 1] = { data, batch_len };
+        iov[3 * frame_nr + 2] = { frame + header_len, 2 };
+        ESP_LOG_BUFFER_HEXDUMP("Send", frame, header_len, ESP_LOG_VERBOSE);
         ESP_LOG_BUFFER_HEXDUMP("Send", data, batch_len, ESP_LOG_VERBOSE);
-        ESP_LOG_BUFFER_HEXDUMP("Send", frame + 4, 2, ESP_LOG_VERBOSE);
+        ESP_LOG_BUFFER_HEXDUMP("Send", frame + header_len, 2, ESP_LOG_VERBOSE);
         need_write -= batch_len;
         data += batch_len;
+        iov_len += header_len + batch_len + 2;
+        ++frames_num;
+        if (++frame_nr == MAX_FRAMES_PER_WRITE || need_write == 0) {
+            // incomplete frames would break the stream, so report the write as failed
+            if (term->writev(iov, 3 * frame_nr) != static_cast<int>(iov_len)) {
+                ESP_LOGE("CMUX", "Failed to write frames of %d bytes", (int)iov_len);
+                return -1;
+            }
+            frame_nr = 0;
+            iov_len = 0;
+        }
     }
+    stats->update([i, len, frames_num](cmux_stats & s) {
+        s.channels[i].tx_frames += frames_num;
+        s.channels[i].tx_bytes += len;
+    });
     return len;
 }
 
 void CMux::set_read_cb(int inst, std::function<bool(uint8_t *, size_t)> f)
 {
-    if (inst < MAX_TERMINALS_NUM) {
-        read_cb[inst] = std::move(f);
+    if (inst >= 0 && static_cast<size_t>(inst) < channels.size()) {
+        channels[inst].read_cb = std::move(f);
+    }
+}
+
+cmux_dlci_params CMux::get_params(int inst)
+{
+    Scoped<Lock> l(lock);
+    if (inst >= 0 && static_cast<size_t>(inst) < channels.size()) {
+        return channels[inst].params;
     }
+    return {};
 }
 
 std::pair<std::shared_ptr<Terminal>, unique_buffer> CMux::detach()
@@ -489,9 +787,19 @@ std::pair<std::shared_ptr<Terminal>, unique_buffer> CMux::detach()
 void esp_modem::CMux::recover_protocol(protocol_mismatch_reason reason)
 {
     ESP_LOGW("CMUX", "Restarting CMUX state machine (reason: %d)", static_cast<int>(reason));
+    stats->update([reason](cmux_stats & s) {
+        s.recoveries[static_cast<size_t>(reason)]++;
+        if (reason == protocol_mismatch_reason::WRONG_CRC) {
+            s.fcs_errors++;
+        }
+    });
     payload_start = nullptr;
     total_payload_size = 0;
     frame_header_offset = 0;
+    control_msg_len = 0;
+    for (auto &ch : channels) {
+        release_payload(ch);
+    }
     state = cmux_state::RECOVER;
 }
 
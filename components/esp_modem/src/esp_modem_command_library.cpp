@@ -5,7 +5,6 @@
  */
 
 #include <charconv>
-#include <list>
 #include "esp_log.h"
 #include "cxx_include/esp_modem_dte.hpp"
 #include "cxx_include/esp_modem_dce_module.hpp"
@@ -16,45 +15,26 @@ namespace esp_modem::dce_commands {
 
 static const char *TAG = "command_lib";
 
-static command_result generic_command(CommandableIf *t, const std::string &command,
-                                      const std::list<std::string_view> &pass_phrase,
-                                      const std::list<std::string_view> &fail_phrase,
-                                      uint32_t timeout_ms)
-{
-    ESP_LOGD(TAG, "%s command %s\n", __func__, command.c_str());
-    return t->command(command, [&](uint8_t *data, size_t len) {
-        std::string_view response((char *)data, len);
-        if (data == nullptr || len == 0 || response.empty()) {
-            return command_result::TIMEOUT;
-        }
-        ESP_LOGD(TAG, "Response: %.*s\n", (int)response.length(), response.data());
-        for (auto &it : pass_phrase)
-            if (response.find(it) != std::string::npos) {
-                return command_result::OK;
-            }
-        for (auto &it : fail_phrase)
-            if (response.find(it) != std::string::npos) {
-                return command_result::FAIL;
-            }
-        return command_result::TIMEOUT;
-    }, timeout_ms);
-
-}
+static constexpr reply_phrases<1, 1> ok_error({"OK"}, {"ERROR"});
+static constexpr reply_phrases<1, 1> connect_error({"CONNECT"}, {"ERROR"});
+static constexpr reply_phrases<1, 1> power_down_error({"POWER DOWN"}, {"ERROR"});
+static constexpr reply_phrases<1, 1> powered_down_error({"POWERED DOWN"}, {"ERROR"});
+static constexpr reply_phrases<1, 1> pb_done_error({"PB DONE"}, {"ERROR"});
+static constexpr reply_phrases<2, 1> no_carrier_ok_error({"NO CARRIER", "OK"}, {"ERROR"});
 
 command_result generic_command(CommandableIf *t, const std::string &command,
                                const std::string &pass_phrase,
                                const std::string &fail_phrase, uint32_t timeout_ms)
 {
-    ESP_LOGV(TAG, "%s", __func__ );
-    const auto pass = std::list<std::string_view>({pass_phrase});
-    const auto fail = std::list<std::string_view>({fail_phrase});
-    return generic_command(t, command, pass, fail, timeout_ms);
+    ESP_LOGD(TAG, "%s command %s\n", __func__, command.c_str());
+    const reply_phrases<1, 1> phrases({pass_phrase}, {fail_phrase});
+    return generic_command(t, command, phrases, timeout_ms);
 }
 
 /*
  * Purpose of this namespace is to provide different means of assigning the result to a string-like parameter.
- * By default we assign strings, which comes with an allocation. Alternatively we could take `std::span`
- * with user's buffer and directly copy the result, thus avoiding allocations (this is not used as of now)
+ * By default we assign strings, which comes with an allocation. Alternatively we take `char_span`
+ * with user's buffer and directly copy the result, thus avoiding allocations
  */
 namespace str_copy {
 
@@ -64,25 +44,39 @@ bool set(std::string &dest, std::string_view &src)
     return true;
 }
 
-/* This is an example of using std::span output in generic_get_string()
-bool set(std::span<char> &dest, std::string_view &src)
+bool set(char_span &dest, std::string_view &src)
 {
-    if (dest.size() >= src.size()) {
-        std::copy(src.begin(), src.end(), dest.data());
-        dest = dest.subspan(0, src.size());
+    if (dest.size == 0) {   // caller not interested in the output
         return true;
     }
-    ESP_LOGE(TAG, "Cannot set result of size %d (to span of size %d)", dest.size(), src.size());
-    return false;
+    if (src.size() >= dest.size) {
+        ESP_LOGW(TAG, "Result of size %d truncated (to span of size %d)", (int)src.size(), (int)dest.size);
+        src = src.substr(0, dest.size - 1);
+    }
+    std::copy(src.begin(), src.end(), dest.data);
+    dest.data[src.size()] = '\0';
+    dest.len = src.size();
+    return true;
 }
-*/
 
 } // str_copy
 
-template <typename T> command_result generic_get_string(CommandableIf *t, const std::string &command, T &output, uint32_t timeout_ms)
+/**
+ * @brief Reply stored on stack, used by the commands which parse the reply (to avoid allocations)
+ */
+struct reply_string : char_span {
+    reply_string(): char_span{buffer, sizeof(buffer)} {}
+    [[nodiscard]] std::string_view view() const
+    {
+        return std::string_view(data, len);
+    }
+    char buffer[128];
+};
+
+template <typename T> command_result generic_get_string(CommandableIf *t, std::string_view command, T &output, uint32_t timeout_ms)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return t->command(command, [&](uint8_t *data, size_t len) {
+    return t->command(command.data(), command.size(), [&](uint8_t *data, size_t len) {
         size_t pos = 0;
         std::string_view response((char *)data, len);
         while ((pos = response.find('\n')) != std::string::npos) {
@@ -105,13 +99,64 @@ template <typename T> command_result generic_get_string(CommandableIf *t, const
             response = response.substr(pos + 1);
         }
         return command_result::TIMEOUT;
-    }, timeout_ms);
+    }, timeout_ms, '\n');
 }
 
-command_result generic_command_common(CommandableIf *t, const std::string &command, uint32_t timeout_ms)
+command_result generic_command_common(CommandableIf *t, std::string_view command, uint32_t timeout_ms)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, command, "OK", "ERROR", timeout_ms);
+    ESP_LOGD(TAG, "%s command %.*s\n", __func__, static_cast<int>(command.size()), command.data());
+    return generic_command(t, command, ok_error, timeout_ms);
+}
+
+command_result generic_get_binary(CommandableIf *t, std::string_view command, const std::function<bool(uint8_t *data, size_t len)> &sink,
+                                  uint32_t timeout_ms, std::string_view prefix)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    enum step { HEADER, PAYLOAD, TRAILER };
+    return t->stream_command(command.data(), command.size(), [&](uint8_t *data, size_t len, stream_state & state) {
+        size_t pos = 0;
+        while (pos < len) {
+            if (state.step == PAYLOAD) {
+                auto n = std::min(state.remaining, len - pos);
+                if (!sink(data + pos, n)) {
+                    return command_result::FAIL;
+                }
+                pos += n;
+                state.remaining -= n;
+                if (state.remaining == 0) {
+                    state.step = TRAILER;
+                }
+                continue;
+            }
+            // header and trailer are processed in lines, incomplete line is passed again with the next chunk
+            auto end = static_cast<uint8_t *>(memchr(data + pos, '\n', len - pos));
+            if (end == nullptr) {
+                break;
+            }
+            std::string_view line((char *)data + pos, end - (data + pos));
+            pos = end - data + 1;
+            if (line.find("ERROR") != std::string_view::npos) {
+                return command_result::FAIL;
+            }
+            if (state.step == TRAILER && line.find("OK") != std::string_view::npos) {
+                return command_result::OK;
+            }
+            if (state.step == HEADER && line.substr(0, 2) == "OK") {
+                return command_result::OK;  // no header, nothing to read (e.g. at the end of a file)
+            }
+            if (state.step == HEADER && line.substr(0, prefix.size()) == prefix) {
+                line.remove_prefix(prefix.size());
+                line.remove_prefix(std::min(line.find_first_not_of(" :"), line.size()));
+                if (std::from_chars(line.data(), line.data() + line.size(), state.remaining).ec != std::errc()) {
+                    return command_result::FAIL;
+                }
+                state.step = state.remaining > 0 ? PAYLOAD : TRAILER;
+            }
+        }
+        state.consumed = pos;
+        return command_result::TIMEOUT;
+    }, timeout_ms);
 }
 
 command_result sync(CommandableIf *t)
@@ -129,7 +174,7 @@ command_result store_profile(CommandableIf *t)
 command_result power_down(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, "AT+QPOWD=1\r", "POWERED DOWN", "ERROR", 1000);
+    return generic_command(t, "AT+QPOWD=1\r", powered_down_error, 1000);
 }
 
 command_result power_down_sim76xx(CommandableIf *t)
@@ -141,25 +186,27 @@ command_result power_down_sim76xx(CommandableIf *t)
 command_result power_down_sim70xx(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, "AT+CPOWD=1\r", "POWER DOWN", "ERROR", 1000);
+    return generic_command(t, "AT+CPOWD=1\r", power_down_error, 1000);
 }
 
 command_result power_down_sim8xx(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, "AT+CPOWD=1\r", "POWER DOWN", "ERROR", 1000);
+    return generic_command(t, "AT+CPOWD=1\r", power_down_error, 1000);
 }
 
 command_result reset(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t,  "AT+CRESET\r", "PB DONE", "ERROR", 60000);
+    return generic_command(t,  "AT+CRESET\r", pb_done_error, 60000);
 }
 
 command_result set_baud(CommandableIf *t, int baud)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t,  "AT+IPR=" + std::to_string(baud) + "\r");
+    at_string<> cmd;
+    cmd << "AT+IPR=" << baud << "\r";
+    return generic_command_common(t, cmd.view());
 }
 
 command_result hang_up(CommandableIf *t)
@@ -171,11 +218,12 @@ command_result hang_up(CommandableIf *t)
 command_result get_battery_status(CommandableIf *t, int &voltage, int &bcs, int &bcl)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CBC\r", out);
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CBC\r", reply);
     if (ret != command_result::OK) {
         return ret;
     }
+    auto out = reply.view();
 
     constexpr std::string_view pattern = "+CBC: ";
     if (out.find(pattern) == std::string_view::npos) {
@@ -207,11 +255,12 @@ command_result get_battery_status(CommandableIf *t, int &voltage, int &bcs, int
 command_result get_battery_status_sim7xxx(CommandableIf *t, int &voltage, int &bcs, int &bcl)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CBC\r", out);
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CBC\r", reply);
     if (ret != command_result::OK) {
         return ret;
     }
+    auto out = reply.view();
     // Parsing +CBC: <voltage in Volts> V
     constexpr std::string_view pattern = "+CBC: ";
     constexpr int num_pos = pattern.size();
@@ -236,40 +285,57 @@ command_result get_battery_status_sim7xxx(CommandableIf *t, int &voltage, int &b
 command_result set_flow_control(CommandableIf *t, int dce_flow, int dte_flow)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+IFC=" + std::to_string(dce_flow) + "," + std::to_string(dte_flow) + "\r");
+    at_string<> cmd;
+    cmd << "AT+IFC=" << dce_flow << "," << dte_flow << "\r";
+    return generic_command_common(t, cmd.view());
 }
 
-command_result get_operator_name(CommandableIf *t, std::string &operator_name, int &act)
+template <typename T> command_result parse_operator_name(std::string_view out, T &operator_name, int &act)
 {
-    ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+COPS?\r", out, 75000);
-    if (ret != command_result::OK) {
-        return ret;
-    }
     auto pos = out.find("+COPS");
     auto property = 0;
     while (pos != std::string::npos) {
         // Looking for: +COPS: <mode>[, <format>[, <oper>[, <act>]]]
         if (property++ == 2) {  // operator name is after second comma (as a 3rd property of COPS string)
-            operator_name = out.substr(++pos);
-            auto additional_comma = operator_name.find(',');    // check for the optional ACT
-            if (additional_comma != std::string::npos && std::from_chars(operator_name.data() + additional_comma + 1, operator_name.data() + operator_name.length(), act).ec != std::errc::invalid_argument) {
-                operator_name = operator_name.substr(0, additional_comma);
+            auto name = out.substr(++pos);
+            auto additional_comma = name.find(',');    // check for the optional ACT
+            if (additional_comma != std::string::npos && std::from_chars(name.data() + additional_comma + 1, name.data() + name.length(), act).ec != std::errc::invalid_argument) {
+                name = name.substr(0, additional_comma);
             }
             // and strip quotes if present
-            auto quote1 = operator_name.find('"');
-            auto quote2 = operator_name.rfind('"');
+            auto quote1 = name.find('"');
+            auto quote2 = name.rfind('"');
             if (quote1 != std::string::npos && quote2 != std::string::npos) {
-                operator_name = operator_name.substr(quote1 + 1, quote2 - 1);
+                name = name.substr(quote1 + 1, quote2 - quote1 - 1);
             }
-            return command_result::OK;
+            return str_copy::set(operator_name, name) ? command_result::OK : command_result::FAIL;
         }
         pos = out.find(',', ++pos);
     }
     return command_result::FAIL;
 }
 
+template <typename T> command_result get_operator_name_impl(CommandableIf *t, T &operator_name, int &act)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+COPS?\r", reply, 75000);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    return parse_operator_name(reply.view(), operator_name, act);
+}
+
+command_result get_operator_name(CommandableIf *t, std::string &operator_name, int &act)
+{
+    return get_operator_name_impl(t, operator_name, act);
+}
+
+command_result get_operator_name(CommandableIf *t, char_span &operator_name, int &act)
+{
+    return get_operator_name_impl(t, operator_name, act);
+}
+
 command_result set_echo(CommandableIf *t, bool on)
 {
     ESP_LOGV(TAG, "%s", __func__ );
@@ -282,9 +348,12 @@ command_result set_echo(CommandableIf *t, bool on)
 command_result set_pdp_context(CommandableIf *t, PdpContext &pdp, uint32_t timeout_ms)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string pdp_command = "AT+CGDCONT=" + std::to_string(pdp.context_id) +
-                              ",\"" + pdp.protocol_type + "\",\"" + pdp.apn + "\"\r";
-    return generic_command_common(t, pdp_command, timeout_ms);
+    at_string<160> cmd;
+    cmd << "AT+CGDCONT=" << static_cast<int>(pdp.context_id) << ",\"" << pdp.protocol_type << "\",\"" << pdp.apn << "\"\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    return generic_command_common(t, cmd.view(), timeout_ms);
 }
 
 command_result set_pdp_context(CommandableIf *t, PdpContext &pdp)
@@ -295,27 +364,25 @@ command_result set_pdp_context(CommandableIf *t, PdpContext &pdp)
 command_result set_data_mode(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, "ATD*99#\r", "CONNECT", "ERROR", 5000);
+    return generic_command(t, "ATD*99#\r", connect_error, 5000);
 }
 
 command_result set_data_mode_alt(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, "ATD*99##\r", "CONNECT", "ERROR", 5000);
+    return generic_command(t, "ATD*99##\r", connect_error, 5000);
 }
 
 command_result resume_data_mode(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command(t, "ATO\r", "CONNECT", "ERROR", 5000);
+    return generic_command(t, "ATO\r", connect_error, 5000);
 }
 
 command_result set_command_mode(CommandableIf *t)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    const auto pass = std::list<std::string_view>({"NO CARRIER", "OK"});
-    const auto fail = std::list<std::string_view>({"ERROR"});
-    return generic_command(t, "+++", pass, fail, 5000);
+    return generic_command(t, "+++", no_carrier_ok_error, 5000);
 }
 
 command_result get_imsi(CommandableIf *t, std::string &imsi_number)
@@ -324,18 +391,36 @@ command_result get_imsi(CommandableIf *t, std::string &imsi_number)
     return generic_get_string(t, "AT+CIMI\r", imsi_number, 5000);
 }
 
+command_result get_imsi(CommandableIf *t, char_span &imsi_number)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    return generic_get_string(t, "AT+CIMI\r", imsi_number, 5000);
+}
+
 command_result get_imei(CommandableIf *t, std::string &out)
 {
     ESP_LOGV(TAG, "%s", __func__ );
     return generic_get_string(t, "AT+CGSN\r", out, 5000);
 }
 
+command_result get_imei(CommandableIf *t, char_span &out)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    return generic_get_string(t, "AT+CGSN\r", out, 5000);
+}
+
 command_result get_module_name(CommandableIf *t, std::string &out)
 {
     ESP_LOGV(TAG, "%s", __func__ );
     return generic_get_string(t, "AT+CGMM\r", out, 5000);
 }
 
+command_result get_module_name(CommandableIf *t, char_span &out)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    return generic_get_string(t, "AT+CGMM\r", out, 5000);
+}
+
 command_result sms_txt_mode(CommandableIf *t, bool txt = true)
 {
     ESP_LOGV(TAG, "%s", __func__ );
@@ -355,7 +440,12 @@ command_result sms_character_set(CommandableIf *t)
 command_result send_sms(CommandableIf *t, const std::string &number, const std::string &message)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    auto ret = t->command("AT+CMGS=\"" + number + "\"\r", [&](uint8_t *data, size_t len) {
+    at_string<> cmd;
+    cmd << "AT+CMGS=\"" << number << "\"\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    auto ret = t->command(cmd.view().data(), cmd.view().size(), [&](uint8_t *data, size_t len) {
         std::string_view response((char *)data, len);
         ESP_LOGD(TAG, "Send SMS response %.*s", static_cast<int>(response.size()), response.data());
         if (response.find('>') != std::string::npos) {
@@ -366,7 +456,13 @@ command_result send_sms(CommandableIf *t, const std::string &number, const std::
     if (ret != command_result::OK) {
         return ret;
     }
-    return generic_command_common(t, message + "\x1A", 120000);
+    at_string<256> sms;
+    sms << message << "\x1A";
+    if (!sms.ok()) {
+        // long (PDU) messages don't fit the stack buffer
+        return generic_command_common(t, message + "\x1A", 120000);
+    }
+    return generic_command_common(t, sms.view(), 120000);
 }
 
 
@@ -376,14 +472,8 @@ command_result set_cmux(CommandableIf *t)
     return generic_command_common(t, "AT+CMUX=0\r");
 }
 
-command_result read_pin(CommandableIf *t, bool &pin_ok)
+static command_result parse_pin(std::string_view out, bool &pin_ok)
 {
-    ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CPIN?\r", out);
-    if (ret != command_result::OK) {
-        return ret;
-    }
     if (out.find("+CPIN:") == std::string::npos) {
         return command_result::FAIL;
     }
@@ -398,45 +488,77 @@ command_result read_pin(CommandableIf *t, bool &pin_ok)
     return command_result::FAIL; // Neither pin-ok, nor waiting for pin/puk -> mark as error
 }
 
-command_result set_pin(CommandableIf *t, const std::string &pin)
+command_result read_pin(CommandableIf *t, bool &pin_ok)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string set_pin_command = "AT+CPIN=" + pin + "\r";
-    return generic_command_common(t, set_pin_command);
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CPIN?\r", reply);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    return parse_pin(reply.view(), pin_ok);
 }
 
-command_result at(CommandableIf *t, const std::string &cmd, std::string &out, int timeout = 500)
+command_result set_pin(CommandableIf *t, const std::string &pin)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string at_command = cmd + "\r";
-    return generic_get_string(t, at_command, out, timeout);
+    at_string<> cmd;
+    cmd << "AT+CPIN=" << pin << "\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    return generic_command_common(t, cmd.view());
 }
 
-command_result at_raw(CommandableIf *t, const std::string &cmd, std::string &out, const std::string &pass, const std::string &fail, int timeout = 500)
+template <typename T> command_result at_impl(CommandableIf *t, std::string_view cmd, T &out, int timeout)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return t->command(cmd, [&](uint8_t *data, size_t len) {
-        out.assign(reinterpret_cast<char *>(data), len);
+    at_string<128> at_command;
+    at_command << cmd << "\r";
+    if (!at_command.ok()) {
+        // user commands which don't fit the stack buffer
+        std::string long_command(cmd);
+        return generic_get_string(t, long_command + "\r", out, timeout);
+    }
+    return generic_get_string(t, at_command.view(), out, timeout);
+}
 
-        if (out.find(pass) != std::string::npos) {
-            return command_result::OK;
-        } else if (out.find(fail) != std::string::npos) {
+command_result at(CommandableIf *t, const std::string &cmd, std::string &out, int timeout = 500)
+{
+    return at_impl(t, cmd, out, timeout);
+}
+
+command_result at(CommandableIf *t, std::string_view cmd, char_span &out, int timeout)
+{
+    return at_impl(t, cmd, out, timeout);
+}
+
+template <typename T> command_result at_raw_impl(CommandableIf *t, std::string_view cmd, T &out, std::string_view pass, std::string_view fail, int timeout)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    const reply_phrases<1, 1> phrases({pass}, {fail});
+    size_t scanned = 0;
+    return t->command(cmd.data(), cmd.size(), [&](uint8_t *data, size_t len) {
+        std::string_view reply(reinterpret_cast<char *>(data), len);
+        if (!str_copy::set(out, reply)) {
             return command_result::FAIL;
         }
+        return phrases.scan(data, len, scanned);
+    }, timeout, '\n');
+}
 
-        return command_result::TIMEOUT;
-    }, timeout);
+command_result at_raw(CommandableIf *t, const std::string &cmd, std::string &out, const std::string &pass, const std::string &fail, int timeout = 500)
+{
+    return at_raw_impl(t, cmd, out, pass, fail, timeout);
 }
 
-command_result get_signal_quality(CommandableIf *t, int &rssi, int &ber)
+command_result at_raw(CommandableIf *t, std::string_view cmd, char_span &out, std::string_view pass, std::string_view fail, int timeout)
 {
-    ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CSQ\r", out);
-    if (ret != command_result::OK) {
-        return ret;
-    }
+    return at_raw_impl(t, cmd, out, pass, fail, timeout);
+}
 
+static command_result parse_signal_quality(std::string_view out, int &rssi, int &ber)
+{
     constexpr std::string_view pattern = "+CSQ: ";
     constexpr int rssi_pos = pattern.size();
     int ber_pos;
@@ -454,26 +576,38 @@ command_result get_signal_quality(CommandableIf *t, int &rssi, int &ber)
     return command_result::OK;
 }
 
+command_result get_signal_quality(CommandableIf *t, int &rssi, int &ber)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CSQ\r", reply);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    return parse_signal_quality(reply.view(), rssi, ber);
+}
+
 command_result set_operator(CommandableIf *t, int mode, int format, const std::string &oper)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+COPS=" + std::to_string(mode) + "," + std::to_string(format) + ",\"" + oper + "\"\r", 90000);
+    at_string<> cmd;
+    cmd << "AT+COPS=" << mode << "," << format << ",\"" << oper << "\"\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    return generic_command_common(t, cmd.view(), 90000);
 }
 
 command_result set_network_attachment_state(CommandableIf *t, int state)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+CGATT=" + std::to_string(state) + "\r");
+    at_string<> cmd;
+    cmd << "AT+CGATT=" << state << "\r";
+    return generic_command_common(t, cmd.view());
 }
 
-command_result get_network_attachment_state(CommandableIf *t, int &state)
+static command_result parse_network_attachment_state(std::string_view out, int &state)
 {
-    ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CGATT?\r", out);
-    if (ret != command_result::OK) {
-        return ret;
-    }
     constexpr std::string_view pattern = "+CGATT: ";
     constexpr int pos = pattern.size();
     if (out.find(pattern) == std::string::npos) {
@@ -487,20 +621,27 @@ command_result get_network_attachment_state(CommandableIf *t, int &state)
     return command_result::OK;
 }
 
-command_result set_radio_state(CommandableIf *t, int state)
+command_result get_network_attachment_state(CommandableIf *t, int &state)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+CFUN=" + std::to_string(state) + "\r", 15000);
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CGATT?\r", reply);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    return parse_network_attachment_state(reply.view(), state);
 }
 
-command_result get_radio_state(CommandableIf *t, int &state)
+command_result set_radio_state(CommandableIf *t, int state)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CFUN?\r", out);
-    if (ret != command_result::OK) {
-        return ret;
-    }
+    at_string<> cmd;
+    cmd << "AT+CFUN=" << state << "\r";
+    return generic_command_common(t, cmd.view(), 15000);
+}
+
+static command_result parse_radio_state(std::string_view out, int &state)
+{
     constexpr std::string_view pattern = "+CFUN: ";
     constexpr int pos = pattern.size();
     if (out.find(pattern) == std::string::npos) {
@@ -514,28 +655,46 @@ command_result get_radio_state(CommandableIf *t, int &state)
     return command_result::OK;
 }
 
+command_result get_radio_state(CommandableIf *t, int &state)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CFUN?\r", reply);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    return parse_radio_state(reply.view(), state);
+}
+
 command_result set_network_mode(CommandableIf *t, int mode)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+CNMP=" + std::to_string(mode) + "\r");
+    at_string<> cmd;
+    cmd << "AT+CNMP=" << mode << "\r";
+    return generic_command_common(t, cmd.view());
 }
 
 command_result set_preferred_mode(CommandableIf *t, int mode)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+CMNB=" + std::to_string(mode) + "\r");
+    at_string<> cmd;
+    cmd << "AT+CMNB=" << mode << "\r";
+    return generic_command_common(t, cmd.view());
 }
 
 command_result set_network_bands(CommandableIf *t, const std::string &mode, const int *bands, int size)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string band_string = "";
+    at_string<128> cmd;
+    cmd << "AT+CBANDCFG=\"" << mode << "\",";
     for (int i = 0; i < size - 1; ++i) {
-        band_string += std::to_string(bands[i]) + ",";
+        cmd << bands[i] << ",";
     }
-    band_string += std::to_string(bands[size - 1]);
-
-    return generic_command_common(t, "AT+CBANDCFG=\"" + mode + "\"," + band_string + "\r");
+    cmd << bands[size - 1] << "\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    return generic_command_common(t, cmd.view());
 }
 
 // mode is expected to be 64bit string (in hex)
@@ -545,8 +704,8 @@ command_result set_network_bands_sim76xx(CommandableIf *t, const std::string &mo
     ESP_LOGV(TAG, "%s", __func__ );
     static const char *hexDigits = "0123456789ABCDEF";
     uint64_t band_bits = 0;
-    int hex_len = 16;
-    std::string band_string(hex_len, '0');
+    const int hex_len = 16;
+    char band_string[hex_len];
     for (int i = 0; i < size; ++i) {
         // OR-operation to add bands
         auto band = bands[i] - 1; // Sim7600 has 0-indexed band selection (band 20 has to be shifted 19 places)
@@ -555,18 +714,16 @@ command_result set_network_bands_sim76xx(CommandableIf *t, const std::string &mo
     for (int i = hex_len; i > 0; i--) {
         band_string[i - 1] = hexDigits[(band_bits >> ((hex_len - i) * 4)) & 0xF];
     }
-    return generic_command_common(t, "AT+CNBP=" + mode + ",0x" + band_string + "\r");
+    at_string<> cmd;
+    cmd << "AT+CNBP=" << mode << ",0x" << std::string_view(band_string, hex_len) << "\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    return generic_command_common(t, cmd.view());
 }
 
-command_result get_network_system_mode(CommandableIf *t, int &mode)
+static command_result parse_network_system_mode(std::string_view out, int &mode)
 {
-    ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CNSMOD?\r", out);
-    if (ret != command_result::OK) {
-        return ret;
-    }
-
     constexpr std::string_view pattern = "+CNSMOD: ";
     int mode_pos = out.find(",") + 1; // Skip "<n>,"
     if (out.find(pattern) == std::string::npos) {
@@ -580,20 +737,34 @@ command_result get_network_system_mode(CommandableIf *t, int &mode)
     return command_result::OK;
 }
 
+command_result get_network_system_mode(CommandableIf *t, int &mode)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CNSMOD?\r", reply);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    return parse_network_system_mode(reply.view(), mode);
+}
+
 command_result set_gnss_power_mode(CommandableIf *t, int mode)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+CGNSPWR=" + std::to_string(mode) + "\r");
+    at_string<> cmd;
+    cmd << "AT+CGNSPWR=" << mode << "\r";
+    return generic_command_common(t, cmd.view());
 }
 
 command_result get_gnss_power_mode(CommandableIf *t, int &mode)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string out;
-    auto ret = generic_get_string(t, "AT+CGNSPWR?\r", out);
+    reply_string reply;
+    auto ret = generic_get_string(t, "AT+CGNSPWR?\r", reply);
     if (ret != command_result::OK) {
         return ret;
     }
+    auto out = reply.view();
     constexpr std::string_view pattern = "+CGNSPWR: ";
     constexpr int pos = pattern.size();
     if (out.find(pattern) == std::string::npos) {
@@ -607,10 +778,248 @@ command_result get_gnss_power_mode(CommandableIf *t, int &mode)
     return command_result::OK;
 }
 
+static const uint32_t file_chunk_timeout_ms = 5000;
+
+static command_result open_file_quectel(CommandableIf *t, std::string_view name, int mode, int &handle)
+{
+    at_string<128> cmd;
+    cmd << "AT+QFOPEN=\"" << name << "\"," << mode << "\r";
+    if (!cmd.ok()) {
+        return command_result::FAIL;
+    }
+    reply_string reply;
+    auto ret = generic_get_string(t, cmd.view(), reply, 1000);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    auto out = reply.view();
+    constexpr std::string_view pattern = "+QFOPEN: ";
+    auto pos = out.find(pattern);
+    if (pos == std::string_view::npos ||
+            std::from_chars(out.data() + pos + pattern.size(), out.data() + out.size(), handle).ec != std::errc()) {
+        return command_result::FAIL;
+    }
+    return command_result::OK;
+}
+
+static command_result close_file_quectel(CommandableIf *t, int handle)
+{
+    at_string<> cmd;
+    cmd << "AT+QFCLOSE=" << handle << "\r";
+    return generic_command_common(t, cmd.view());
+}
+
+static command_result write_file_chunk_quectel(CommandableIf *t, int handle, uint8_t *data, size_t len)
+{
+    at_string<> cmd;
+    cmd << "AT+QFWRITE=" << handle << "," << static_cast<int>(len) << "\r";
+    auto ret = generic_command(t, cmd.view(), connect_error, file_chunk_timeout_ms);
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    // the chunk is sent as raw data (binary safe, as the module expects the exact length)
+    // and acknowledged with +QFWRITE: <written>,<total>
+    size_t written = 0;
+    ret = t->command(reinterpret_cast<char *>(data), len, [&](uint8_t *reply, size_t reply_len) {
+        std::string_view out((char *)reply, reply_len);
+        if (out.find("ERROR") != std::string_view::npos) {
+            return command_result::FAIL;
+        }
+        constexpr std::string_view pattern = "+QFWRITE: ";
+        auto pos = out.find(pattern);
+        if (pos == std::string_view::npos || out.find("OK", pos) == std::string_view::npos) {
+            return command_result::TIMEOUT;
+        }
+        std::from_chars(out.data() + pos + pattern.size(), out.data() + out.size(), written);
+        return command_result::OK;
+    }, file_chunk_timeout_ms, '\n');
+    if (ret == command_result::OK && written != len) {
+        return command_result::FAIL;
+    }
+    return ret;
+}
+
+command_result upload_file_quectel(CommandableIf *t, std::string_view name, const file_read_cb &source, size_t chunk_size)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    int handle;
+    auto ret = open_file_quectel(t, name, 1, handle);   // create, or overwrite the existing file
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    auto chunk = std::make_unique<uint8_t[]>(chunk_size);
+    while (true) {
+        int len = source(chunk.get(), chunk_size);
+        if (len <= 0) {
+            ret = len == 0 ? command_result::OK : command_result::FAIL;
+            break;
+        }
+        ret = write_file_chunk_quectel(t, handle, chunk.get(), len);
+        if (ret != command_result::OK) {
+            break;
+        }
+    }
+    auto close_ret = close_file_quectel(t, handle);
+    return ret == command_result::OK ? close_ret : ret;
+}
+
+command_result download_file_quectel(CommandableIf *t, std::string_view name, const file_write_cb &sink, size_t chunk_size)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    int handle;
+    auto ret = open_file_quectel(t, name, 2, handle);   // read only
+    if (ret != command_result::OK) {
+        return ret;
+    }
+    at_string<> cmd;
+    cmd << "AT+QFREAD=" << handle << "," << static_cast<int>(chunk_size) << "\r";
+    size_t received;
+    do {
+        // the chunk is streamed to the sink, so it doesn't need to fit in the DTE buffer
+        received = 0;
+        ret = generic_get_binary(t, cmd.view(), [&](uint8_t *data, size_t len) {
+            received += len;
+            return sink(data, len);
+        }, file_chunk_timeout_ms);
+    } while (ret == command_result::OK && received == chunk_size);
+    auto close_ret = close_file_quectel(t, handle);
+    return ret == command_result::OK ? close_ret : ret;
+}
+
 command_result set_gnss_power_mode_sim76xx(CommandableIf *t, int mode)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return generic_command_common(t, "AT+CGPS=" + std::to_string(mode) + "\r");
+    at_string<> cmd;
+    cmd << "AT+CGPS=" << mode << "\r";
+    return generic_command_common(t, cmd.view());
+}
+
+command_result batch(CommandableIf *t, CommandBatch &queries)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    auto &q = queries.queries;
+    if (queries.count == 0 || queries.overflow) {
+        return command_result::FAIL;
+    }
+    // concatenate the queries to one line: AT+CSQ;+CGATT?;+COPS?
+    at_string<128> cmd;
+    uint32_t timeout_ms = 0;
+    cmd << "AT";
+    for (size_t i = 0; i < queries.count; ++i) {
+        cmd << (i ? ";" : "") << q[i].command;
+        timeout_ms = std::max(timeout_ms, q[i].timeout_ms);
+        q[i].result = command_result::TIMEOUT;
+    }
+    cmd << "\r";
+    if (!cmd.ok()) {
+        ESP_LOGE(TAG, "Batch of %d queries doesn't fit the command line", (int)queries.count);
+        return command_result::FAIL;
+    }
+    // replies come in the order of queries, so we parse the lines as they complete
+    size_t parsed = 0;
+    size_t next = 0;
+    auto ret = t->command(cmd.view().data(), cmd.view().size(), [&](uint8_t *data, size_t len) {
+        if (len < parsed) {
+            parsed = 0;
+        }
+        std::string_view response(reinterpret_cast<char *>(data) + parsed, len - parsed);
+        size_t pos;
+        while ((pos = response.find('\n')) != std::string::npos) {
+            auto line = response.substr(0, pos);
+            while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
+                line.remove_suffix(1);
+            }
+            response.remove_prefix(pos + 1);
+            parsed += pos + 1;
+            if (line == "OK") {
+                return command_result::OK;
+            }
+            if (line == "ERROR" || line.substr(0, 11) == "+CME ERROR:") {
+                return command_result::FAIL;
+            }
+            for (size_t i = next; i < queries.count; ++i) {
+                if (line.substr(0, q[i].prefix.size()) == q[i].prefix) {
+                    q[i].result = q[i].parse(line);
+                    next = i + 1;
+                    break;
+                }
+            }
+        }
+        return command_result::TIMEOUT;
+    }, timeout_ms, '\n');
+    // queries without a reply line fail if the device completed the line, or time out
+    for (size_t i = 0; i < queries.count; ++i) {
+        if (q[i].result == command_result::TIMEOUT && ret != command_result::TIMEOUT) {
+            q[i].result = command_result::FAIL;
+        }
+        if (q[i].result != command_result::OK && ret == command_result::OK) {
+            ret = command_result::FAIL;
+        }
+    }
+    return ret;
 }
 
 } // esp_modem::dce_commands
+
+namespace esp_modem {
+
+CommandBatch &CommandBatch::add(std::string_view command, std::string_view prefix, parser parse, uint32_t timeout_ms)
+{
+    if (count == max_queries) {
+        overflow = true;
+        return *this;
+    }
+    queries[count++] = { command, prefix, std::move(parse), timeout_ms, command_result::TIMEOUT };
+    return *this;
+}
+
+CommandBatch &CommandBatch::signal_quality(int &rssi, int &ber)
+{
+    return add("+CSQ", "+CSQ:", [&rssi, &ber](std::string_view line) {
+        return dce_commands::parse_signal_quality(line, rssi, ber);
+    });
+}
+
+CommandBatch &CommandBatch::network_attachment_state(int &state)
+{
+    return add("+CGATT?", "+CGATT:", [&state](std::string_view line) {
+        return dce_commands::parse_network_attachment_state(line, state);
+    });
+}
+
+CommandBatch &CommandBatch::radio_state(int &state)
+{
+    return add("+CFUN?", "+CFUN:", [&state](std::string_view line) {
+        return dce_commands::parse_radio_state(line, state);
+    }, 15000);
+}
+
+CommandBatch &CommandBatch::network_system_mode(int &mode)
+{
+    return add("+CNSMOD?", "+CNSMOD:", [&mode](std::string_view line) {
+        return dce_commands::parse_network_system_mode(line, mode);
+    });
+}
+
+CommandBatch &CommandBatch::operator_name(std::string &name, int &act)
+{
+    return add("+COPS?", "+COPS:", [&name, &act](std::string_view line) {
+        return dce_commands::parse_operator_name(line, name, act);
+    }, 75000);
+}
+
+CommandBatch &CommandBatch::operator_name(char_span &name, int &act)
+{
+    return add("+COPS?", "+COPS:", [&name, &act](std::string_view line) {
+        return dce_commands::parse_operator_name(line, name, act);
+    }, 75000);
+}
+
+CommandBatch &CommandBatch::pin(bool &pin_ok)
+{
+    return add("+CPIN?", "+CPIN:", [&pin_ok](std::string_view line) {
+        return dce_commands::parse_pin(line, pin_ok);
+    });
+}
+
+} // esp_modem
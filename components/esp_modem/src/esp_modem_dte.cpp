@@ -5,142 +5,459 @@
  */
 
 #include <cstring>
+#include <algorithm>
+#include <chrono>
 #include "esp_log.h"
 #include "cxx_include/esp_modem_dte.hpp"
 #include "cxx_include/esp_modem_cmux.hpp"
 #include "esp_modem_config.h"
 
+#ifdef CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
+#warning "CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED has no effect, set esp_modem_dte_config::reply_buffer_size to fit the longest reply instead"
+#endif
+
 using namespace esp_modem;
 
 static const size_t dte_default_buffer_size = 1000;
+static const size_t dte_default_reply_buffer_size = 512;
+static const uint32_t dte_default_task_stack_size = 4096;
+static const unsigned dte_default_task_priority = 5;
+static const size_t rx_flow_off_percent = 75;   // Fill level of the Rx ring to stop the device from sending (streamed replies in CMUX modes)
+static const size_t rx_flow_on_percent = 25;    // Fill level of the Rx ring to let the device send again
 
 DTE::DTE(const esp_modem_dte_config *config, std::unique_ptr<Terminal> terminal):
     buffer(config->dte_buffer_size),
+    rx_ring(config->reply_buffer_size ? config->reply_buffer_size : config->dte_buffer_size),
     cmux_term(nullptr), primary_term(std::move(terminal)), secondary_term(primary_term),
-    mode(modem_mode::UNDEF)
+    mode(modem_mode::UNDEF), cmux_config(config->cmux_config),
+    task_stack_size(config->task_stack_size), task_priority(config->task_priority)
 {
     set_command_callbacks();
 }
 
 DTE::DTE(std::unique_ptr<Terminal> terminal):
     buffer(dte_default_buffer_size),
+    rx_ring(dte_default_reply_buffer_size),
     cmux_term(nullptr), primary_term(std::move(terminal)), secondary_term(primary_term),
-    mode(modem_mode::UNDEF)
+    mode(modem_mode::UNDEF),
+    task_stack_size(dte_default_task_stack_size), task_priority(dte_default_task_priority)
 {
     set_command_callbacks();
 }
 
 DTE::DTE(const esp_modem_dte_config *config, std::unique_ptr<Terminal> t, std::unique_ptr<Terminal> s):
     buffer(config->dte_buffer_size),
+    rx_ring(config->reply_buffer_size ? config->reply_buffer_size : config->dte_buffer_size),
     cmux_term(nullptr), primary_term(std::move(t)), secondary_term(std::move(s)),
-    mode(modem_mode::DUAL_MODE)
+    mode(modem_mode::DUAL_MODE), cmux_config(config->cmux_config),
+    task_stack_size(config->task_stack_size), task_priority(config->task_priority)
 {
     set_command_callbacks();
 }
 
 DTE::DTE(std::unique_ptr<Terminal> t, std::unique_ptr<Terminal> s):
     buffer(dte_default_buffer_size),
+    rx_ring(dte_default_reply_buffer_size),
     cmux_term(nullptr), primary_term(std::move(t)), secondary_term(std::move(s)),
-    mode(modem_mode::DUAL_MODE)
+    mode(modem_mode::DUAL_MODE),
+    task_stack_size(dte_default_task_stack_size), task_priority(dte_default_task_priority)
 {
     set_command_callbacks();
 }
 
+DTE::~DTE()
+{
+    // stop reading first, as the read callbacks use the members, which are destroyed before the terminals
+    if (cmux_term) {
+        exit_cmux_internal();   // takes the physical terminal back from CMUX
+    }
+    primary_term->stop();
+    primary_term->set_read_cb(nullptr);
+    if (secondary_term != primary_term) {
+        secondary_term->stop();
+        secondary_term->set_read_cb(nullptr);
+    }
+    if (async_commands.task) {
+        async_commands.signal.set(command_queue::EXIT);
+        async_commands.signal.wait(command_queue::EXITED, portMAX_DELAY);
+        async_commands.task->release();    // the task deletes itself
+        async_commands.task.reset();
+    }
+    for (auto &r : async_commands.requests) {
+        if (r.job) {
+            r.job(true);
+            continue;
+        }
+        r.result.set_value(command_result::FAIL);
+    }
+}
+
 void DTE::set_command_callbacks()
 {
     primary_term->set_read_cb([this](uint8_t *data, size_t len) {
-        Scoped<Lock> l(command_cb.line_lock);
-        if (command_cb.got_line == nullptr) {
-            return false;
-        }
-        if (data) {
-            // For terminals which post data directly with the callback (CMUX)
-            // we cannot defragment unless we allocate, but
-            // we'll try to process the data on the actual buffer
-#ifdef CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
-            if (inflatable.consumed != 0) {
-                inflatable.grow(inflatable.consumed + len);
-                std::memcpy(inflatable.current(), data, len);
-                data = inflatable.begin();
+        urc_router *router;
+        bool ret;
+        bool post_urc = false;
+        {
+            Scoped<Lock> l(command_cb.line_lock);
+            router = command_cb.stream ? nullptr : urc.get();
+            if (command_cb.stream) {
+                ret = read_stream(data, len);
+            } else if (router) {
+                ret = read_urc(*router, data, len);
+            } else if (command_cb.got_line == nullptr) {
+                // nobody is waiting for the data, but they have to be read out, as the terminal
+                // keeps reporting the unread data
+                discard(data, len);
+                return false;
+            } else {
+                ret = read_command(data, len);
             }
-            if (command_cb.process_line(data, inflatable.consumed, len)) {
-                return true;
+            update_rx_flow();
+            if (router && router->pending.available() && !router->posted) {
+                router->posted = post_urc = true;
             }
-            // at this point we're sure that the data processing hasn't finished,
-            // and we have to grow the inflatable buffer (if enabled) or give up
-            if (inflatable.consumed == 0) {
-                inflatable.grow(len);
-                std::memcpy(inflatable.begin(), data, len);
-            }
-            inflatable.consumed += len;
-            return false;
-#else
-            if (command_cb.process_line(data, 0, len)) {
-                return true;
-            }
-            // cannot inflate and the processing hasn't finishes in the first iteration, but continue
-            // (will post next fragments to the parser, since we might be just missing a last token or OK
-            return false;
-#endif
         }
-        // data == nullptr: Terminals which request users to read current data
-        // we're able to use DTE's buffer to defragment it; as long as we consume less that the buffer size
-        if (buffer.size > buffer.consumed) {
-            data = buffer.get();
-            len = primary_term->read(data + buffer.consumed, buffer.size - buffer.consumed);
-            if (command_cb.process_line(data, buffer.consumed, len)) {
-                return true;
-            }
-            buffer.consumed += len;
-            return false;
+        if (post_urc) {
+            // URC handlers are called from the command task, so they don't block reading the terminal
+            post([this](bool cancelled) {
+                if (!cancelled) {
+                    dispatch_urc();
+                }
+            });
         }
-        // we have used the entire DTE's buffer, need to use the inflatable buffer to continue
-#ifdef CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
-        if (inflatable.consumed == 0) {
-            inflatable.grow(buffer.size + len);
-            std::memcpy(inflatable.begin(), buffer.get(), buffer.size);
-            inflatable.consumed = buffer.size;
-        } else {
-            inflatable.grow(inflatable.consumed + len);
+        return ret;
+    });
+    primary_term->set_error_cb([this](terminal_error err) {
+        on_error(err);
+    });
+    secondary_term->set_error_cb([this](terminal_error err) {
+        on_error(err);
+    });
+
+}
+
+void DTE::on_error(terminal_error err)
+{
+    stats.update([err](dte_stats & s) {
+        s.errors[static_cast<size_t>(err)]++;
+    });
+    if (user_error_cb) {
+        user_error_cb(err);
+    }
+    handle_error(err);
+}
+
+/**
+ * @brief Helpers adding the received/sent bytes and completed commands to the statistics
+ */
+static void count_rx(Stats<dte_stats> &stats, esp_modem_channel_stats dte_stats::*channel, size_t len)
+{
+    stats.update([channel, len](dte_stats & s) {
+        (s.*channel).rx_bytes += len;
+    });
+}
+
+static void count_tx(Stats<dte_stats> &stats, esp_modem_channel_stats dte_stats::*channel, int len)
+{
+    if (len > 0) {
+        stats.update([channel, len](dte_stats & s) {
+            (s.*channel).tx_bytes += len;
+        });
+    }
+}
+
+static void count_command(Stats<dte_stats> &stats, std::string_view command, command_result result,
+                          std::chrono::steady_clock::time_point start)
+{
+    auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    stats.update([command, result, time_ms](dte_stats & s) {
+        add_command_stats(s, command, result, static_cast<uint32_t>(time_ms));
+    });
+}
+
+bool DTE::read_command(uint8_t *data, size_t len)
+{
+    if (data) {
+        count_rx(stats, &dte_stats::command, len);
+        // For terminals which post data directly with the callback (CMUX)
+        // we copy the data to the ring buffer to defragment it
+        if (rx_ring.push(data, len)) {
+            return command_cb.process_line(rx_ring, len);
+        }
+        // the reply doesn't fit in the ring buffer -> report a failure (instead of waiting for the timeout)
+        command_cb.give_up();
+        return true;
+    }
+    // data == nullptr: Terminals which request users to read current data
+    // are read directly to the ring buffer, as long as it's not full
+    size_t contiguous;
+    data = rx_ring.write_ptr(contiguous);
+    if (contiguous == 0) {
+        // the reply doesn't fit in the ring buffer -> report a failure
+        command_cb.give_up();
+        return true;
+    }
+    len = primary_term->read(data, contiguous);
+    rx_ring.commit(len);
+    if (len == contiguous) {
+        // we've read up to the wrap point, continue from the beginning of the ring
+        data = rx_ring.write_ptr(contiguous);
+        if (contiguous > 0) {
+            auto wrapped_len = primary_term->read(data, contiguous);
+            rx_ring.commit(wrapped_len);
+            len += wrapped_len;
+        }
+    }
+    count_rx(stats, &dte_stats::command, len);
+    return command_cb.process_line(rx_ring, len);
+}
+
+void DTE::discard(uint8_t *data, size_t len)
+{
+    if (data == nullptr) {
+        uint8_t chunk[64];
+        do {
+            len = primary_term->read(chunk, sizeof(chunk));
+            count_rx(stats, &dte_stats::command, len);
+        } while (len == sizeof(chunk));
+    } else {
+        count_rx(stats, &dte_stats::command, len);
+    }
+    ESP_LOGD("esp_modem_dte", "No command in progress, dropped unsolicited data");
+}
+
+bool DTE::read_stream(uint8_t *data, size_t len)
+{
+    if (command_cb.result != command_result::TIMEOUT) {
+        return false;   // the reply has been processed already
+    }
+    if (data) {
+        count_rx(stats, &dte_stats::command, len);
+        return command_cb.process_chunk(rx_ring, data, len);
+    }
+    // read directly to the ring buffer, which keeps only the data not consumed by the callback
+    size_t contiguous;
+    do {
+        data = rx_ring.write_ptr(contiguous);
+        if (contiguous == 0) {
+            // the callback doesn't consume the data and there's no space left -> report a failure
+            command_cb.give_up();
+            return true;
         }
-        len = primary_term->read(inflatable.current(), len);
-        if (command_cb.process_line(inflatable.begin(), inflatable.consumed, len)) {
+        len = primary_term->read(data, contiguous);
+        rx_ring.commit(len);
+        count_rx(stats, &dte_stats::command, len);
+        if (len > 0 && command_cb.process_chunk(rx_ring)) {
             return true;
         }
-        inflatable.consumed += len;
+    } while (len == contiguous);
+    return false;
+}
+
+bool DTE::set_urc_cb(const std::string &prefix, urc_cb f)
+{
+    if (prefix.empty() || prefix.size() >= urc_router::max_line) {
         return false;
-#else
-        // cannot inflate -> report a failure
-        command_cb.give_up();
-        return true;
-#endif
+    }
+    Scoped<Lock> l(command_cb.line_lock);
+    if (!urc) {
+        urc = std::make_unique<urc_router>();
+    }
+    auto &entries = urc->entries;
+    auto it = std::lower_bound(entries.begin(), entries.end(), prefix, [](const urc_router::entry & e, const std::string & p) {
+        return e.prefix < p;
     });
-    primary_term->set_error_cb([this](terminal_error err) {
-        if (user_error_cb) {
-            user_error_cb(err);
+    bool exists = it != entries.end() && it->prefix == prefix;
+    if (f == nullptr) {
+        if (exists) {
+            entries.erase(it);
         }
-        handle_error(err);
+        return true;
+    }
+    if (exists) {
+        it->cb = std::move(f);
+        return true;
+    }
+    // commands containing the prefix (without the trailing separators) expect the same line as a reply
+    auto key = prefix.substr(0, prefix.find_last_not_of(": ") + 1);
+    entries.insert(it, {prefix, key.empty() ? prefix : key, std::move(f)});
+    return true;
+}
+
+const DTE::urc_router::entry *DTE::urc_router::find(const uint8_t *data, size_t len, bool &partial) const
+{
+    partial = false;
+    // entries are sorted, so we check only the ones starting with the same character
+    auto it = std::lower_bound(entries.begin(), entries.end(), data[0], [](const entry & e, uint8_t c) {
+        return static_cast<uint8_t>(e.prefix[0]) < c;
     });
-    secondary_term->set_error_cb([this](terminal_error err) {
-        if (user_error_cb) {
-            user_error_cb(err);
+    for (; it != entries.end() && static_cast<uint8_t>(it->prefix[0]) == data[0]; ++it) {
+        auto n = std::min(len, it->prefix.size());
+        if (memcmp(it->prefix.data(), data, n) == 0) {
+            if (n == it->prefix.size()) {
+                return &*it;
+            }
+            partial = true;
         }
-        handle_error(err);
-    });
+    }
+    return nullptr;
+}
 
+bool DTE::read_urc(urc_router &router, uint8_t *data, size_t len)
+{
+    if (data == nullptr) {
+        // read the terminal in small chunks, since we have to split lines out of the stream before collecting replies
+        uint8_t chunk[64];
+        bool ret = false;
+        do {
+            len = primary_term->read(chunk, sizeof(chunk));
+            count_rx(stats, &dte_stats::command, len);
+            ret |= route_urc(router, chunk, len);
+        } while (len == sizeof(chunk));
+        return ret;
+    }
+    count_rx(stats, &dte_stats::command, len);
+    return route_urc(router, data, len);
+}
+
+bool DTE::route_urc(urc_router &router, uint8_t *data, size_t len)
+{
+    size_t collected = 0;
+    bool ret = false;
+    auto solicited = [&](uint8_t *d, size_t n) {
+        if (command_cb.got_line == nullptr || n == 0) {
+            return;     // nobody is waiting for this data
+        }
+        if (rx_ring.push(d, n)) {
+            collected += n;
+        } else {
+            ret |= command_cb.process_line(d, 0, n);
+        }
+    };
+    size_t i = 0;
+    while (i < len) {
+        if (router.state == urc_router::line_state::SOLICITED) {
+            auto end = static_cast<uint8_t *>(memchr(data + i, '\n', len - i));
+            size_t n = end ? end - (data + i) + 1 : len - i;
+            solicited(data + i, n);
+            i += n;
+            if (end) {
+                router.state = urc_router::line_state::LINE_START;
+            }
+            continue;
+        }
+        uint8_t c = data[i++];
+        if (router.line_len < urc_router::max_line) {
+            router.line[router.line_len++] = c;
+        }
+        if (router.state == urc_router::line_state::LINE_START) {
+            // hold the beginning of the line until we know if it's a URC
+            bool partial;
+            auto entry = router.find(router.line, router.line_len, partial);
+            if (entry && command_cb.command.find(entry->key) == std::string_view::npos) {
+                router.state = urc_router::line_state::URC;
+            } else if (entry || !partial || c == '\n') {
+                solicited(router.line, router.line_len);
+                router.line_len = 0;
+                router.state = c == '\n' ? urc_router::line_state::LINE_START : urc_router::line_state::SOLICITED;
+                continue;
+            }
+        }
+        if (router.state == urc_router::line_state::URC && c == '\n') {
+            if (!router.pending.push(router.line, router.line_len)) {
+                ESP_LOGW("esp_modem_dte", "URC dropped, too many pending");
+            }
+            router.line_len = 0;
+            router.state = urc_router::line_state::LINE_START;
+        }
+    }
+    if (collected) {
+        ret |= command_cb.process_line(rx_ring, collected);
+    }
+    return ret;
+}
+
+void DTE::dispatch_urc()
+{
+    // the lines are pushed by the terminal's thread, so we take them out with the line lock held,
+    // but call the handlers without it (so they could send commands)
+    uint8_t line[urc_router::max_line];
+    while (true) {
+        size_t len;
+        urc_cb cb;
+        {
+            Scoped<Lock> l(command_cb.line_lock);
+            if (!urc || urc->pending.available() == 0) {
+                if (urc) {
+                    urc->posted = false;
+                }
+                return;
+            }
+            auto &pending = urc->pending;
+            auto data = pending.linearize();
+            auto end = static_cast<uint8_t *>(memchr(data, '\n', pending.available()));
+            len = end ? end - data + 1 : pending.available();
+            if (len > urc_router::max_line) {
+                len = urc_router::max_line;     // lines are pushed truncated (possibly without the newline)
+            }
+            bool partial;
+            if (auto entry = urc->find(data, len, partial)) {
+                cb = entry->cb;
+            }
+            memcpy(line, data, len);
+            pending.consume(len);
+        }
+        if (cb) {
+            cb(line, len);
+        }
+    }
 }
 
 command_result DTE::command(const std::string &command, got_line_cb got_line, uint32_t time_ms, const char separator)
+{
+    return DTE::command(command.c_str(), command.length(), std::move(got_line), time_ms, separator);
+}
+
+command_result DTE::command(const char *command, size_t len, got_line_cb got_line, uint32_t time_ms, const char separator)
 {
     Scoped<Lock> l1(internal_lock);
-    command_cb.set(got_line, separator);
-    primary_term->write((uint8_t *)command.c_str(), command.length());
+    auto start = std::chrono::steady_clock::now();
+    command_cb.set(std::move(got_line), separator, std::string_view(command, len));
+    count_tx(stats, &dte_stats::command, primary_term->write((uint8_t *)command, len));
     command_cb.wait_for_line(time_ms);
     command_cb.set(nullptr);
-    buffer.consumed = 0;
-#ifdef CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
-    inflatable.deflate();
-#endif
+    {
+        // after the reader has processed the last data (and possibly stopped the flow)
+        Scoped<Lock> l2(command_cb.line_lock);
+        rx_ring.clear();
+        update_rx_flow();
+    }
+    count_command(stats, std::string_view(command, len), command_cb.result, start);
+    return command_cb.result;
+}
+
+command_result DTE::stream_command(const char *command, size_t len, stream_cb on_chunk, uint32_t time_ms)
+{
+    Scoped<Lock> l1(internal_lock);
+    auto start = std::chrono::steady_clock::now();
+    command_cb.set_stream(std::move(on_chunk), std::string_view(command, len));
+    count_tx(stats, &dte_stats::command, primary_term->write((uint8_t *)command, len));
+    // the timeout applies to each chunk, so long replies don't need to fit in one
+    while (command_cb.signal.wait_any(command_cb::GOT_LINE | command_cb::GOT_DATA, time_ms)) {
+        if (command_cb.signal.is_any(command_cb::GOT_LINE)) {
+            break;
+        }
+        command_cb.signal.clear(command_cb::GOT_DATA);
+    }
+    command_cb.set(nullptr);
+    {
+        // after the reader has processed the last data (and possibly stopped the flow)
+        Scoped<Lock> l2(command_cb.line_lock);
+        rx_ring.clear();
+        update_rx_flow();
+    }
+    count_command(stats, std::string_view(command, len), command_cb.result, start);
     return command_cb.result;
 }
 
@@ -149,6 +466,57 @@ command_result DTE::command(const std::string &cmd, got_line_cb got_line, uint32
     return command(cmd, got_line, time_ms, '\n');
 }
 
+void DTE::start_command_task()
+{
+    if (!async_commands.task) {
+        async_commands.task = std::make_unique<Task>(task_stack_size, task_priority, this, [](void *p) {
+            static_cast<DTE *>(p)->command_task();
+            Task::Delete();
+        });
+    }
+}
+
+std::future<command_result> DTE::command_async(const std::string &command, got_line_cb got_line, uint32_t time_ms, const char separator)
+{
+    Scoped<Lock> l(async_commands.lock);
+    start_command_task();
+    async_commands.requests.push_back({command, std::move(got_line), time_ms, separator, {}, nullptr});
+    auto result = async_commands.requests.back().result.get_future();
+    async_commands.signal.set(command_queue::REQUEST);
+    return result;
+}
+
+void DTE::post(std::function<void(bool cancelled)> job)
+{
+    Scoped<Lock> l(async_commands.lock);
+    start_command_task();
+    async_commands.requests.push_back({{}, nullptr, 0, '\n', {}, std::move(job)});
+    async_commands.signal.set(command_queue::REQUEST);
+}
+
+void DTE::command_task()
+{
+    while (!async_commands.signal.is_any(command_queue::EXIT)) {
+        async_commands.lock.lock();
+        if (async_commands.requests.empty()) {
+            async_commands.signal.clear(command_queue::REQUEST);
+            async_commands.lock.unlock();
+            async_commands.signal.wait_any(command_queue::REQUEST | command_queue::EXIT, portMAX_DELAY);
+            continue;
+        }
+        auto request = std::move(async_commands.requests.front());
+        async_commands.requests.pop_front();
+        async_commands.lock.unlock();
+        if (request.job) {
+            request.job(false);
+            continue;
+        }
+        // the next command is sent as soon as this one completes (or times out)
+        request.result.set_value(command(request.command, std::move(request.got_line), request.time_ms, request.separator));
+    }
+    async_commands.signal.set(command_queue::EXITED);
+}
+
 bool DTE::exit_cmux()
 {
     if (!cmux_term) {
@@ -182,7 +550,7 @@ bool DTE::setup_cmux()
         ESP_LOGE("esp_modem_dte", "Cannot setup_cmux(), cmux_term already exists");
         return false;
     }
-    cmux_term = std::make_shared<CMux>(primary_term, std::move(buffer));
+    cmux_term = std::make_shared<CMux>(primary_term, std::move(buffer), &cmux_config, cmux_counters);
     if (cmux_term == nullptr) {
         return false;
     }
@@ -289,6 +657,7 @@ void DTE::set_read_cb(std::function<bool(uint8_t *, size_t)> f)
             data = buffer.get();
             len = secondary_term->read(buffer.get(), buffer.size);
         }
+        count_rx(stats, &dte_stats::data, len);
         if (on_data) {
             return on_data(data, len);
         }
@@ -307,18 +676,25 @@ int DTE::read(uint8_t **d, size_t len)
     auto data_to_read = std::min(len, buffer.size);
     auto data = buffer.get();
     auto actual_len = secondary_term->read(data, data_to_read);
+    if (actual_len > 0) {
+        count_rx(stats, &dte_stats::data, actual_len);
+    }
     *d = data;
     return actual_len;
 }
 
 int DTE::write(uint8_t *data, size_t len)
 {
-    return secondary_term->write(data, len);
+    auto written = secondary_term->write(data, len);
+    count_tx(stats, &dte_stats::data, written);
+    return written;
 }
 
 int DTE::write(DTE_Command command)
 {
-    return primary_term->write(command.data, command.len);
+    auto written = primary_term->write(command.data, command.len);
+    count_tx(stats, &dte_stats::command, written);
+    return written;
 }
 
 void DTE::on_read(got_line_cb on_read_cb)
@@ -360,14 +736,131 @@ bool DTE::command_cb::process_line(uint8_t *data, size_t consumed, size_t len)
     return false;
 }
 
+bool DTE::command_cb::process_line(ring_buffer &ring, size_t len)
+{
+    if (result != command_result::TIMEOUT) {
+        return false;   // this line has been processed already (got OK or FAIL previously)
+    }
+    // scan only the new data for the separator, and linearize the reply (if wrapped) only when complete
+    if (ring.contains(separator, len)) {
+        result = got_line(ring.linearize(), ring.available());
+        if (result == command_result::OK || result == command_result::FAIL) {
+            signal.set(GOT_LINE);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DTE::command_cb::feed(uint8_t *data, size_t len)
+{
+    state.consumed = len;
+    result = stream(data, len, state);
+    state.consumed = std::min(state.consumed, len);
+    state.offset += state.consumed;
+    if (result == command_result::OK || result == command_result::FAIL) {
+        signal.set(GOT_LINE);
+        return true;
+    }
+    result = command_result::TIMEOUT;
+    return false;
+}
+
+bool DTE::command_cb::process_chunk(ring_buffer &ring)
+{
+    if (result != command_result::TIMEOUT) {
+        return false;   // the reply has been processed already
+    }
+    signal.set(GOT_DATA);
+    bool done = feed(ring.linearize(), ring.available());
+    ring.consume(state.consumed);
+    return done;
+}
+
+bool DTE::command_cb::process_chunk(ring_buffer &ring, uint8_t *data, size_t len)
+{
+    if (result != command_result::TIMEOUT) {
+        return false;   // the reply has been processed already
+    }
+    signal.set(GOT_DATA);
+    if (ring.available() == 0) {
+        // nothing kept from the previous chunks, so pass this one directly and keep only the rest
+        if (feed(data, len)) {
+            return true;
+        }
+        data += state.consumed;
+        len -= state.consumed;
+    }
+    while (len > 0) {
+        auto n = std::min(len, ring.size() - ring.available());
+        if (n == 0) {
+            // the callback doesn't consume the data and there's no space left -> report a failure
+            give_up();
+            return true;
+        }
+        ring.push(data, n);
+        data += n;
+        len -= n;
+        if (process_chunk(ring)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool DTE::recover()
 {
+    stats.update([](dte_stats & s) {
+        s.recoveries++;
+    });
     if (mode == modem_mode::CMUX_MODE || mode == modem_mode::CMUX_MANUAL_MODE || mode == modem_mode::DUAL_MODE) {
         return cmux_term->recover();
     }
     return false;
 }
 
+void DTE::update_rx_flow()
+{
+    // called with the line lock held, so that the flow is switched in the order of the ring updates
+    // only the stream callback consumes the reply as it comes, so the device is stopped while the callback keeps
+    // most of the ring (and resumed as it consumes it). Other replies are processed once complete,
+    // so stopping the device would stall them: these fail when they don't fit in the ring
+    size_t pending = rx_ring.available();
+    if (command_cb.stream && pending >= rx_ring.size() * rx_flow_off_percent / 100) {
+        if (!rx_flow_off.exchange(true)) {
+            set_cmux_flow(false);
+        }
+    } else if (pending <= rx_ring.size() * rx_flow_on_percent / 100 && rx_flow_off.exchange(false)) {
+        set_cmux_flow(true);
+    }
+}
+
+bool DTE::set_cmux_flow(bool enable)
+{
+    if (cmux_term && (mode == modem_mode::CMUX_MODE || mode == modem_mode::CMUX_MANUAL_MODE)) {
+        return cmux_term->set_flow(enable);
+    }
+    return false;
+}
+
+std::shared_ptr<Terminal> DTE::open_cmux_terminal(size_t index)
+{
+    if (!cmux_term || (mode != modem_mode::CMUX_MODE && mode != modem_mode::CMUX_MANUAL_MODE)) {
+        return nullptr;
+    }
+    // terminals 0 and 1 are used for commands and data
+    if (index < CMUX_DEFAULT_TERMINALS_NUM || index >= cmux_term->terminals_num()) {
+        return nullptr;
+    }
+    return std::make_shared<CMuxInstance>(cmux_term, index);
+}
+
+void DTE::reset_stats()
+{
+    stats.reset();
+    cmux_counters->reset();
+}
+
 void DTE::handle_error(terminal_error err)
 {
     if (err == terminal_error::BUFFER_OVERFLOW ||
@@ -377,22 +870,74 @@ void DTE::handle_error(terminal_error err)
     }
 }
 
-#ifdef CONFIG_ESP_MODEM_USE_INFLATABLE_BUFFER_IF_NEEDED
-void DTE::extra_buffer::grow(size_t need_size)
-{
-    if (need_size == 0) {
-        delete buffer;
-        buffer = nullptr;
-    } else if (buffer == nullptr) {
-        buffer = new std::vector<uint8_t>(need_size);
-    } else {
-        buffer->resize(need_size);
-    }
-}
-#endif
-
 /**
  * Implemented here to keep all headers C++11 compliant
  */
 unique_buffer::unique_buffer(size_t size):
     data(std::make_unique<uint8_t[]>(size)), size(size), consumed(0) {}
+
+ring_buffer::ring_buffer(size_t size):
+    data(std::make_unique<uint8_t[]>(size)), capacity(size) {}
+
+uint8_t *ring_buffer::write_ptr(size_t &len) const
+{
+    auto h = head.load(std::memory_order_relaxed);
+    auto t = tail.load(std::memory_order_acquire);
+    size_t free = capacity - (h >= t ? h - t : h + 2 * capacity - t);
+    len = std::min(free, capacity - position(h));
+    return data.get() + position(h);
+}
+
+void ring_buffer::commit(size_t len)
+{
+    head.store(advance(head.load(std::memory_order_relaxed), len), std::memory_order_release);
+}
+
+bool ring_buffer::push(const uint8_t *src, size_t len)
+{
+    if (capacity - available() < len) {
+        return false;
+    }
+    size_t contiguous;
+    auto ptr = write_ptr(contiguous);
+    auto first = std::min(contiguous, len);
+    std::memcpy(ptr, src, first);
+    std::memcpy(data.get(), src + first, len - first);
+    commit(len);
+    return true;
+}
+
+size_t ring_buffer::available() const
+{
+    auto h = head.load(std::memory_order_acquire);
+    auto t = tail.load(std::memory_order_relaxed);
+    return h >= t ? h - t : h + 2 * capacity - t;
+}
+
+bool ring_buffer::contains(uint8_t c, size_t len) const
+{
+    auto used = available();
+    len = std::min(len, used);
+    auto start = position(advance(tail.load(std::memory_order_relaxed), used - len));
+    auto first = std::min(len, capacity - start);
+    return std::memchr(data.get() + start, c, first) != nullptr ||
+           std::memchr(data.get(), c, len - first) != nullptr;
+}
+
+uint8_t *ring_buffer::linearize()
+{
+    auto used = available();
+    auto start = position(tail.load(std::memory_order_relaxed));
+    if (start + used <= capacity) {
+        return data.get() + start;
+    }
+    std::rotate(data.get(), data.get() + start, data.get() + capacity);
+    tail.store(0, std::memory_order_relaxed);
+    head.store(used, std::memory_order_release);
+    return data.get();
+}
+
+void ring_buffer::consume(size_t len)
+{
+    tail.store(advance(tail.load(std::memory_order_relaxed), std::min(len, available())), std::memory_order_release);
+}
@@ -0,0 +1,111 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <array>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "cxx_include/esp_modem_exception.hpp"
+#include "fd_reactor.hpp"
+#include "sdkconfig.h"
+
+#ifndef CONFIG_ESP_MODEM_LINUX_REACTOR_THREADS
+#define CONFIG_ESP_MODEM_LINUX_REACTOR_THREADS 1
+#endif
+
+namespace esp_modem {
+
+static const int max_events = 16;
+static thread_local bool reactor_thread = false;
+
+FdReactor &FdReactor::get(int fd)
+{
+    static std::mutex pool_lock;
+    static std::array<std::unique_ptr<FdReactor>, CONFIG_ESP_MODEM_LINUX_REACTOR_THREADS> pool;
+    std::lock_guard<std::mutex> l(pool_lock);
+    auto &reactor = pool[fd % pool.size()];
+    if (reactor == nullptr) {
+        reactor.reset(new FdReactor());
+    }
+    return *reactor;
+}
+
+FdReactor::FdReactor(): epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+    ESP_MODEM_THROW_IF_FALSE(epoll_fd >= 0 && wake_fd >= 0, "Failed to create epoll reactor");
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd;
+    ESP_MODEM_THROW_IF_FALSE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == 0, "Failed to add eventfd to epoll");
+    thread = std::thread(&FdReactor::run, this);
+}
+
+FdReactor::~FdReactor()
+{
+    running = false;
+    uint64_t wake = 1;
+    (void)::write(wake_fd, &wake, sizeof(wake));
+    thread.join();
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+void FdReactor::add(int fd, read_cb f)
+{
+    std::lock_guard<std::recursive_mutex> l(dispatch_lock);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    bool exists = handlers.find(fd) != handlers.end();
+    ESP_MODEM_THROW_IF_FALSE(epoll_ctl(epoll_fd, exists ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == 0, "Failed to add fd to epoll");
+    handlers[fd] = std::make_shared<read_cb>(std::move(f));
+}
+
+void FdReactor::remove(int fd)
+{
+    // epoll stops reporting the fd immediately, the lock waits for the callback in progress (if called from another thread)
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    std::lock_guard<std::recursive_mutex> l(dispatch_lock);
+    handlers.erase(fd);
+}
+
+bool FdReactor::in_reactor_thread()
+{
+    return reactor_thread;
+}
+
+void FdReactor::run()
+{
+    reactor_thread = true;
+    struct epoll_event events[max_events];
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, max_events, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        std::lock_guard<std::recursive_mutex> l(dispatch_lock);
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                uint64_t value;
+                (void)::read(wake_fd, &value, sizeof(value));
+                continue;
+            }
+            auto it = handlers.find(fd);
+            if (it == handlers.end()) {
+                continue;   // removed by one of the previous callbacks
+            }
+            // keep the callback alive even if it removes itself
+            auto handler = it->second;
+            (*handler)();
+        }
+    }
+}
+
+} // namespace esp_modem
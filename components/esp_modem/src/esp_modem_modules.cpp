@@ -13,6 +13,19 @@ namespace esp_modem {
 GenericModule::GenericModule(std::shared_ptr<DTE> dte, const dce_config *config) :
     dte(std::move(dte)), pdp(std::make_unique<PdpContext>(config->apn)) {}
 
+ResponseCache *GenericModule::enable_cache(const cache_config &config)
+{
+    Scoped<DTE> lock(*dte);     // not while a command is being sent through the previous cache
+    cache = std::make_unique<ResponseCache>(dte.get(), config);
+    return cache.get();
+}
+
+void GenericModule::disable_cache()
+{
+    Scoped<DTE> lock(*dte);
+    cache.reset();
+}
+
 //
 // Define preprocessor's forwarding to dce_commands definitions
 //
@@ -33,58 +46,116 @@ GenericModule::GenericModule(std::shared_ptr<DTE> dte, const dce_config *config)
 // Repeat all declarations and forward to the AT commands defined in esp_modem::dce_commands:: namespace
 //
 #define ESP_MODEM_DECLARE_DCE_COMMAND(name, return_type, arg_nr, ...) \
-     return_type GenericModule::name(__VA_ARGS__) { return esp_modem::dce_commands::name(dte.get() ARGS(arg_nr) ); }
+     return_type GenericModule::name(__VA_ARGS__) { return esp_modem::dce_commands::name(commandable() ARGS(arg_nr) ); }
 
 DECLARE_ALL_COMMAND_APIS(return_type name(...) )
 
 #undef ESP_MODEM_DECLARE_DCE_COMMAND
 
+//
+// Commands returning strings in caller's buffer
+//
+command_result GenericModule::get_operator_name(char_span &name, int &act)
+{
+    return dce_commands::get_operator_name(commandable(), name, act);
+}
+
+command_result GenericModule::get_imsi(char_span &imsi)
+{
+    return dce_commands::get_imsi(commandable(), imsi);
+}
+
+command_result GenericModule::get_imei(char_span &imei)
+{
+    return dce_commands::get_imei(commandable(), imei);
+}
+
+command_result GenericModule::get_module_name(char_span &name)
+{
+    return dce_commands::get_module_name(commandable(), name);
+}
+
+command_result GenericModule::at(std::string_view cmd, char_span &out, int timeout)
+{
+    return dce_commands::at(commandable(), cmd, out, timeout);
+}
+
+command_result GenericModule::at_raw(std::string_view cmd, char_span &out, std::string_view pass, std::string_view fail, int timeout)
+{
+    return dce_commands::at_raw(commandable(), cmd, out, pass, fail, timeout);
+}
+
+command_result GenericModule::batch(CommandBatch &queries)
+{
+    return dce_commands::batch(commandable(), queries);
+}
+
+command_result GenericModule::upload_file(std::string_view name, const file_read_cb &source, size_t chunk_size)
+{
+    return command_result::FAIL;
+}
+
+command_result GenericModule::download_file(std::string_view name, const file_write_cb &sink, size_t chunk_size)
+{
+    return command_result::FAIL;
+}
+
 //
 // Handle specific commands for specific supported modems
 //
 command_result SIM7600::get_battery_status(int &voltage, int &bcs, int &bcl)
 {
-    return dce_commands::get_battery_status_sim7xxx(dte.get(), voltage, bcs, bcl);
+    return dce_commands::get_battery_status_sim7xxx(commandable(), voltage, bcs, bcl);
 }
 
 command_result SIM7600::set_network_bands(const std::string &mode, const int *bands, int size)
 {
-    return dce_commands::set_network_bands_sim76xx(dte.get(), mode, bands, size);
+    return dce_commands::set_network_bands_sim76xx(commandable(), mode, bands, size);
 }
 
 command_result SIM7600::set_gnss_power_mode(int mode)
 {
-    return dce_commands::set_gnss_power_mode_sim76xx(dte.get(), mode);
+    return dce_commands::set_gnss_power_mode_sim76xx(commandable(), mode);
 }
 
 command_result SIM7600::power_down()
 {
-    return dce_commands::power_down_sim76xx(dte.get());
+    return dce_commands::power_down_sim76xx(commandable());
 }
 
 command_result SIM7070::power_down()
 {
-    return dce_commands::power_down_sim70xx(dte.get());
+    return dce_commands::power_down_sim70xx(commandable());
 }
 
 command_result SIM7070::set_data_mode()
 {
-    return dce_commands::set_data_mode_alt(dte.get());
+    return dce_commands::set_data_mode_alt(commandable());
 }
 
 command_result SIM7000::power_down()
 {
-    return dce_commands::power_down_sim70xx(dte.get());
+    return dce_commands::power_down_sim70xx(commandable());
 }
 
 command_result SIM800::power_down()
 {
-    return dce_commands::power_down_sim8xx(dte.get());
+    return dce_commands::power_down_sim8xx(commandable());
 }
 
 command_result BG96::set_pdp_context(esp_modem::PdpContext &pdp)
 {
-    return dce_commands::set_pdp_context(dte.get(), pdp, 300);
+    return dce_commands::set_pdp_context(commandable(), pdp, 300);
+}
+
+command_result BG96::upload_file(std::string_view name, const file_read_cb &source, size_t chunk_size)
+{
+    return dce_commands::upload_file_quectel(commandable(), name, source, chunk_size);
+}
+
+command_result BG96::download_file(std::string_view name, const file_write_cb &sink, size_t chunk_size)
+{
+    return dce_commands::download_file_quectel(commandable(), name, sink, chunk_size);
 }
 
 }
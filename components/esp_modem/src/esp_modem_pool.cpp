@@ -0,0 +1,355 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "cxx_include/esp_modem_pool.hpp"
+#include "cxx_include/esp_modem_command_batch.hpp"
+
+namespace esp_modem {
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Default health check: signal quality and network attachment in one round trip
+ */
+static command_result default_health_check(DCE &dce, modem_status &status)
+{
+    int rssi = 99, ber = 99, attached = -1;
+    CommandBatch queries;
+    queries.signal_quality(rssi, ber).network_attachment_state(attached);
+    auto ret = dce.batch(queries);
+    if (ret == command_result::OK) {
+        status.rssi = rssi;
+        status.ber = ber;
+        status.attached = attached;
+    }
+    return ret;
+}
+
+ModemPool::ModemPool(const modem_pool_config &cfg): config(cfg), check_cb(default_health_check)
+{
+    config.workers = std::max<size_t>(config.workers, 1);
+    config.max_checks_per_second = std::max<uint32_t>(config.max_checks_per_second, 1);
+    config.failures_to_down = std::max<uint32_t>(config.failures_to_down, 1);
+    Scoped<Lock> l(lock);
+    for (size_t i = 0; i < config.workers; ++i) {
+        workers.push_back(std::make_unique<Task>(config.task_stack_size, config.task_priority, this, [](void *p) {
+            static_cast<ModemPool *>(p)->worker();
+            Task::Delete();     // not deleted again by ~Task, the handles are released once all the workers have exited
+        }));
+        running++;
+    }
+}
+
+ModemPool::~ModemPool()
+{
+    {
+        Scoped<Lock> l(lock);
+        exit = true;
+    }
+    signal.set(EXIT);
+    signal.wait(EXITED, portMAX_DELAY);
+    for (auto &w : workers) {
+        w->release();
+    }
+    workers.clear();
+    // jobs which exceeded the timeout could still run on the command tasks of their DCEs
+    while (true) {
+        int busy = -1;
+        {
+            Scoped<Lock> l(lock);
+            for (auto &[id, m] : modems) {
+                if (m->busy) {
+                    busy = id;
+                    break;
+                }
+            }
+        }
+        if (busy < 0) {
+            break;
+        }
+        wait_idle(busy);
+    }
+    modems.clear();
+}
+
+int ModemPool::add(const std::string &name, std::unique_ptr<DCE> dce)
+{
+    if (dce == nullptr) {
+        return -1;
+    }
+    auto m = std::make_unique<modem>();
+    m->dce = std::move(dce);
+    m->status.name = name;
+    Scoped<Lock> l(lock);
+    int id = next_id++;
+    m->status.id = id;
+    m->next_check_ms = now_ms();
+    modems.emplace(id, std::move(m));
+    signal.set(WORK);
+    return id;
+}
+
+/**
+ * @brief Waits until the modem (marked as removed, so no other job starts) completes its job
+ */
+void ModemPool::wait_idle(int id)
+{
+    SignalGroup idle;
+    {
+        Scoped<Lock> l(lock);
+        auto &m = *modems.at(id);
+        if (!m.busy) {
+            return;
+        }
+        m.idle = &idle;
+    }
+    idle.wait(IDLE, portMAX_DELAY);
+    // set under the lock, so it's not in use anymore once we get the lock
+    Scoped<Lock> l(lock);
+    modems.at(id)->idle = nullptr;
+}
+
+bool ModemPool::remove(int id)
+{
+    {
+        Scoped<Lock> l(lock);
+        auto it = modems.find(id);
+        if (it == modems.end() || it->second->removed) {
+            return false;
+        }
+        it->second->removed = true;   // no more jobs nor checks are started
+    }
+    wait_idle(id);
+    std::unique_ptr<modem> removed;
+    {
+        Scoped<Lock> l(lock);
+        auto it = modems.find(id);
+        removed = std::move(it->second);
+        modems.erase(it);
+    }
+    // the DCE is destroyed without holding the lock
+    removed.reset();
+    return true;
+}
+
+bool ModemPool::post(int id, job j)
+{
+    Scoped<Lock> l(lock);
+    auto it = modems.find(id);
+    if (it == modems.end() || it->second->removed) {
+        return false;
+    }
+    it->second->jobs.push_back(std::move(j));
+    signal.set(WORK);
+    return true;
+}
+
+void ModemPool::post_all(const job &j)
+{
+    Scoped<Lock> l(lock);
+    for (auto &[id, m] : modems) {
+        if (!m->removed) {
+            m->jobs.push_back(j);
+        }
+    }
+    signal.set(WORK);
+}
+
+void ModemPool::set_health_check(health_check check)
+{
+    Scoped<Lock> l(lock);
+    check_cb = check ? std::move(check) : default_health_check;
+}
+
+std::vector<modem_status> ModemPool::get_status()
+{
+    Scoped<Lock> l(lock);
+    std::vector<modem_status> ret;
+    ret.reserve(modems.size());
+    for (auto &[id, m] : modems) {
+        ret.push_back(m->status);
+        ret.back().pending = m->jobs.size();
+    }
+    return ret;
+}
+
+modem_pool_status ModemPool::get_summary()
+{
+    Scoped<Lock> l(lock);
+    modem_pool_status ret;
+    for (auto &[id, m] : modems) {
+        ret.modems++;
+        switch (m->status.health) {
+        case modem_health::UP:
+            ret.up++;
+            break;
+        case modem_health::DEGRADED:
+            ret.degraded++;
+            break;
+        case modem_health::DOWN:
+            ret.down++;
+            break;
+        case modem_health::UNKNOWN:
+            ret.unknown++;
+            break;
+        }
+        ret.busy += m->busy ? 1 : 0;
+        ret.pending += m->jobs.size();
+    }
+    return ret;
+}
+
+/**
+ * @brief Picks the next job (the first idle modem with jobs, from the cursor on) or the most overdue health check
+ *
+ * Called with the lock held
+ * @return Modem to run `j` on (or check, if `j` is empty), nullptr if nothing to run now (`wait_ms` until the next check)
+ */
+ModemPool::modem *ModemPool::pick(int64_t now, job &j, uint32_t &wait_ms)
+{
+    wait_ms = portMAX_DELAY;
+    if (modems.empty()) {
+        return nullptr;
+    }
+    auto start = modems.lower_bound(cursor);
+    if (start == modems.end()) {
+        start = modems.begin();
+    }
+    auto it = start;
+    do {
+        auto &m = *it->second;
+        if (++it == modems.end()) {
+            it = modems.begin();
+        }
+        if (!m.busy && !m.removed && !m.jobs.empty()) {
+            j = std::move(m.jobs.front());
+            m.jobs.pop_front();
+            cursor = it->first;
+            return &m;
+        }
+    } while (it != start);
+
+    if (config.health_period_ms == 0) {
+        return nullptr;
+    }
+    modem *due = nullptr;
+    for (auto &[id, m] : modems) {
+        if (!m->busy && !m->removed && (due == nullptr || m->next_check_ms < due->next_check_ms)) {
+            due = m.get();
+        }
+    }
+    if (due == nullptr) {
+        return nullptr;
+    }
+    int64_t start_ms = std::max(due->next_check_ms, next_check_allowed_ms);
+    if (start_ms > now) {
+        wait_ms = static_cast<uint32_t>(std::min<int64_t>(start_ms - now, portMAX_DELAY - 1));
+        return nullptr;
+    }
+    next_check_allowed_ms = now + 1000 / config.max_checks_per_second;
+    return due;
+}
+
+/**
+ * @brief Runs the job (or the health check, if `j` is empty) and makes the modem available for the next one
+ */
+void ModemPool::run(modem &m, const job &j)
+{
+    if (j) {
+        j(*m.dce);
+    } else {
+        check(m);
+    }
+    Scoped<Lock> l(lock);
+    m.busy = false;
+    m.status.jobs += j ? 1 : 0;
+    if (m.idle) {
+        m.idle->set(IDLE);
+    }
+    signal.set(WORK);   // the modem could have more jobs, other workers may take them
+}
+
+void ModemPool::check(modem &m)
+{
+    health_check f;
+    modem_status status;
+    {
+        Scoped<Lock> l(lock);
+        f = check_cb;
+        status = m.status;
+    }
+    auto ret = f(*m.dce, status);
+    Scoped<Lock> l(lock);
+    m.status.rssi = status.rssi;
+    m.status.ber = status.ber;
+    m.status.attached = status.attached;
+    m.status.last_result = ret;
+    m.status.checks++;
+    if (ret == command_result::OK) {
+        m.status.failures = 0;
+        m.status.health = modem_health::UP;
+    } else {
+        m.status.failures++;
+        m.status.health = m.status.failures >= config.failures_to_down ? modem_health::DOWN : modem_health::DEGRADED;
+    }
+    m.next_check_ms = now_ms() + config.health_period_ms;
+}
+
+void ModemPool::worker()
+{
+    while (true) {
+        job j;
+        modem *m;
+        uint32_t wait_ms;
+        {
+            Scoped<Lock> l(lock);
+            if (exit) {
+                break;
+            }
+            m = pick(now_ms(), j, wait_ms);
+            if (m) {
+                m->busy = true;
+            } else {
+                // cleared under the lock, so that new work (signalled under the lock, too) is not missed
+                signal.clear(WORK);
+            }
+        }
+        if (m == nullptr) {
+            signal.wait_any(WORK | EXIT, wait_ms);
+            continue;
+        }
+        if (config.job_timeout_ms == 0) {
+            run(*m, j);
+            continue;
+        }
+        // a slow (or dead) modem holds the worker up to the timeout, then its job continues on the command task of its DCE
+        auto done = std::make_shared<SignalGroup>();
+        m->dce->post([this, m, j, done](bool) {
+            // never cancelled, as the modems are destroyed only when idle
+            run(*m, j);
+            done->set(DONE);
+        });
+        if (!done->wait(DONE, config.job_timeout_ms)) {
+            Scoped<Lock> l(lock);
+            m->status.late++;
+        }
+    }
+    bool last;
+    {
+        Scoped<Lock> l(lock);
+        last = --running == 0;
+    }
+    if (last) {
+        signal.set(EXITED);     // the last access to the pool, which could be destroyed right after
+    }
+}
+
+} // namespace esp_modem
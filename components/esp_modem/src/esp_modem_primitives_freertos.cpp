@@ -88,6 +88,11 @@ Task::~Task()
     }
 }
 
+void Task::release()
+{
+    task_handle = nullptr;
+}
+
 void Task::Delete()
 {
     vTaskDelete(nullptr);
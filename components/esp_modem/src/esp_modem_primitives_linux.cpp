@@ -1,19 +1,104 @@
 /*
- * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ * SPDX-FileCopyrightText: 2021-2024 Espressif Systems (Shanghai) CO LTD
  *
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#include <condition_variable>
+#include <cerrno>
+#include <climits>
+#include <ctime>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "cxx_include/esp_modem_primitives.hpp"
 
 namespace esp_modem {
 
+static int futex(std::atomic<uint32_t> *addr, int op, uint32_t val, const struct timespec *timeout = nullptr, uint32_t bitset = FUTEX_BITSET_MATCH_ANY)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op | FUTEX_PRIVATE_FLAG, val, timeout, nullptr, bitset);
+}
+
+void Lock::lock()
+{
+    auto self = std::this_thread::get_id();
+    if (owner.load(std::memory_order_relaxed) == self) {
+        ++count;
+        return;
+    }
+    uint32_t c = 0;
+    if (!state.compare_exchange_strong(c, 1, std::memory_order_acquire)) {
+        for (int spin = 0; spin < 100 && c == 1; ++spin) {
+            c = 0;
+            if (state.compare_exchange_weak(c, 1, std::memory_order_acquire)) {
+                break;
+            }
+        }
+        if (c != 0) {
+            // mark the lock as contended, so that the owner wakes us up on unlock
+            if (c != 2) {
+                c = state.exchange(2, std::memory_order_acquire);
+            }
+            while (c != 0) {
+                futex(&state, FUTEX_WAIT, 2);
+                c = state.exchange(2, std::memory_order_acquire);
+            }
+        }
+    }
+    owner.store(self, std::memory_order_relaxed);
+    count = 1;
+}
+
+void Lock::unlock()
+{
+    if (--count > 0) {
+        return;
+    }
+    owner.store(std::thread::id(), std::memory_order_relaxed);
+    if (state.exchange(0, std::memory_order_release) == 2) {
+        futex(&state, FUTEX_WAKE, 1);
+    }
+}
+
+/**
+ * The flags are a futex word: waiters sleep with the bits they wait for as the futex bitset,
+ * so setting bits wakes only the waiters interested in them. Nothing is waiting for cleared bits.
+ */
 struct SignalGroupInternal {
-    std::condition_variable notify;
-    std::mutex m;
-    uint32_t flags{ 0 };
+    std::atomic<uint32_t> flags{ 0 };
+    std::atomic<uint32_t> waiters{ 0 };         /*!< Number of sleeping (or about to sleep) waiters, set() skips the syscall if zero */
+
+    /**
+     * @brief Waits until `take` accepts the current flags or the time elapses
+     */
+    template<class F>
+    bool wait(uint32_t bits, uint32_t time_ms, F &&take)
+    {
+        uint32_t current = flags.load();
+        if (take(current)) {
+            return true;
+        }
+        struct timespec deadline = {};
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += time_ms / 1000;
+        deadline.tv_nsec += (time_ms % 1000) * 1'000'000L;
+        if (deadline.tv_nsec >= 1'000'000'000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1'000'000'000L;
+        }
+        waiters.fetch_add(1);
+        bool ret = false;
+        while (true) {
+            // sleeps only if the flags are still what we've checked (so no set() could be missed)
+            bool timeout = futex(&flags, FUTEX_WAIT_BITSET, current, &deadline, bits ? bits : FUTEX_BITSET_MATCH_ANY) == -1 && errno == ETIMEDOUT;
+            current = flags.load();
+            if ((ret = take(current)) || timeout) {
+                break;
+            }
+        }
+        waiters.fetch_sub(1);
+        return ret;
+    }
 };
 
 
@@ -23,43 +108,41 @@ SignalGroup::SignalGroup(): event_group(std::make_unique<SignalGroupInternal>())
 
 void SignalGroup::set(uint32_t bits)
 {
-    std::unique_lock<std::mutex> lock(event_group->m);
-    event_group->flags |= bits;
-    event_group->notify.notify_all();
+    uint32_t changed = bits & ~event_group->flags.fetch_or(bits);
+    if (changed && event_group->waiters.load() > 0) {
+        futex(&event_group->flags, FUTEX_WAKE_BITSET, INT_MAX, nullptr, changed);
+    }
 }
 
 void SignalGroup::clear(uint32_t bits)
 {
-    std::unique_lock<std::mutex> lock(event_group->m);
-    event_group->flags &= ~bits;
-    event_group->notify.notify_all();
+    event_group->flags.fetch_and(~bits);
 }
 
 bool SignalGroup::wait(uint32_t flags, uint32_t time_ms)
 {
-    std::unique_lock<std::mutex> lock(event_group->m);
-    return event_group->notify.wait_for(lock, std::chrono::milliseconds(time_ms), [&] {
-        if ((flags & event_group->flags) == flags)
-        {
-            event_group->flags &= ~flags;
-            return true;
+    auto &group = *event_group;
+    return group.wait(flags, time_ms, [&group, flags](uint32_t & current) {
+        // take (clear) all the flags at once, if set
+        while ((current & flags) == flags) {
+            if (group.flags.compare_exchange_weak(current, current & ~flags)) {
+                return true;
+            }
         }
         return false;
     });
-//    return ret != std::cv_status::timeout;
-//    , [&]{return flags&event_group->flags; });
 }
 
 bool SignalGroup::is_any(uint32_t flags)
 {
-    std::unique_lock<std::mutex> lock(event_group->m);
-    return flags & event_group->flags;
+    return flags & event_group->flags.load();
 }
 
 bool SignalGroup::wait_any(uint32_t flags, uint32_t time_ms)
 {
-    std::unique_lock<std::mutex> lock(event_group->m);
-    return event_group->notify.wait_for(lock, std::chrono::milliseconds(time_ms), [&] { return flags & event_group->flags; });
+    return event_group->wait(flags, time_ms, [flags](uint32_t & current) {
+        return (flags & current) != 0;
+    });
 }
 
 SignalGroup::~SignalGroup() = default;
@@ -74,6 +157,8 @@ Task::~Task()
     task_handle.join();
 }
 
+void Task::release() {}
+
 void Task::Delete() {}
 
 void Task::Relinquish()
@@ -0,0 +1,140 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cxx_include/esp_modem_response_cache.hpp"
+
+namespace esp_modem {
+
+// Commands which reset the device or change the SIM state, invalidating all the cached replies
+static constexpr std::string_view invalidating_commands[] = {
+    "AT+CRESET", "AT+CFUN=", "AT+CPIN=", "AT+QPOWD", "AT+CPOWD", "AT+CPOF"
+};
+
+ResponseCache::ResponseCache(CommandableIf *t, const cache_config &config): t(t)
+{
+    set_ttl("AT+CGSN\r", config.imei_ttl_ms);
+    set_ttl("AT+CIMI\r", config.imsi_ttl_ms);
+    set_ttl("AT+CGMM\r", config.module_name_ttl_ms);
+    set_ttl("AT+COPS?\r", config.operator_name_ttl_ms);
+    set_ttl("AT+CSQ\r", config.signal_quality_ttl_ms);
+}
+
+ResponseCache::entry *ResponseCache::find(std::string_view command)
+{
+    for (auto &e : entries) {
+        if (e.command == command) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+void ResponseCache::set_ttl(std::string_view command, uint32_t ttl_ms)
+{
+    Scoped<Lock> l(lock);
+    if (auto e = find(command)) {
+        e->ttl_ms = ttl_ms;
+        e->valid = false;
+        return;
+    }
+    entries.push_back({std::string(command), ttl_ms, false, clock::time_point{}, std::string()});
+}
+
+void ResponseCache::invalidate(bool all)
+{
+    Scoped<Lock> l(lock);
+    for (auto &e : entries) {
+        if (all || e.ttl_ms != cache_config::infinite) {
+            e.valid = false;
+        }
+    }
+}
+
+ResponseCache::stats ResponseCache::get_stats()
+{
+    Scoped<Lock> l(lock);
+    return counters;
+}
+
+command_result ResponseCache::command(const char *command, size_t len, got_line_cb got_line, uint32_t time_ms, const char separator)
+{
+    std::string_view cmd(command, len);
+    for (auto &prefix : invalidating_commands) {
+        if (cmd.substr(0, prefix.size()) == prefix) {
+            auto ret = t->command(command, len, std::move(got_line), time_ms, separator);
+            invalidate();
+            return ret;
+        }
+    }
+    enum class lookup { NOT_CACHED, HIT, MISS } found = lookup::NOT_CACHED;
+    std::string reply;
+    {
+        Scoped<Lock> l(lock);
+        auto e = find(cmd);
+        if (e && e->ttl_ms != 0) {
+            auto age = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - e->stored).count();
+            if (e->valid && (e->ttl_ms == cache_config::infinite || age < e->ttl_ms)) {
+                counters.hits++;
+                reply = e->reply;
+                found = lookup::HIT;
+            } else {
+                counters.misses++;
+                found = lookup::MISS;
+            }
+        }
+    }
+    if (found == lookup::NOT_CACHED) {
+        return t->command(command, len, std::move(got_line), time_ms, separator);
+    }
+    if (found == lookup::HIT) {
+        // complete the command with the stored reply
+        return got_line(reinterpret_cast<uint8_t *>(reply.data()), reply.size());
+    }
+    auto ret = t->command(command, len, [&](uint8_t *data, size_t len) {
+        auto r = got_line(data, len);
+        if (r == command_result::OK) {
+            reply.assign(reinterpret_cast<char *>(data), len);
+        }
+        return r;
+    }, time_ms, separator);
+    if (ret == command_result::OK) {
+        Scoped<Lock> l(lock);
+        if (auto e = find(cmd)) {
+            e->reply = std::move(reply);
+            e->stored = clock::now();
+            e->valid = true;
+        }
+    }
+    return ret;
+}
+
+command_result ResponseCache::command(const std::string &command, got_line_cb got_line, uint32_t time_ms, const char separator)
+{
+    return ResponseCache::command(command.c_str(), command.length(), std::move(got_line), time_ms, separator);
+}
+
+command_result ResponseCache::command(const std::string &command, got_line_cb got_line, uint32_t time_ms)
+{
+    return ResponseCache::command(command.c_str(), command.length(), std::move(got_line), time_ms, '\n');
+}
+
+command_result ResponseCache::stream_command(const char *command, size_t len, stream_cb on_chunk, uint32_t time_ms)
+{
+    // streamed replies are not cached
+    return t->stream_command(command, len, std::move(on_chunk), time_ms);
+}
+
+int ResponseCache::write(uint8_t *data, size_t len)
+{
+    return t->write(data, len);
+}
+
+void ResponseCache::on_read(got_line_cb on_data)
+{
+    t->on_read(std::move(on_data));
+}
+
+} // namespace esp_modem
@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "cxx_include/esp_modem_stats.hpp"
+
+namespace esp_modem {
+
+static constexpr std::string_view other_commands = "other";
+
+/**
+ * @brief Name of the command, i.e. up to the first parameter, query or concatenated command
+ */
+static std::string_view command_name(std::string_view command)
+{
+    if (command.size() < 2 || (command.compare(0, 2, "AT") != 0 && command.compare(0, 2, "at") != 0)) {
+        return other_commands;  // raw data sent as a command (e.g. SMS text), or +++
+    }
+    auto name = command.substr(0, command.find_first_of("=?;\r\n"));
+    return name.substr(0, ESP_MODEM_STATS_COMMAND_NAME_LEN - 1);
+}
+
+static esp_modem_command_stats *find_or_add(dte_stats &stats, std::string_view name)
+{
+    for (size_t i = 0; i < stats.commands_num; ++i) {
+        if (name == stats.commands[i].name) {
+            return &stats.commands[i];
+        }
+    }
+    // the last entry is kept for the other commands
+    if (stats.commands_num >= ESP_MODEM_STATS_COMMANDS_NUM - 1 && name != other_commands) {
+        return find_or_add(stats, other_commands);
+    }
+    auto &entry = stats.commands[stats.commands_num++];
+    memcpy(entry.name, name.data(), name.size());
+    entry.name[name.size()] = '\0';
+    return &entry;
+}
+
+void add_command_stats(dte_stats &stats, std::string_view command, command_result result, uint32_t time_ms)
+{
+    auto *entry = find_or_add(stats, command_name(command));
+    entry->count++;
+    if (result == command_result::FAIL) {
+        entry->failures++;
+    } else if (result == command_result::TIMEOUT) {
+        entry->timeouts++;
+    }
+    entry->max_ms = std::max(entry->max_ms, time_ms);
+    entry->total_ms += time_ms;
+    size_t bucket = 0;
+    while (bucket < ESP_MODEM_STATS_LATENCY_BUCKETS - 1 && time_ms >= (1u << bucket)) {
+        ++bucket;
+    }
+    entry->latency[bucket]++;
+}
+
+} // namespace esp_modem
@@ -5,13 +5,22 @@
  */
 
 #include <optional>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include "cxx_include/esp_modem_dte.hpp"
 #include "esp_log.h"
 #include "esp_modem_config.h"
 #include "exception_stub.hpp"
+#if defined(CONFIG_IDF_TARGET_LINUX)
+#include <poll.h>
+#include "fd_reactor.hpp"
+#endif
 
 static const char *TAG = "fs_terminal";
+#if defined(CONFIG_IDF_TARGET_LINUX)
+static constexpr int write_timeout_ms = 1000;   // Maximum time to wait for the device to accept more data
+#endif
 
 namespace esp_modem {
 
@@ -38,6 +47,17 @@ public:
 
     ~FdTerminal() override;
 
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    void start() override
+    {
+        FdReactor::get(f.fd).add(f.fd, [this] { on_readable(); });
+    }
+
+    void stop() override
+    {
+        FdReactor::get(f.fd).remove(f.fd);
+    }
+#else
     void start() override
     {
         signal.set(TASK_START);
@@ -47,11 +67,36 @@ public:
     {
         signal.clear(TASK_START);
     }
+#endif
 
     int write(uint8_t *data, size_t len) override;
 
+    int writev(const struct iovec *iov, int iovcnt) override;
+
     int read(uint8_t *data, size_t len) override;
 
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    /**
+     * @brief Sets the read callback, waits for the previous one if it's running on the reactor thread
+     * (unless called from the callback itself), so it's not called after returning from here
+     */
+    void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override
+    {
+        Scoped<Lock> l(read_cb_lock);
+        on_read = std::move(f);
+        read_cb_changed = true;
+    }
+
+private:
+    void on_readable();
+    void discard();
+
+    File f;
+    Lock read_cb_lock;                                              /*!< Held while the callback runs */
+    bool read_cb_changed{false};
+    std::function<bool(uint8_t *data, size_t len)> on_read_priv;    /*!< Copy of on_read used by the reactor thread */
+};
+#else
     void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override
     {
         on_read = std::move(f);
@@ -70,6 +115,7 @@ private:
     SignalGroup signal;
     Task task_handle;
 };
+#endif
 
 std::unique_ptr<Terminal> create_vfs_terminal(const esp_modem_dte_config *config)
 {
@@ -80,6 +126,38 @@ std::unique_ptr<Terminal> create_vfs_terminal(const esp_modem_dte_config *config
     )
 }
 
+#if defined(CONFIG_IDF_TARGET_LINUX)
+FdTerminal::FdTerminal(const esp_modem_dte_config *config) : f(config)
+{
+    // the readers drain the fd until a short read, so it must not block when empty
+    fcntl(f.fd, F_SETFL, fcntl(f.fd, F_GETFL) | O_NONBLOCK);
+}
+
+void FdTerminal::on_readable()
+{
+    Scoped<Lock> l(read_cb_lock);
+    // take the updated callback here, as it could be replaced from within the callback itself
+    if (read_cb_changed) {
+        on_read_priv = on_read;
+        read_cb_changed = false;
+    }
+    if (on_read_priv) {
+        on_read_priv(nullptr, 0);
+    } else {
+        discard();
+    }
+}
+
+void FdTerminal::discard()
+{
+    // the reactor reports the fd as long as it's readable, so the data nobody reads are dropped
+    uint8_t data[64];
+    int len;
+    while ((len = ::read(f.fd, data, sizeof(data))) > 0) {
+        ESP_LOGD(TAG, "No reader, dropping %d bytes", len);
+    }
+}
+#else
 FdTerminal::FdTerminal(const esp_modem_dte_config *config) :
     f(config), signal(),
     task_handle(config->task_stack_size, config->task_priority, this, [](void *p)
@@ -129,6 +207,7 @@ void FdTerminal::task()
         Task::Relinquish();
     }
 }
+#endif
 
 int FdTerminal::read(uint8_t *data, size_t len)
 {
@@ -153,6 +232,44 @@ int FdTerminal::write(uint8_t *data, size_t len)
     return size;
 }
 
+int FdTerminal::writev(const struct iovec *iov, int iovcnt)
+{
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    // the fd is non-blocking, so the device could take only a part of the data: write the rest once it's writable
+    int total = 0;
+    size_t offset = 0;  // already written from the first buffer
+    while (iovcnt > 0) {
+        ssize_t size = offset > 0 ? ::write(f.fd, static_cast<uint8_t *>(iov->iov_base) + offset, iov->iov_len - offset)
+                       : ::writev(f.fd, iov, iovcnt);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // don't block the reactor thread (and all its terminals) when writing from a read callback
+            struct pollfd pfd = { f.fd, POLLOUT, 0 };
+            int timeout_ms = FdReactor::in_reactor_thread() ? 0 : write_timeout_ms;
+            if (errno == EAGAIN && poll(&pfd, 1, timeout_ms) > 0) {
+                continue;
+            }
+            ESP_LOGE(TAG, "Error occurred during write: %d", errno);
+            return -1;
+        }
+        total += size;
+        size_t consumed = offset + size;
+        while (iovcnt > 0 && consumed >= iov->iov_len) {
+            consumed -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        offset = consumed;
+    }
+    return total;
+#else
+    // VFS on target doesn't implement writev() for all file types, so write the buffers separately
+    return Terminal::writev(iov, iovcnt);
+#endif
+}
+
 FdTerminal::~FdTerminal()
 {
     stop();
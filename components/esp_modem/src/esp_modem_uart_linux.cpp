@@ -1,31 +1,55 @@
 /*
- * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ * SPDX-FileCopyrightText: 2021-2024 Espressif Systems (Shanghai) CO LTD
  *
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#include <termios.h>
 #include <sys/ioctl.h>
+#include <asm/termbits.h>       // termios2 (arbitrary baud rates), glibc's <termios.h> cannot be used along
+#include <linux/serial.h>
 #include "esp_log.h"
 #include "cxx_include/esp_modem_dte.hpp"
 #include "esp_modem_config.h"
 #include "uart_resource.hpp"
 
+#ifndef CONFIG_ESP_MODEM_LINUX_UART_LOW_LATENCY
+#define CONFIG_ESP_MODEM_LINUX_UART_LOW_LATENCY 0
+#endif
+
 namespace esp_modem {
 
 constexpr const char *TAG = "uart_resource";
 
+static constexpr int default_baud_rate = 115200;
+
+/**
+ * @brief Sets ASYNC_LOW_LATENCY, so the driver pushes received data to the tty immediately (not batched)
+ *
+ * Not all devices support it (e.g. pseudo terminals), so it's not an error if it fails
+ */
+static void set_low_latency(int fd)
+{
+    struct serial_struct serial = {};
+    if (ioctl(fd, TIOCGSERIAL, &serial) != 0) {
+        ESP_LOGW(TAG, "Low latency mode not supported by the device");
+        return;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &serial) != 0) {
+        ESP_LOGW(TAG, "Failed to set low latency mode");
+    }
+}
+
 uart_resource::uart_resource(const esp_modem_uart_term_config *config, QueueHandle_t *event_queue, int fd): port(-1)
 {
     ESP_LOGD(TAG, "Creating uart resource" );
-    struct termios tty = {};
-    ESP_MODEM_THROW_IF_FALSE(tcgetattr(fd, &tty) == 0, "Failed to tcgetattr()");
+    struct termios2 tty = {};
+    ESP_MODEM_THROW_IF_FALSE(ioctl(fd, TCGETS2, &tty) == 0, "Failed to get terminal attributes (TCGETS2)");
 
     tty.c_cflag &= ~PARENB;
     tty.c_cflag &= ~CSTOPB;
     tty.c_cflag &= ~CSIZE; // Clear all the size bits, then use one of the statements below
     tty.c_cflag |= CS8; // 8 bits per byte (most common)
-    tty.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
     tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
     tty.c_lflag &= ~ICANON;
     tty.c_lflag &= ~ECHO; // Disable echo
@@ -34,12 +58,37 @@ uart_resource::uart_resource(const esp_modem_uart_term_config *config, QueueHand
     tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL); // Disable any special handling of received bytes
     tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
     tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
+
+    tty.c_cflag &= ~CRTSCTS;
+    if (config->flow_control == ESP_MODEM_FLOW_CONTROL_HW) {
+        tty.c_cflag |= CRTSCTS;
+    } else if (config->flow_control == ESP_MODEM_FLOW_CONTROL_SW) {
+        tty.c_iflag |= IXON | IXOFF;
+    }
+
+    // The fd is non-blocking and read when the reactor reports it readable, so a read returns whatever is available
+    // (up to the DTE buffer size) without waiting for VMIN bytes or VTIME timeout
     tty.c_cc[VTIME] = 0;
     tty.c_cc[VMIN] = 0;
-    cfsetispeed(&tty, B115200);
-    cfsetospeed(&tty, B115200);
-    cfsetspeed(&tty, B115200);
-    ioctl(fd, TCSETS, &tty);
+
+    // Any baud rate (not only the Bxxx constants), if supported by the driver
+    int baud_rate = config->baud_rate > 0 ? config->baud_rate : default_baud_rate;
+    tty.c_cflag &= ~CBAUD;
+    tty.c_cflag |= BOTHER;
+    tty.c_ispeed = baud_rate;
+    tty.c_ospeed = baud_rate;
+    tty.c_cflag &= ~(CBAUD << IBSHIFT); // Input speed same as output speed
+    if (ioctl(fd, TCSETS2, &tty) != 0) {
+        // some devices (e.g. pseudo terminals, USB adapters) reject the attributes, but work with their defaults,
+        // so it's an error only if the requested baud rate couldn't be set
+        ESP_MODEM_THROW_IF_FALSE(baud_rate == default_baud_rate, "Failed to set terminal attributes (TCSETS2)");
+        ESP_LOGW(TAG, "Failed to set terminal attributes (TCSETS2), using the device defaults");
+    } else if (ioctl(fd, TCGETS2, &tty) == 0 && tty.c_ospeed != static_cast<speed_t>(baud_rate)) {
+        ESP_LOGW(TAG, "Baud rate %d not supported exactly, using %u", baud_rate, tty.c_ospeed);
+    }
+    if (CONFIG_ESP_MODEM_LINUX_UART_LOW_LATENCY) {
+        set_low_latency(fd);
+    }
 }
 
 uart_resource::~uart_resource() = default;
@@ -0,0 +1,490 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "cxx_include/esp_modem_api.hpp"
+#include "cxx_include/esp_modem_cmux.hpp"
+#include "LoopbackTerm.h"
+
+using namespace esp_modem;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct options {
+    int iterations = 1000;                          /*!< Number of commands (or packets, frames) per benchmark */
+    std::vector<size_t> inject_by = { 0, 1, 16, 128 };  /*!< Fragmentation of the replies, 0 to deliver them at once */
+    std::string filter;                             /*!< Run only benchmarks containing this string */
+};
+
+FILE *output = stdout;                              /*!< Results (stdout is shared with the library logs on linux) */
+
+/**
+ * @brief One line of JSON output per benchmark (and configuration), so the results could be compared between runs
+ */
+class report {
+public:
+    explicit report(const char *name): line(std::string("{\"benchmark\":\"") + name + "\"") {}
+
+    report &add(const char *key, const char *value)
+    {
+        line += std::string(",\"") + key + "\":\"" + value + "\"";
+        return *this;
+    }
+
+    report &add(const char *key, size_t value)
+    {
+        line += std::string(",\"") + key + "\":" + std::to_string(value);
+        return *this;
+    }
+
+    report &add(const char *key, double value)
+    {
+        char number[32];
+        snprintf(number, sizeof(number), "%.3f", value);
+        line += std::string(",\"") + key + "\":" + number;
+        return *this;
+    }
+
+    report &latencies(std::vector<clock_type::duration> &samples)
+    {
+        auto us = [](clock_type::duration d) {
+            return std::chrono::duration<double, std::micro>(d).count();
+        };
+        std::sort(samples.begin(), samples.end());
+        return add("p50_us", us(samples[samples.size() / 2]))
+               .add("p99_us", us(samples[samples.size() * 99 / 100]))
+               .add("max_us", us(samples.back()));
+    }
+
+    void print()
+    {
+        fprintf(output, "%s}\n", line.c_str());
+        fflush(output);
+    }
+
+private:
+    std::string line;
+};
+
+double seconds(clock_type::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+command_result expect_ok(uint8_t *data, size_t len)
+{
+    std::string_view reply((char *)data, len);
+    if (reply.find("OK") != std::string_view::npos) {
+        return command_result::OK;
+    }
+    if (reply.find("ERROR") != std::string_view::npos) {
+        return command_result::FAIL;
+    }
+    return command_result::TIMEOUT;
+}
+
+[[noreturn]] void fail(const char *benchmark, const char *reason)
+{
+    fprintf(stderr, "%s: %s\n", benchmark, reason);
+    exit(1);
+}
+
+/**
+ * @brief Terminal to exercise the CMUX codec without I/O: acknowledges SABM synchronously,
+ * captures written frames (if enabled) and feeds them back in fragments
+ */
+class CodecTerm : public Terminal {
+public:
+    int write(uint8_t *data, size_t len) override
+    {
+        if (len == 6 && data[2] == 0x3f) {    // SABM -> UA
+            uint8_t ua[] = { 0xf9, data[1], 0x73, 0x01, 0, 0xf9 };
+            ua[4] = 0xFF - CMux::fcs_crc(ua + 1, 3);
+            on_read(ua, sizeof(ua));
+            return len;
+        }
+        if (capture) {
+            written.insert(written.end(), data, data + len);
+        }
+        return len;
+    }
+    int writev(const struct iovec *iov, int iovcnt) override
+    {
+        int len = 0;
+        for (int i = 0; i < iovcnt; ++i) {
+            auto *base = static_cast<uint8_t *>(iov[i].iov_base);
+            if (capture) {
+                written.insert(written.end(), base, base + iov[i].iov_len);
+            }
+            len += iov[i].iov_len;
+        }
+        return len;
+    }
+    void feed(uint8_t *data, size_t len, size_t fragment)
+    {
+        fragment = fragment ? fragment : len;
+        for (size_t pos = 0; pos < len; pos += fragment) {
+            on_read(data + pos, std::min(fragment, len - pos));
+        }
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        return 0;
+    }
+    void start() override {}
+    void stop() override {}
+
+    bool capture{false};
+    std::vector<uint8_t> written;
+};
+
+/**
+ * @brief Pseudo terminal pair: the DTE uses the slave side as a VFS terminal, the responder thread serves the master side
+ * (answering AT commands with OK, or echoing data back)
+ */
+class PtyModem {
+public:
+    PtyModem(bool echo, size_t fragment): echo(echo), fragment(fragment)
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+            fail("pty", "cannot open pseudo terminal");
+        }
+        slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        termios tio{};
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        responder = std::thread([this] {
+            serve();
+        });
+    }
+
+    ~PtyModem()
+    {
+        stop = true;
+        responder.join();
+        close(master);
+    }
+
+    std::shared_ptr<DTE> create_dte()
+    {
+        esp_modem_dte_config_t dte_config = {
+            .dte_buffer_size = 4096,
+            .task_stack_size = 0,
+            .task_priority = 0,
+            .vfs_config = { .fd = slave, .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr },
+            .cmux_config = {},
+            .reply_buffer_size = 0
+        };
+        return create_vfs_dte(&dte_config);
+    }
+
+private:
+    void reply(const uint8_t *data, size_t len)
+    {
+        // written in fragments, to let the reader see them separately
+        size_t step = fragment ? fragment : len;
+        for (size_t pos = 0; pos < len;) {
+            auto n = ::write(master, data + pos, std::min(step, len - pos));
+            if (n <= 0) {
+                return;
+            }
+            pos += n;
+        }
+    }
+
+    void serve()
+    {
+        static const char ok[] = "\r\n+CSQ: 123,456\r\n\r\nOK\r\n";
+        uint8_t buffer[4096];
+        while (!stop) {
+            pollfd pfd = { master, POLLIN, 0 };
+            if (poll(&pfd, 1, 10) <= 0) {
+                continue;
+            }
+            auto len = ::read(master, buffer, sizeof(buffer));
+            if (len <= 0) {
+                continue;
+            }
+            if (echo) {
+                reply(buffer, len);
+                continue;
+            }
+            for (ssize_t i = 0; i < len; ++i) {
+                if (buffer[i] == '\r') {
+                    reply((const uint8_t *)ok, sizeof(ok) - 1);
+                }
+            }
+        }
+    }
+
+    bool echo;
+    size_t fragment;
+    int master;
+    int slave;
+    std::atomic<bool> stop{false};
+    std::thread responder;
+};
+
+/**
+ * @brief Sequential commands: round-trip latency and command rate
+ */
+void command_latency(const options &opt, const char *term_name, DTE *dte, size_t inject_by)
+{
+    std::vector<clock_type::duration> samples;
+    samples.reserve(opt.iterations);
+    auto start = clock_type::now();
+    for (int i = 0; i < opt.iterations; ++i) {
+        auto t0 = clock_type::now();
+        if (dte->command("AT+CSQ\r", expect_ok, 1000) != command_result::OK) {
+            fail("command_latency", "command failed");
+        }
+        samples.push_back(clock_type::now() - t0);
+    }
+    auto total = clock_type::now() - start;
+    report("command_latency").add("term", term_name).add("inject_by", inject_by).add("count", samples.size())
+    .add("commands_per_s", samples.size() / seconds(total)).latencies(samples).print();
+}
+
+void loopback_commands(const options &opt)
+{
+    for (auto inject_by : opt.inject_by) {
+        auto term = std::make_unique<LoopbackTerm>();
+        term->set_fragment_size(inject_by);
+        auto dte = std::make_unique<DTE>(std::move(term));
+        command_latency(opt, "loopback", dte.get(), inject_by);
+    }
+}
+
+void pty_commands(const options &opt)
+{
+    for (auto inject_by : opt.inject_by) {
+        PtyModem modem(false, inject_by);
+        auto dte = modem.create_dte();
+        command_latency(opt, "pty", dte.get(), inject_by);
+    }
+}
+
+/**
+ * @brief Asynchronous commands queued at once: command rate of the DTE's command task
+ */
+void loopback_async_commands(const options &opt)
+{
+    auto dte = std::make_unique<DTE>(std::make_unique<LoopbackTerm>());
+    std::vector<std::future<command_result>> results;
+    results.reserve(opt.iterations);
+    auto start = clock_type::now();
+    for (int i = 0; i < opt.iterations; ++i) {
+        results.push_back(dte->command_async("AT+CSQ\r", expect_ok, 1000));
+    }
+    for (auto &r : results) {
+        if (r.get() != command_result::OK) {
+            fail("command_async_rate", "command failed");
+        }
+    }
+    auto total = clock_type::now() - start;
+    report("command_async_rate").add("term", "loopback").add("count", results.size())
+    .add("commands_per_s", results.size() / seconds(total)).print();
+}
+
+/**
+ * @brief CMUX encoding and decoding of frames of different sizes, decoded in fragments
+ */
+void cmux_codec(const options &opt)
+{
+    for (size_t payload : { size_t(16), size_t(127), size_t(1024) }) {
+        auto term = std::make_shared<CodecTerm>();
+        esp_modem_cmux_config config = { .terminals_num = 0, .max_frame_size = payload, .negotiate_params = false, .ui_frames = false };
+        auto cmux = std::make_shared<CMux>(term, unique_buffer(4096), &config);
+        if (!cmux->init()) {
+            fail("cmux_codec", "init failed");
+        }
+        std::vector<uint8_t> data(payload, 0x7e);
+        auto start = clock_type::now();
+        for (int i = 0; i < opt.iterations; ++i) {
+            cmux->write(1, data.data(), data.size());
+        }
+        auto encode = clock_type::now() - start;
+        report("cmux_encode").add("payload", payload).add("count", size_t(opt.iterations))
+        .add("frames_per_s", opt.iterations / seconds(encode))
+        .add("bytes_per_s", opt.iterations * payload / seconds(encode)).print();
+
+        term->capture = true;
+        for (int i = 0; i < opt.iterations; ++i) {
+            cmux->write(1, data.data(), data.size());
+        }
+        term->capture = false;
+        size_t decoded = 0;
+        cmux->set_read_cb(1, [&](uint8_t *d, size_t len) {
+            decoded += len;
+            return false;
+        });
+        for (auto inject_by : opt.inject_by) {
+            decoded = 0;
+            start = clock_type::now();
+            term->feed(term->written.data(), term->written.size(), inject_by);
+            auto decode = clock_type::now() - start;
+            if (decoded != opt.iterations * payload) {
+                fail("cmux_decode", "decoded payload doesn't match");
+            }
+            report("cmux_decode").add("payload", payload).add("inject_by", inject_by).add("count", size_t(opt.iterations))
+            .add("frames_per_s", opt.iterations / seconds(decode))
+            .add("bytes_per_s", decoded / seconds(decode)).print();
+        }
+    }
+}
+
+/**
+ * @brief Data mode: packets echoed back by the terminal, received with DTE::set_read_cb()
+ * @param window Number of packets in flight (LoopbackTerm is not thread safe, so it processes one at a time)
+ */
+void data_throughput(const options &opt, const char *term_name, const char *mode, DTE *dte, int window)
+{
+    const size_t packet = 1024;
+    const size_t total = opt.iterations * packet;
+    std::atomic<size_t> received{0};
+    SignalGroup signal;
+    dte->set_read_cb([&](uint8_t *data, size_t len) {
+        received += len;
+        signal.set(1);
+        return false;
+    });
+    std::vector<uint8_t> data(packet, 0x55);
+    auto start = clock_type::now();
+    for (int i = 0; i < opt.iterations; ++i) {
+        dte->write(data.data(), data.size());
+        // wait until the number of packets in flight drops below the window
+        while (received + window * packet <= (i + 1) * packet) {
+            if (!signal.wait_any(1, 1000)) {
+                fail("data_throughput", "echo timeout");
+            }
+            signal.clear(1);
+        }
+    }
+    while (received < total) {
+        if (!signal.wait_any(1, 1000)) {
+            fail("data_throughput", "echo timeout");
+        }
+        signal.clear(1);
+    }
+    auto elapsed = clock_type::now() - start;
+    report("data_throughput").add("term", term_name).add("mode", mode).add("packet", packet).add("window", size_t(window))
+    .add("count", size_t(opt.iterations)).add("bytes_per_s", total / seconds(elapsed)).print();
+    dte->set_read_cb(nullptr);
+}
+
+void loopback_data(const options &opt)
+{
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 4096,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {},
+        .cmux_config = { .terminals_num = 0, .max_frame_size = 1024, .negotiate_params = false, .ui_frames = false },
+        .reply_buffer_size = 0
+    };
+    auto dte = std::make_unique<DTE>(&dte_config, std::make_unique<LoopbackTerm>());
+    if (!dte->set_mode(modem_mode::DATA_MODE)) {
+        fail("data_throughput", "cannot set data mode");
+    }
+    data_throughput(opt, "loopback", "data", dte.get(), 1);
+
+    dte = std::make_unique<DTE>(&dte_config, std::make_unique<LoopbackTerm>());
+    if (!dte->set_mode(modem_mode::CMUX_MODE)) {
+        fail("data_throughput", "cannot set CMUX mode");
+    }
+    data_throughput(opt, "loopback", "cmux", dte.get(), 1);
+}
+
+void pty_data(const options &opt)
+{
+    PtyModem modem(true, 0);
+    auto dte = modem.create_dte();
+    if (!dte->set_mode(modem_mode::DATA_MODE)) {
+        fail("data_throughput", "cannot set data mode");
+    }
+    data_throughput(opt, "pty", "data", dte.get(), 1);
+    data_throughput(opt, "pty", "data", dte.get(), 4);
+}
+
+std::vector<size_t> parse_list(const char *arg)
+{
+    std::vector<size_t> values;
+    for (const char *p = arg; *p;) {
+        char *end;
+        values.push_back(strtoul(p, &end, 10));
+        p = *end == ',' ? end + 1 : end;
+        if (end == p && *p) {
+            break;
+        }
+    }
+    return values;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    options opt;
+    int c;
+    while ((c = getopt(argc, argv, "n:i:f:o:h")) != -1) {
+        switch (c) {
+        case 'n':
+            opt.iterations = std::max(1, atoi(optarg));
+            break;
+        case 'i':
+            opt.inject_by = parse_list(optarg);
+            break;
+        case 'f':
+            opt.filter = optarg;
+            break;
+        case 'o':
+            output = fopen(optarg, "w");
+            if (output == nullptr) {
+                fail("benchmark", "cannot open the output file");
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] [-i inject_by,...] [-f filter] [-o results.jsonl]\n", argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    struct {
+        const char *name;
+        void (*run)(const options &);
+    } benchmarks[] = {
+        { "loopback_commands", loopback_commands },
+        { "loopback_async_commands", loopback_async_commands },
+        { "pty_commands", pty_commands },
+        { "cmux_codec", cmux_codec },
+        { "loopback_data", loopback_data },
+        { "pty_data", pty_data },
+    };
+    for (auto &b : benchmarks) {
+        if (opt.filter.empty() || strstr(b.name, opt.filter.c_str())) {
+            b.run(opt);
+        }
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}
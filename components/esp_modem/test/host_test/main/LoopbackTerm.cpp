@@ -18,84 +18,245 @@ void LoopbackTerm::stop()
     status = status_t::STOPPED;
 }
 
+bool LoopbackTerm::at_response(const std::string &command, std::string &response)
+{
+    if (command == "+++") {
+        response = "NO CARRIER\r\n";
+    } else if (command == "ATE1\r" || command == "ATE0\r") {
+        response = "OK\r\n ";
+    } else if (command == "ATO\r") {
+        response = "ERROR\r\n";
+    } else if (command.find("ATD") != std::string::npos) {
+        response = "CONNECT\n";
+    } else if (command.find("AT+CSQ\r") != std::string::npos) {
+        response = "+CSQ: 123,456\n\r\nOK\r\n";
+    } else if (command.find("AT+CGMM\r") != std::string::npos) {
+        response = "0G Dummy Model\n\r\nOK\r\n";
+    } else if (command.find("AT+COPS?\r") != std::string::npos) {
+        response = "+COPS: 0,0,\"OperatorName\",5\n\r\nOK\r\n";
+    } else if (command.find("AT+CBC\r") != std::string::npos) {
+        response = is_bg96 ? "+CBC: 1,20,123456\r\r\n\r\nOK\r\n\n\r\n" :
+                   "+CBC: 123.456V\r\r\n\r\nOK\r\n\n\r\n";
+    } else if (command.find("AT+CPIN=1234\r") != std::string::npos) {
+        response = "OK\r\n";
+        pin_ok = true;
+    } else if (command.find("AT+CPIN?\r") != std::string::npos) {
+        response = pin_ok ? "+CPIN: READY\r\nOK\r\n" : "+CPIN: SIM PIN\r\nOK\r\n";
+    } else if (command.find("AT+READBIN=") != std::string::npos) {
+        // binary payload of the requested length, containing also line endings and "OK"
+        size_t len = std::stoul(command.substr(command.find('=') + 1));
+        response = "CONNECT " + std::to_string(len) + "\r\n";
+        for (size_t i = 0; i < len; ++i) {
+            response.push_back(static_cast<char>("\r\nOK"[i % 4] + i / 4 % 2));
+        }
+        response += "\r\nOK\r\n";
+    } else if (command.find("AT+QFOPEN=") != std::string::npos) {
+        // simple file system, files are created (or cleared) when opened for writing
+        auto begin = command.find('"') + 1;
+        auto name = command.substr(begin, command.find('"', begin) - begin);
+        auto it = files.find(name);
+        if (command.find(",1\r") != std::string::npos) {
+            file = &files[name];
+            file->clear();
+        } else if (it != files.end()) {
+            file = &it->second;
+        } else {
+            file = nullptr;
+        }
+        file_pos = 0;
+        response = file ? "+QFOPEN: 1\r\n\r\nOK\r\n" : "+CME ERROR: 405\r\n";    // file not found
+    } else if (file == nullptr && (command.find("AT+QFWRITE=1,") != std::string::npos || command.find("AT+QFREAD=1,") != std::string::npos)) {
+        response = "ERROR\r\n";
+    } else if (command.find("AT+QFWRITE=1,") != std::string::npos) {
+        file_pending = std::stoul(command.substr(command.find(',') + 1));
+        response = "CONNECT\r\n";
+    } else if (command.find("AT+QFREAD=1,") != std::string::npos) {
+        size_t len = std::min<size_t>(std::stoul(command.substr(command.find(',') + 1)), file->size() - file_pos);
+        response = "CONNECT " + std::to_string(len) + "\r\n" + file->substr(file_pos, len) + "\r\n\r\nOK\r\n";
+        file_pos += len;
+    } else if (command.find("AT") != std::string::npos) {
+        if (command.length() > 4) {
+            response = command;
+            response[0] = 'O';
+            response[1] = 'K';
+            response[2] = '\r';
+            response[3] = '\n';
+        } else {
+            response = "OK\r\n";
+        }
+    }
+    return !response.empty();
+}
+
+static uint8_t cmux_fcs(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xe0 : crc >> 1;
+        }
+    }
+    return 0xFF - crc;
+}
+
+std::vector<uint8_t> LoopbackTerm::cmux_response(const uint8_t *data, size_t len)
+{
+    // Turns requests into replies -> implements CMUX loopback:
+    // SABM and DISC are acknowledged, AT commands on virtual terminals answered, PN negotiated, other payloads echoed back
+    std::vector<uint8_t> reply;
+    size_t pos = 0;
+    while (pos + 6 <= len && data[pos] == 0xf9) {
+        const uint8_t *frame = data + pos;
+        size_t header_len = (frame[3] & 0x01) ? 4 : 5;
+        size_t payload_len = (frame[3] >> 1) + (header_len == 5 ? frame[4] << 7 : 0);
+        if (pos + header_len + payload_len + 2 > len) {
+            break;
+        }
+        std::string payload((char *)frame + header_len, payload_len);
+        uint8_t control = frame[2];
+        if (honour_flow && (frame[1] >> 2) == 0 && control == 0xef && payload_len > 0) {
+            if ((uint8_t)payload[0] == 0x63) {          // FCoff command
+                flow_off = true;
+            } else if ((uint8_t)payload[0] == 0xa3) {   // FCon command
+                flow_off = false;
+            }
+        }
+        if (control == 0x3f || control == 0x53) {  // SABM or DISC command
+            control = 0x73;
+        } else if (control == 0xef) {   // Generic request
+            control = 0xff;             // generic reply
+            std::string response;
+            if (payload_len > 2 && (payload.back() == '\r' || payload.back() == '+') && at_response(payload, response)) {
+                payload = response;
+            }
+            if ((frame[1] >> 2) == 0 && payload_len == 10 && (uint8_t)payload[0] == 0x83) { // PN command
+                payload[0] = 0x81;  // PN response, supporting frames up to 512 bytes
+                size_t n1 = std::min<size_t>((uint8_t)payload[6] | ((uint8_t)payload[7] << 8), 512);
+                payload[6] = n1 & 0xFF;
+                payload[7] = n1 >> 8;
+            }
+        }
+        // replies are split into frames of the configured size, if set
+        size_t offset = 0;
+        do {
+            size_t size = reply_frame_size ? std::min(reply_frame_size, payload.size() - offset) : payload.size();
+            uint8_t header[5] = { 0xf9, frame[1], control };
+            size_t reply_header_len = 4;
+            if (size > 127) {
+                header[3] = (size & 0x7F) << 1;
+                header[4] = size >> 7;
+                reply_header_len = 5;
+            } else {
+                header[3] = (size << 1) | 0x01;
+            }
+            reply.insert(reply.end(), header, header + reply_header_len);
+            reply.insert(reply.end(), payload.begin() + offset, payload.begin() + offset + size);
+            reply.push_back(cmux_fcs(header + 1, reply_header_len - 1));
+            reply.push_back(0xf9);
+            offset += size;
+        } while (offset < payload.size());
+        pos += header_len + payload_len + 2;
+    }
+    return reply;
+}
+
 int LoopbackTerm::write(uint8_t *data, size_t len)
 {
+    Scoped<Lock> lock(data_guard);
+    writes++;
     if (inject_by) {    // injection test: ignore what we write, but respond with injected data
         signal.clear(1);
         auto ret = std::async(&LoopbackTerm::batch_read, this);
         async_results.push_back(std::move(ret));
         return len;
     }
+    if (file_pending && len <= file_pending) { // Raw data written to the file
+        file->append((char *)data, len);
+        file_pending -= len;
+        if (file_pending == 0) {
+            std::string response = "+QFWRITE: " + std::to_string(len) + "," + std::to_string(file->size()) + "\r\n\r\nOK\r\n";
+            data_len = response.length();
+            loopback_data.assign(response.begin(), response.end());
+            respond();
+        }
+        return len;
+    }
     if (len > 2 && (data[len - 1] == '\r' || data[len - 1] == '+') ) { // Simple AT responder
-        std::string command((char *)data, len);
         std::string response;
-        if (command == "+++") {
-            response = "NO CARRIER\r\n";
-        } else if (command == "ATE1\r" || command == "ATE0\r") {
-            response = "OK\r\n ";
-        } else if (command == "ATO\r") {
-            response = "ERROR\r\n";
-        } else if (command.find("ATD") != std::string::npos) {
-            response = "CONNECT\n";
-        } else if (command.find("AT+CSQ\r") != std::string::npos) {
-            response = "+CSQ: 123,456\n\r\nOK\r\n";
-        } else if (command.find("AT+CGMM\r") != std::string::npos) {
-            response = "0G Dummy Model\n\r\nOK\r\n";
-        } else if (command.find("AT+COPS?\r") != std::string::npos) {
-            response = "+COPS: 0,0,\"OperatorName\",5\n\r\nOK\r\n";
-        } else if (command.find("AT+CBC\r") != std::string::npos) {
-            response = is_bg96 ? "+CBC: 1,20,123456\r\r\n\r\nOK\r\n\n\r\n" :
-                       "+CBC: 123.456V\r\r\n\r\nOK\r\n\n\r\n";
-        } else if (command.find("AT+CPIN=1234\r") != std::string::npos) {
-            response = "OK\r\n";
-            pin_ok = true;
-        } else if (command.find("AT+CPIN?\r") != std::string::npos) {
-            response = pin_ok ? "+CPIN: READY\r\nOK\r\n" : "+CPIN: SIM PIN\r\nOK\r\n";
-        } else if (command.find("AT") != std::string::npos) {
-            if (command.length() > 4) {
-                response = command;
-                response[0] = 'O';
-                response[1] = 'K';
-                response[2] = '\r';
-                response[3] = '\n';
-            } else {
-                response = "OK\r\n";
-            }
-
-        }
-        if (!response.empty()) {
+        if (at_response(std::string((char *)data, len), response)) {
             data_len = response.length();
             loopback_data.resize(data_len);
             memcpy(&loopback_data[0], &response[0], data_len);
-            signal.clear(1);
-            auto ret = std::async(on_read, nullptr, data_len);
+            respond();
             return len;
         }
     }
     if (len > 2 && data[0] == 0xf9) { // Simple CMUX responder
-        // turn the request into a reply -> implements CMUX loopback
-        // Note: This simple CMUX responder only updates CMUX headers and replaces payload.
-        // It means that all responses (that we test) must be shorter or equal to the requests
-        // For example ATD (dial command): sizeof("ATD*99#") >= sizeof("CONNECT");
-        if (data[2] == 0x3f || data[2] == 0x53) {  // SABM command
-            data[2] = 0x73;
-        } else if (data[2] == 0xef) { // Generic request
-            data[2] = 0xff;         // generic reply
-        }
-    }
-    loopback_data.resize(data_len + len);
-    memcpy(&loopback_data[data_len], data, len);
-    data_len += len;
-    signal.clear(1);
-    auto ret = std::async(on_read, nullptr, data_len);
+        auto reply = cmux_response(data, len);
+        loopback_data.resize(data_len + reply.size());
+        memcpy(&loopback_data[data_len], reply.data(), reply.size());
+        data_len += reply.size();
+    } else {
+        loopback_data.resize(data_len + len);
+        memcpy(&loopback_data[data_len], data, len);
+        data_len += len;
+    }
+    respond();
     return len;
 }
 
+void LoopbackTerm::respond()
+{
+    // Process the reply asynchronously (as real terminals do), so that the reader could write
+    // to this terminal (e.g. CMUX control replies), but make sure we process one read at a time
+    // (called with the data guard held)
+    signal.clear(1);
+    auto ret = std::async(std::launch::async, [this] {
+        Scoped<Lock> lock(on_read_guard);
+        if (on_read == nullptr) {
+            signal.set(1);  // nobody reads the reply
+            return;
+        }
+        // deliver the reply at once, or in fragments as long as the reader reads them
+        size_t len;
+        size_t remaining = pending();
+        do {
+            len = remaining;
+            on_read(nullptr, fragment_size ? std::min(fragment_size, len) : len);
+            remaining = pending();
+        } while (fragment_size && remaining > 0 && remaining != len);
+    });
+    async_results.push_back(std::move(ret));
+}
+
+int LoopbackTerm::writev(const struct iovec *iov, int iovcnt)
+{
+    std::vector<uint8_t> gathered;
+    for (int i = 0; i < iovcnt; ++i) {
+        auto *base = static_cast<uint8_t *>(iov[i].iov_base);
+        gathered.insert(gathered.end(), base, base + iov[i].iov_len);
+    }
+    return write(gathered.data(), gathered.size());
+}
+
+size_t LoopbackTerm::pending()
+{
+    Scoped<Lock> lock(data_guard);
+    return data_len;
+}
+
 int LoopbackTerm::read(uint8_t *data, size_t len)
 {
+    Scoped<Lock> lock(data_guard);
+    if (flow_off) {
+        return 0;   // the data are delivered once the flow is on again
+    }
     size_t read_len = std::min(data_len, len);
     if (inject_by && read_len > inject_by) {
         read_len = inject_by;
+    } else if (fragment_size && read_len > fragment_size) {
+        read_len = fragment_size;
     }
     if (read_len) {
         if (loopback_data.capacity() < len) {
@@ -108,18 +269,19 @@ int LoopbackTerm::read(uint8_t *data, size_t len)
     return read_len;
 }
 
-LoopbackTerm::LoopbackTerm(bool is_bg96): loopback_data(), data_len(0), pin_ok(false), is_bg96(is_bg96), inject_by(0)
+LoopbackTerm::LoopbackTerm(bool is_bg96): loopback_data(), data_len(0), pin_ok(false), is_bg96(is_bg96), inject_by(0), writes(0)
 {
     init_signal();
 }
 
-LoopbackTerm::LoopbackTerm(): loopback_data(), data_len(0), pin_ok(false), is_bg96(false), inject_by(0)
+LoopbackTerm::LoopbackTerm(): loopback_data(), data_len(0), pin_ok(false), is_bg96(false), inject_by(0), writes(0)
 {
     init_signal();
 }
 
 int LoopbackTerm::inject(uint8_t *data, size_t len, size_t injected_by, size_t delay_before, size_t delay_after)
 {
+    Scoped<Lock> lock(data_guard);
     if (data == nullptr) {
         inject_by = 0;
         return 0;
@@ -136,21 +298,51 @@ int LoopbackTerm::inject(uint8_t *data, size_t len, size_t injected_by, size_t d
 
 void LoopbackTerm::batch_read()
 {
-    while (data_len > 0) {
-        Task::Delay(delay_before_inject);
+    while (true) {
+        size_t len, delay_before, delay_after;
+        {
+            Scoped<Lock> lock(data_guard);
+            len = data_len;
+            delay_before = delay_before_inject;
+            delay_after = delay_after_inject;
+        }
+        if (len == 0) {
+            break;
+        }
+        Task::Delay(delay_before);
         {
             Scoped<Lock> lock(on_read_guard);
-            on_read(nullptr, std::min(inject_by, data_len));
+            if (on_read == nullptr) {
+                break;
+            }
+            on_read(nullptr, len);  // reads up to inject_by
         }
-        Task::Delay(delay_after_inject);
+        Task::Delay(delay_after);
     }
     signal.set(1);
 }
 
 LoopbackTerm::~LoopbackTerm()
 {
-    data_len = 0;
+    {
+        Scoped<Lock> lock(data_guard);
+        data_len = 0;
+    }
     signal.wait(1, INT32_MAX); // wait "very long" to let the std::async() finish
+    // the pending operations might start new ones (e.g. write a reply), so wait until there are none left
+    while (true) {
+        std::vector<std::future<void>> results;
+        {
+            Scoped<Lock> lock(data_guard);
+            results.swap(async_results);
+        }
+        if (results.empty()) {
+            break;
+        }
+        for (auto &result : results) {
+            result.wait();
+        }
+    }
 }
 
 void LoopbackTerm::init_signal()
@@ -163,7 +355,12 @@ void LoopbackTerm::init_signal()
 
 void LoopbackTerm::set_read_cb(std::function<bool(uint8_t *, size_t)> f)
 {
+    Scoped<Lock> lock(on_read_guard);     // not while we're delivering the data
     user_on_read = std::move(f);
+    if (user_on_read == nullptr) {
+        on_read = nullptr;
+        return;
+    }
     on_read = [this](uint8_t *data, size_t len) {
         auto ret = user_on_read(data, len);
         signal.set(1);
@@ -5,6 +5,8 @@
  */
 #pragma once
 
+#include <map>
+#include <string>
 #include "cxx_include/esp_modem_api.hpp"
 #include "cxx_include/esp_modem_terminal.hpp"
 
@@ -24,11 +26,46 @@ public:
      */
     int inject(uint8_t *data, size_t len, size_t inject_by, size_t delay_before = 0, size_t delay_after = 1);
 
+    /**
+     * @brief Delivers the replies of responders in fragments of `len` bytes (0 to deliver them at once)
+     */
+    void set_fragment_size(size_t len)
+    {
+        fragment_size = len;
+    }
+
+    /**
+     * @brief Stops delivering the replies on CMUX flow-off (FCoff) until flow-on (FCon), as devices do
+     */
+    void set_honour_flow(bool honour)
+    {
+        honour_flow = honour;
+    }
+
+    /**
+     * @brief Splits the CMUX replies into frames of up to `size` bytes of payload (0 to reply in one frame)
+     */
+    void set_reply_frame_size(size_t size)
+    {
+        reply_frame_size = size;
+    }
+
     void start() override;
     void stop() override;
 
     int write(uint8_t *data, size_t len) override;
 
+    /**
+     * @brief Gathers the buffers and writes them as one chunk, so the responder
+     * sees entire CMUX frames (and we can check the number of writes)
+     */
+    int writev(const struct iovec *iov, int iovcnt) override;
+
+    size_t write_count() const
+    {
+        return writes;
+    }
+
     int read(uint8_t *data, size_t len) override;
 
     void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override;
@@ -39,6 +76,10 @@ private:
         STOPPED
     };
     void batch_read();
+    void respond();
+    size_t pending();
+    bool at_response(const std::string &command, std::string &response);
+    std::vector<uint8_t> cmux_response(const uint8_t *data, size_t len);
     std::function<bool(uint8_t *data, size_t len)> user_on_read;
     status_t status;
     SignalGroup signal;
@@ -50,7 +91,17 @@ private:
     size_t inject_by;
     size_t delay_before_inject;
     size_t delay_after_inject;
+    size_t writes;
+    size_t fragment_size{0};
+    bool honour_flow{false};
+    size_t reply_frame_size{0};
+    bool flow_off{false};       /*!< Flow-off received (and honoured) */
+    std::map<std::string, std::string> files;   /*!< Files written and read with AT+QFWRITE/AT+QFREAD, by name */
+    std::string *file{nullptr}; /*!< Content of the open file */
+    size_t file_pos{0};
+    size_t file_pending{0};     /*!< Bytes of the file expected to be written (after AT+QFWRITE) */
     std::vector<std::future<void>> async_results;
     Lock on_read_guard;
+    Lock data_guard;            /*!< Guards the loopback data and the async results (written and read from different threads) */
 
 };
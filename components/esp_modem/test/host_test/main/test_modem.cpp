@@ -6,12 +6,80 @@
 #define CATCH_CONFIG_MAIN // This tells the catch header to generate a main
 #include <memory>
 #include <future>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <asm/termbits.h>
 #include "catch.hpp"
 #include "cxx_include/esp_modem_api.hpp"
+#include "cxx_include/esp_modem_cmux.hpp"
+#include "cxx_include/esp_modem_command_library_utils.hpp"
+#include "cxx_include/esp_modem_coroutine.hpp"
+#include "cxx_include/esp_modem_pool.hpp"
+#include "vfs_resource/vfs_create.hpp"
 #include "LoopbackTerm.h"
+#include "modem_sim.hpp"
+#include "tun_packet.h"
 
 using namespace esp_modem;
 
+/**
+ * @brief Minimal terminal to exercise the CMUX codec directly: acknowledges SABM synchronously
+ * and keeps the last written data, which could be decoded back with `feed()`
+ */
+class CMuxCodecTerm : public Terminal {
+public:
+    int write(uint8_t *data, size_t len) override
+    {
+        if (len == 6 && data[2] == 0x3f) {    // SABM -> UA
+            uint8_t ua[] = { 0xf9, data[1], 0x73, 0x01, 0, 0xf9 };
+            ua[4] = 0xFF - CMux::fcs_crc(ua + 1, 3);
+            on_read(ua, sizeof(ua));
+            return len;
+        }
+        written.assign(data, data + len);
+        return len;
+    }
+    int writev(const struct iovec *iov, int iovcnt) override
+    {
+        written.clear();
+        for (int i = 0; i < iovcnt; ++i) {
+            auto *base = static_cast<uint8_t *>(iov[i].iov_base);
+            written.insert(written.end(), base, base + iov[i].iov_len);
+        }
+        return written.size();
+    }
+    void feed(uint8_t *data, size_t len)
+    {
+        on_read(data, len);
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        return 0;
+    }
+    void start() override {}
+    void stop() override {}
+
+    std::vector<uint8_t> written;
+};
+
+static uint8_t fcs_crc_bitwise(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xe0 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
 TEST_CASE("DTE command races", "[esp_modem]")
 {
     auto term = std::make_unique<LoopbackTerm>(true);
@@ -108,6 +176,233 @@ TEST_CASE("DCE AT parser", "[esp_modem]")
     CHECK(act == 5);
 }
 
+TEST_CASE("DCE string outputs in caller's buffer", "[esp_modem]")
+{
+    using namespace esp_modem::dce_commands;
+    at_string<16> cmd;
+    cmd << "AT+IFC=" << 2 << ',' << -1 << "\r";
+    CHECK(cmd.ok());
+    CHECK(cmd.view() == "AT+IFC=2,-1\r");
+    cmd << "AT+CFUN=" << 1;
+    CHECK(cmd.ok() == false);
+
+    auto term = std::make_unique<LoopbackTerm>();
+    auto dte =  std::make_shared<DTE>(std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+
+    char buffer[32];
+    char_span out{buffer, sizeof(buffer)};
+    CHECK(dce->get_module_name(out) == command_result::OK);
+    CHECK(std::string_view(out.data, out.len) == "0G Dummy Model");
+    CHECK(strcmp(buffer, "0G Dummy Model") == 0);
+
+    int act = 0;
+    CHECK(dce->get_operator_name(out, act) == command_result::OK);
+    CHECK(std::string_view(out.data, out.len) == "OperatorName");
+    CHECK(act == 5);
+
+    // longer outputs are truncated
+    char small[6];
+    char_span small_out{small, sizeof(small)};
+    CHECK(dce->at("AT+CGMM", small_out, 500) == command_result::OK);
+    CHECK(std::string_view(small) == "0G Du");
+}
+
+TEST_CASE("DCE batch of queries in one command line", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto loopback = term.get();
+    auto dte =  std::make_shared<DTE>(std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+
+    int rssi = 0, ber = 0, state = 0, act = 0;
+    std::string name;
+    CommandBatch status;
+    status.signal_quality(rssi, ber).network_attachment_state(state).operator_name(name, act);
+    CHECK(status.size() == 3);
+
+    // combined reply parsed into outputs of all queries (received in fragments)
+    uint8_t reply[] = "\r\n+CSQ: 20,99\r\n\r\n+CGATT: 1\r\n\r\n+COPS: 0,0,\"OperatorName\",7\r\n\r\nOK\r\n";
+    loopback->inject(&reply[0], sizeof(reply) - 1, 7, 0, 0);
+    CHECK(dce->batch(status) == command_result::OK);
+    CHECK(rssi == 20);
+    CHECK(ber == 99);
+    CHECK(state == 1);
+    CHECK(name == "OperatorName");
+    CHECK(act == 7);
+    for (size_t i = 0; i < status.size(); ++i) {
+        CHECK(status.result(i) == command_result::OK);
+    }
+
+    // the device stops on the first failure, so the following queries fail, too
+    uint8_t error_reply[] = "\r\n+CSQ: 10,99\r\n\r\n+CME ERROR: 30\r\n";
+    loopback->inject(&error_reply[0], sizeof(error_reply) - 1, 7, 0, 0);
+    CHECK(dce->batch(status) == command_result::FAIL);
+    CHECK(rssi == 10);
+    CHECK(status.result(0) == command_result::OK);
+    CHECK(status.result(1) == command_result::FAIL);
+    CHECK(status.result(2) == command_result::FAIL);
+    loopback->inject(nullptr, 0, 0);
+
+    // batch limited by the number of queries
+    CommandBatch too_many;
+    for (size_t i = 0; i <= CommandBatch::max_queries; ++i) {
+        too_many.network_attachment_state(state);
+    }
+    CHECK(dce->batch(too_many) == command_result::FAIL);
+}
+
+TEST_CASE("DCE caches replies of static queries", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto loopback = term.get();
+    auto dte =  std::make_shared<DTE>(std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+    cache_config config;
+    config.operator_name_ttl_ms = 0;    // not cached
+    auto cache = dce->get_module()->enable_cache(config);
+
+    std::string name;
+    CHECK(dce->get_module_name(name) == command_result::OK);
+    auto writes = loopback->write_count();
+    for (int i = 0; i < 3; ++i) {
+        name.clear();
+        CHECK(dce->get_module_name(name) == command_result::OK);
+        CHECK(name == "0G Dummy Model");
+    }
+    CHECK(loopback->write_count() == writes);
+    CHECK(cache->get_stats().hits == 3);
+    CHECK(cache->get_stats().misses == 1);
+
+    // commands not configured for caching
+    int act;
+    CHECK(dce->get_operator_name(name, act) == command_result::OK);
+    CHECK(dce->get_operator_name(name, act) == command_result::OK);
+    CHECK(loopback->write_count() == writes + 2);
+    CHECK(cache->get_stats().misses == 1);
+
+    // mode switching keeps the replies with infinite TTL, reset (or SIM events) invalidates all
+    CHECK(dce->set_mode(modem_mode::COMMAND_MODE));
+    CHECK(dce->get_module_name(name) == command_result::OK);
+    CHECK(cache->get_stats().hits == 4);
+    CHECK(dce->set_radio_state(1) == command_result::OK);
+    CHECK(dce->get_module_name(name) == command_result::OK);
+    CHECK(cache->get_stats().misses == 2);
+    cache->invalidate();
+    CHECK(dce->get_module_name(name) == command_result::OK);
+    CHECK(cache->get_stats().misses == 3);
+}
+
+/**
+ * @brief Minimal (fire and forget) coroutine type to run the test sessions
+ */
+struct co_task {
+    struct promise_type {
+        co_task get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+TEST_CASE("DCE commands awaited in coroutines", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto dte =  std::make_shared<DTE>(std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+
+    // simple event loop: coroutines are resumed from this thread only
+    std::mutex ready_lock;
+    std::deque<std::coroutine_handle<>> ready;
+    coro::AsyncDCE modem(*dce, [&](std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> l(ready_lock);
+        ready.push_back(h);
+    });
+    auto loop_thread = std::this_thread::get_id();
+    int completed = 0;
+    auto session = [&](int id) -> co_task {
+        std::string name;
+        int rssi = 0, ber = 0;
+        auto ret = co_await modem.get_module_name(name);
+        CHECK(std::this_thread::get_id() == loop_thread);
+        CHECK(ret == command_result::OK);
+        CHECK(name == "0G Dummy Model");
+        ret = co_await modem.get_signal_quality(rssi, ber);
+        CHECK(ret == command_result::OK);
+        CHECK(rssi == 123);
+        completed++;
+    };
+    // two sessions on one thread, their commands are queued on the DTE
+    session(1);
+    session(2);
+    for (int i = 0; i < 1000 && completed < 2; ++i) {
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> l(ready_lock);
+            if (!ready.empty()) {
+                h = ready.front();
+                ready.pop_front();
+            }
+        }
+        if (h) {
+            h.resume();
+        } else {
+            usleep(1000);
+        }
+    }
+    CHECK(completed == 2);
+}
+
+TEST_CASE("Reply phrases scan only new data", "[esp_modem]")
+{
+    using namespace esp_modem::dce_commands;
+    static constexpr reply_phrases<2, 1> phrases({"NO CARRIER", "OK"}, {"ERROR"});
+    std::string reply = "\r\nNO CAR";
+    size_t scanned = 0;
+    CHECK(phrases.scan((uint8_t *)reply.data(), reply.size(), scanned) == command_result::TIMEOUT);
+    CHECK(scanned == reply.size());
+    // phrase received in fragments is found, although we scan only from the previous position
+    reply += "RIER\r\n";
+    CHECK(phrases.scan((uint8_t *)reply.data(), reply.size(), scanned) == command_result::OK);
+
+    // pass phrases take precedence over fail phrases
+    scanned = 0;
+    reply = "ERROR\r\nOK\r\n";
+    CHECK(phrases.scan((uint8_t *)reply.data(), reply.size(), scanned) == command_result::OK);
+    scanned = 0;
+    reply = "+CME ERROR: 10\r\n";
+    CHECK(phrases.scan((uint8_t *)reply.data(), reply.size(), scanned) == command_result::FAIL);
+    // shorter reply (i.e. not continuation of the previous one) is scanned from the beginning
+    reply = "O";
+    CHECK(phrases.scan((uint8_t *)reply.data(), reply.size(), scanned) == command_result::TIMEOUT);
+    reply = "OK";
+    CHECK(phrases.scan((uint8_t *)reply.data(), reply.size(), scanned) == command_result::OK);
+}
 
 TEST_CASE("DTE send/receive command", "[esp_modem]")
 {
@@ -128,6 +423,646 @@ TEST_CASE("DTE send/receive command", "[esp_modem]")
 }
 
 
+TEST_CASE("DTE collects replies in a ring buffer", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 64,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {}
+    };
+    auto dte = std::make_unique<DTE>(&dte_config, std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+
+    // replies are read directly to the ring buffer, so the consecutive ones wrap around its end
+    for (int i = 0; i < 4; ++i) {
+        std::string test_command(40, 'A' + i);
+        test_command.back() = '\n';
+        auto ret = dte->command(test_command, [&](uint8_t *data, size_t len) {
+            std::string response((char *)data, len);
+            CHECK(response == test_command);
+            return command_result::OK;
+        }, 1000);
+        CHECK(ret == command_result::OK);
+    }
+}
+
+
+TEST_CASE("DTE reply buffer is sized independently of the DTE buffer", "[esp_modem]")
+{
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 1024,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {},
+        .reply_buffer_size = 64
+    };
+    auto dte = std::make_unique<DTE>(&dte_config, std::make_unique<LoopbackTerm>());
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    auto echo = [](size_t len) {
+        std::string command(len, 'A');
+        command.back() = '\n';
+        return command;
+    };
+    auto complete = [](uint8_t *data, size_t len) {
+        return command_result::OK;
+    };
+    CHECK(dte->command(echo(60), complete, 1000) == command_result::OK);
+    // doesn't fit in the reply buffer (even though the DTE buffer is larger)
+    CHECK(dte->command(echo(100), complete, 200) != command_result::OK);
+    CHECK(dte->command(echo(60), complete, 1000) == command_result::OK);
+}
+
+TEST_CASE("DTE streams long replies in chunks", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 64,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {}
+    };
+    auto dte = std::make_unique<DTE>(&dte_config, std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+
+    // the binary payload is much longer than the DTE buffer
+    const size_t len = 4096;
+    size_t received = 0;
+    bool matches = true;
+    auto ret = dce_commands::generic_get_binary(dte.get(), "AT+READBIN=4096\r", [&](uint8_t *data, size_t n) {
+        for (size_t i = 0; i < n; ++i, ++received) {
+            matches &= data[i] == static_cast<uint8_t>("\r\nOK"[received % 4] + received / 4 % 2);
+        }
+        return true;
+    }, 1000);
+    CHECK(ret == command_result::OK);
+    CHECK(received == len);
+    CHECK(matches);
+
+    // lines could be parsed in chunks, keeping the incomplete ones for the next chunk
+    std::string lines(1000, 'x');
+    for (size_t i = 0; i < lines.size(); i += 25) {
+        lines[i] = '\n';
+    }
+    lines += "\nEND\n";
+    size_t line_count = 0;
+    ret = dte->stream_command(lines.c_str(), lines.size(), [&](uint8_t *data, size_t n, stream_state & state) {
+        std::string_view chunk((char *)data, n);
+        size_t pos;
+        state.consumed = 0;
+        while ((pos = chunk.find('\n', state.consumed)) != std::string_view::npos) {
+            if (chunk.substr(state.consumed, pos - state.consumed) == "END") {
+                return command_result::OK;
+            }
+            line_count++;
+            state.consumed = pos + 1;
+        }
+        return command_result::TIMEOUT;
+    }, 1000);
+    CHECK(ret == command_result::OK);
+    CHECK(line_count == 41);
+
+    // a line which doesn't fit in the buffer fails the command
+    std::string long_line(200, 'y');
+    long_line += "\n";
+    ret = dte->stream_command(long_line.c_str(), long_line.size(), [](uint8_t *data, size_t n, stream_state & state) {
+        state.consumed = 0;
+        return command_result::TIMEOUT;
+    }, 1000);
+    CHECK(ret == command_result::FAIL);
+
+    // the sink could fail the command
+    ret = dce_commands::generic_get_binary(dte.get(), "AT+READBIN=100\r", [](uint8_t *data, size_t n) {
+        return false;
+    }, 1000);
+    CHECK(ret == command_result::FAIL);
+
+    // OK without the header completes with no payload, ERROR fails
+    received = 0;
+    auto count = [&](uint8_t *data, size_t n) {
+        received += n;
+        return true;
+    };
+    ret = dce_commands::generic_get_binary(dte.get(), "AT\r", count, 1000);
+    CHECK(ret == command_result::OK);
+    CHECK(received == 0);
+    ret = dce_commands::generic_get_binary(dte.get(), "ATO\r", count, 1000);
+    CHECK(ret == command_result::FAIL);
+    CHECK(received == 0);
+}
+
+TEST_CASE("DCE transfers files in chunks", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>(true);
+    auto dte = std::make_shared<DTE>(std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_BG96_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+
+    // binary content, longer than the DTE buffer
+    std::string content;
+    for (int i = 0; i < 5000; ++i) {
+        content.push_back(static_cast<char>(i * 7));
+    }
+    size_t pos = 0;
+    CHECK(dce->upload_file("UFS:test.bin", [&](uint8_t *data, size_t len) {
+        len = std::min(len, content.size() - pos);
+        memcpy(data, content.data() + pos, len);
+        pos += len;
+        return static_cast<int>(len);
+    }, 1024) == command_result::OK);
+
+    std::string downloaded;
+    CHECK(dce->download_file("UFS:test.bin", [&](uint8_t *data, size_t len) {
+        downloaded.append((char *)data, len);
+        return true;
+    }, 1024) == command_result::OK);
+    CHECK(downloaded == content);
+
+    // transfer from/to file descriptors
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CHECK(dce->download_file("UFS:test.bin", fds[0], 2048) == command_result::OK);
+    shutdown(fds[0], SHUT_WR);
+    CHECK(dce->upload_file("UFS:copy.bin", fds[1], 512) == command_result::OK);
+    close(fds[0]);
+    close(fds[1]);
+    downloaded.clear();
+    CHECK(dce->download_file("UFS:copy.bin", [&](uint8_t *data, size_t len) {
+        downloaded.append((char *)data, len);
+        return true;
+    }) == command_result::OK);
+    CHECK(downloaded == content);
+
+    // files are kept by name, unknown files cannot be downloaded
+    const std::string other = "other file";
+    CHECK(dce->upload_file("UFS:other.txt", [&, done = false](uint8_t *data, size_t len) mutable {
+        len = done ? 0 : std::min(len, other.size());
+        memcpy(data, other.data(), len);
+        done = true;
+        return static_cast<int>(len);
+    }, 1024) == command_result::OK);
+    for (auto &[name, expected] : { std::pair{"UFS:test.bin", content}, std::pair{"UFS:other.txt", other} }) {
+        downloaded.clear();
+        CHECK(dce->download_file(name, [&](uint8_t *data, size_t len) {
+            downloaded.append((char *)data, len);
+            return true;
+        }) == command_result::OK);
+        CHECK(downloaded == expected);
+    }
+    CHECK(dce->download_file("UFS:missing.bin", [](uint8_t *data, size_t len) {
+        return true;
+    }) == command_result::FAIL);
+
+    // generic modules don't support file transfer
+    auto generic_dce = create_generic_dce(&dce_config, dte, &netif);
+    CHECK(generic_dce->download_file("UFS:test.bin", [](uint8_t *data, size_t len) {
+        return true;
+    }) == command_result::FAIL);
+}
+
+TEST_CASE("DTE pipelined asynchronous commands", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto dte = std::make_unique<DTE>(std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+
+    std::vector<std::string> replies;
+    auto echo = [&](uint8_t *data, size_t len) {
+        replies.emplace_back((char *)data, len);
+        return command_result::OK;
+    };
+    // the caller doesn't block, commands are sent in order, each with its own timeout
+    auto first = dte->command_async("First\n", echo, 1000);
+    auto never = dte->command_async("Never\n", [](uint8_t *data, size_t len) {
+        return command_result::TIMEOUT;
+    }, 100);
+    auto second = dte->command_async("Second\n", echo, 1000);
+    CHECK(first.get() == command_result::OK);
+    CHECK(never.get() == command_result::TIMEOUT);
+    CHECK(second.get() == command_result::OK);
+    REQUIRE(replies.size() == 2);
+    CHECK(replies[0] == "First\n");
+    CHECK(replies[1] == "Second\n");
+
+    // synchronous commands could be interleaved
+    CHECK(dte->command("Sync\n", echo, 1000) == command_result::OK);
+}
+
+TEST_CASE("DTE routes URCs to their handlers", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto loopback = term.get();
+    auto dte = std::make_unique<DTE>(std::move(term));
+    std::vector<std::string> urcs;
+    auto on_urc = [&](uint8_t *data, size_t len) {
+        urcs.emplace_back((char *)data, len);
+    };
+    CHECK(dte->set_urc_cb("RING", on_urc));
+    CHECK(dte->set_urc_cb("+CREG:", on_urc));
+    CHECK(dte->set_urc_cb("", on_urc) == false);
+    // handlers are called from the command task, so the jobs posted after the URCs have been received run after them
+    auto handled = [&dte]() {
+        std::promise<void> done;
+        dte->post([&done](bool cancelled) {
+            done.set_value();
+        });
+        done.get_future().wait();
+    };
+
+    std::string reply;
+    auto got_reply = [&](uint8_t *data, size_t len) {
+        reply.assign((char *)data, len);
+        return reply.find("OK\r\n") != std::string::npos ? command_result::OK : command_result::TIMEOUT;
+    };
+    // URCs are interleaved with the reply and fragmented (injected by 3 bytes)
+    uint8_t resp[] = "\r\nRING\r\n+CREG: 0,1\r\nOK\r\n";
+    loopback->inject(&resp[0], sizeof(resp) - 1, 3, 0, 0);
+    // +CREG line is the reply to AT+CREG?, so it's not a URC
+    CHECK(dte->command("AT+CREG?\r", got_reply, 1000) == command_result::OK);
+    CHECK(reply == "\r\n+CREG: 0,1\r\nOK\r\n");
+    handled();
+    REQUIRE(urcs.size() == 1);
+    CHECK(urcs[0] == "RING\r\n");
+
+    loopback->inject(&resp[0], sizeof(resp) - 1, 3, 0, 0);
+    CHECK(dte->command("AT\r", got_reply, 1000) == command_result::OK);
+    CHECK(reply == "\r\nOK\r\n");
+    handled();
+    REQUIRE(urcs.size() == 3);
+    CHECK(urcs[2] == "+CREG: 0,1\r\n");
+
+    // removed handlers don't receive the lines anymore
+    CHECK(dte->set_urc_cb("RING", nullptr));
+    loopback->inject(&resp[0], sizeof(resp) - 1, 3, 0, 0);
+    CHECK(dte->command("AT\r", got_reply, 1000) == command_result::OK);
+    CHECK(reply == "\r\nRING\r\nOK\r\n");
+    handled();
+    CHECK(urcs.size() == 4);
+    loopback->inject(nullptr, 0, 0);
+}
+
+TEST_CASE("VFS terminals served by a shared reactor", "[esp_modem]")
+{
+    const int modems = 16;
+    std::vector<std::shared_ptr<DTE>> dtes;
+    std::vector<int> devices;
+    for (int i = 0; i < modems; ++i) {
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        esp_modem_dte_config_t dte_config = {
+            .dte_buffer_size = 512,
+            .task_stack_size = 0,
+            .task_priority = 0,
+            .vfs_config = { .fd = sv[0], .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr }
+        };
+        auto dte = create_vfs_dte(&dte_config);
+        REQUIRE(dte != nullptr);
+        dtes.push_back(std::move(dte));
+        devices.push_back(sv[1]);
+    }
+
+    // all modems reply concurrently, the replies are dispatched by the reactor thread(s)
+    std::vector<std::future<command_result>> results;
+    for (int i = 0; i < modems; ++i) {
+        results.push_back(std::async(std::launch::async, [&, i] {
+            return dtes[i]->command("AT\r", [](uint8_t *data, size_t len)
+            {
+                std::string response((char *) data, len);
+                return response.find("OK") != std::string::npos ? command_result::OK : command_result::TIMEOUT;
+            }, 1000);
+        }));
+    }
+    for (auto device : devices) {
+        char cmd[8];
+        CHECK(read(device, cmd, sizeof(cmd)) == 3);
+        CHECK(write(device, "\r\nOK\r\n", 6) == 6);
+    }
+    for (auto &result : results) {
+        CHECK(result.get() == command_result::OK);
+    }
+
+    // terminals stop immediately (no polling with timeout)
+    auto start = std::chrono::steady_clock::now();
+    dtes.clear();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+    for (auto device : devices) {
+        close(device);
+    }
+}
+
+
+TEST_CASE("VFS terminal reads out data nobody waits for", "[esp_modem]")
+{
+    int sv[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 512,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = { .fd = sv[0], .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr }
+    };
+    auto dte = create_vfs_dte(&dte_config);
+    REQUIRE(dte != nullptr);
+    auto cpu_ms = []() {
+        struct timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000 + ts.tv_nsec / 1'000'000;
+    };
+
+    // unsolicited line without a command in progress is dropped, so the reactor doesn't spin on it
+    const std::string urc = "\r\n+CREG: 1\r\n";
+    auto start = cpu_ms();
+    CHECK(write(sv[1], urc.data(), urc.size()) == static_cast<ssize_t>(urc.size()));
+    usleep(200'000);
+    CHECK(cpu_ms() - start < 100);
+    CHECK(dte->get_stats().command.rx_bytes == urc.size());
+
+    // data of a multiple of the read chunk end with an empty read, which mustn't block the reactor (and the callback below)
+    const std::string junk(128, 'x');
+    CHECK(write(sv[1], junk.data(), junk.size()) == static_cast<ssize_t>(junk.size()));
+    usleep(100'000);
+    CHECK(dte->get_stats().command.rx_bytes == urc.size() + junk.size());
+
+    // replacing the read callback waits for the one in progress
+    std::atomic<bool> running{false};
+    dte->set_read_cb([&running](uint8_t *data, size_t len) {
+        running = true;
+        usleep(100'000);
+        running = false;
+        return true;
+    });
+    CHECK(write(sv[1], "data", 4) == 4);
+    for (int i = 0; i < 100 && !running; ++i) {
+        usleep(1000);
+    }
+    CHECK(running == true);
+    dte->set_read_cb(nullptr);
+    CHECK(running == false);
+    dte.reset();
+    close(sv[1]);
+}
+
+TEST_CASE("DCE with simulated modems", "[esp_modem][modem_sim]")
+{
+    modem_sim::config cfg;
+    cfg.latency = std::chrono::milliseconds(1);
+    cfg.jitter = std::chrono::milliseconds(2);
+    cfg.fragment_size = 7;
+    const size_t modems = 8;
+    modem_sim::Simulator sim(modems, cfg);
+
+    auto create_dte = [](modem_sim::Simulator & sim, size_t i) {
+        esp_modem_dte_config_t dte_config = {
+            .dte_buffer_size = 1024,
+            .task_stack_size = 0,
+            .task_priority = 0,
+            .vfs_config = { .fd = sim.open(i), .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr }
+        };
+        return create_vfs_dte(&dte_config);
+    };
+
+    // all modems are driven concurrently through command and CMUX modes, reporting the first failed step
+    std::vector<std::future<std::string>> results;
+    for (size_t i = 0; i < modems; ++i) {
+        results.push_back(std::async(std::launch::async, [&, i]() -> std::string {
+            auto dte = create_dte(sim, i);
+            esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+            esp_netif_t netif{};
+            auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+            std::string name, imsi;
+            int rssi, ber;
+            if (dce->sync() != command_result::OK || dce->get_module_name(name) != command_result::OK || name != "SIM7600") {
+                return "command mode";
+            }
+            if (!dce->set_mode(modem_mode::CMUX_MODE)) {
+                return "enter CMUX";
+            }
+            if (dce->get_signal_quality(rssi, ber) != command_result::OK || rssi < 15 || dce->get_imsi(imsi) != command_result::OK) {
+                return "CMUX commands";
+            }
+            if (!dce->set_mode(modem_mode::COMMAND_MODE) || dce->sync() != command_result::OK) {
+                return "exit CMUX";
+            }
+            return imsi;
+        }));
+    }
+    for (size_t i = 0; i < modems; ++i) {
+        CHECK(results[i].get() == "00101000000000" + std::to_string(i));
+        auto stats = sim.get_stats(i);
+        CHECK(stats.sessions == 1);
+        CHECK(stats.bad_frames == 0);
+    }
+
+    // injected errors and dropped replies are reported as failures and timeouts
+    cfg.error_rate = 1;
+    modem_sim::Simulator failing(1, cfg);
+    cfg.error_rate = 0;
+    cfg.drop_rate = 1;
+    modem_sim::Simulator silent(1, cfg);
+    for (auto [faulty, expected] : { std::pair{&failing, command_result::FAIL}, std::pair{&silent, command_result::TIMEOUT} }) {
+        auto dte = create_dte(*faulty, 0);
+        esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+        esp_netif_t netif{};
+        auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+        CHECK(dce->sync() == expected);
+        auto stats = faulty->get_stats(0);
+        CHECK(stats.errors + stats.drops == 1);
+    }
+}
+
+
+TEST_CASE("CMUX writes complete frames to a slow device", "[esp_modem][modem_sim]")
+{
+    modem_sim::config cfg;
+    cfg.latency = std::chrono::milliseconds(1);
+    modem_sim::Simulator sim(1, cfg);
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 1024,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = { .fd = sim.open(0), .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr }
+    };
+    auto dte = create_vfs_dte(&dte_config);
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    REQUIRE(dce->set_mode(modem_mode::CMUX_MODE) == true);
+    dte->set_read_cb([](uint8_t *, size_t) {
+        return false;
+    });
+
+    // much more than the pty buffer, so that the terminal has to wait and complete partial writes
+    std::vector<uint8_t> data(64 * 1024, 0x55);
+    auto frames_before = sim.get_stats(0).frames;
+    CHECK(dte->write(data.data(), data.size()) == static_cast<int>(data.size()));
+    const uint64_t frames = (data.size() + 126) / 127;
+    for (int i = 0; i < 200 && sim.get_stats(0).frames < frames_before + frames; ++i) {
+        usleep(10'000);
+    }
+    CHECK(sim.get_stats(0).frames == frames_before + frames);
+    CHECK(sim.get_stats(0).bad_frames == 0);
+}
+
+
+TEST_CASE("Modem pool", "[esp_modem][modem_sim]")
+{
+    modem_sim::config cfg;
+    cfg.latency = std::chrono::milliseconds(1);
+    const size_t modems = 12;
+    modem_sim::Simulator sim(modems, cfg);
+    cfg.error_rate = 1;
+    modem_sim::Simulator failing(1, cfg);
+    esp_netif_t netif{};
+
+    auto create_dce = [&netif](modem_sim::Simulator & sim, size_t i) {
+        esp_modem_dte_config_t dte_config = {
+            .dte_buffer_size = 1024,
+            .task_stack_size = 0,
+            .task_priority = 0,
+            .vfs_config = { .fd = sim.open(i), .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr }
+        };
+        esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+        return create_SIM7600_dce(&dce_config, create_vfs_dte(&dte_config), &netif);
+    };
+    auto wait_for = [](ModemPool & pool, auto condition) {
+        for (int i = 0; i < 300 && !condition(pool.get_summary()); ++i) {
+            usleep(10'000);
+        }
+        return condition(pool.get_summary());
+    };
+
+    modem_pool_config config;
+    config.workers = 3;
+    config.health_period_ms = 50;
+    config.max_checks_per_second = 1000;
+    config.failures_to_down = 2;
+    ModemPool pool(config);
+    std::vector<int> ids;
+    for (size_t i = 0; i < modems; ++i) {
+        ids.push_back(pool.add("sim" + std::to_string(i), create_dce(sim, i)));
+    }
+    int bad = pool.add("failing", create_dce(failing, 0));
+    CHECK(pool.add("null", nullptr) == -1);
+
+    // health checks of all modems, the failing one goes down after two checks
+    CHECK(wait_for(pool, [](const modem_pool_status & s) {
+        return s.up == modems && s.down == 1;
+    }));
+    for (auto &status : pool.get_status()) {
+        if (status.id == bad) {
+            CHECK(status.health == modem_health::DOWN);
+            CHECK(status.last_result == command_result::FAIL);
+        } else {
+            CHECK(status.health == modem_health::UP);
+            CHECK(status.rssi >= 15);
+            CHECK(status.attached == 1);
+        }
+    }
+
+    // jobs run on all the modems by the three workers, in order per modem
+    std::mutex results_lock;
+    std::map<std::string, std::vector<std::string>> results;
+    for (size_t i = 0; i < modems; ++i) {
+        for (auto query : { "imsi", "imei" }) {
+            CHECK(pool.post(ids[i], [&, i, query](DCE & dce) {
+                std::string out;
+                if (std::string(query) == "imsi") {
+                    dce.get_imsi(out);
+                } else {
+                    dce.get_imei(out);
+                }
+                std::lock_guard<std::mutex> l(results_lock);
+                results["sim" + std::to_string(i)].push_back(out);
+            }));
+        }
+    }
+    std::atomic<int> all{0};
+    pool.post_all([&all](DCE &) {
+        all++;
+    });
+    CHECK(wait_for(pool, [](const modem_pool_status & s) {
+        return s.pending == 0 && s.busy == 0;
+    }));
+    CHECK(all == modems + 1);
+    for (size_t i = 0; i < modems; ++i) {
+        auto &r = results["sim" + std::to_string(i)];
+        REQUIRE(r.size() == 2);
+        auto suffix = std::to_string(i);
+        CHECK(r[0].size() == 15);
+        CHECK(r[0].compare(15 - suffix.size(), suffix.size(), suffix) == 0);     // IMSI of the simulated modem
+        CHECK(r[1] != r[0]);
+    }
+
+    CHECK(pool.remove(bad) == true);
+    CHECK(pool.remove(bad) == false);
+    CHECK(pool.post(bad, [](DCE &) {}) == false);
+    auto summary = pool.get_summary();
+    CHECK(summary.modems == modems);
+    CHECK(summary.down == 0);
+}
+
+TEST_CASE("Modem pool job timeout", "[esp_modem][modem_sim]")
+{
+    modem_sim::config cfg;
+    cfg.latency = std::chrono::milliseconds(1);
+    modem_sim::Simulator sim(2, cfg);
+    esp_netif_t netif{};
+    modem_pool_config config;
+    config.workers = 1;
+    config.health_period_ms = 0;
+    config.job_timeout_ms = 20;
+    ModemPool pool(config);
+    std::vector<int> ids;
+    for (int i = 0; i < 2; ++i) {
+        esp_modem_dte_config_t dte_config = {
+            .dte_buffer_size = 1024,
+            .task_stack_size = 0,
+            .task_priority = 0,
+            .vfs_config = { .fd = sim.open(i), .deleter = [](int fd, esp_modem_vfs_resource *) { close(fd); }, .resource = nullptr }
+        };
+        esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+        ids.push_back(pool.add("sim" + std::to_string(i), create_SIM7600_dce(&dce_config, create_vfs_dte(&dte_config), &netif)));
+    }
+
+    // the slow job holds the only worker up to the timeout, so the other modem is served meanwhile
+    std::promise<void> release_slow;
+    std::promise<command_result> fast_done;
+    std::atomic<bool> slow_done{false};
+    CHECK(pool.post(ids[0], [&, released = release_slow.get_future().share()](DCE &) {
+        released.wait();
+        slow_done = true;
+    }));
+    CHECK(pool.post(ids[1], [&](DCE & dce) {
+        fast_done.set_value(dce.sync());
+    }));
+    auto fast = fast_done.get_future();
+    REQUIRE(fast.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    CHECK(fast.get() == command_result::OK);
+    auto status = pool.get_status();
+    CHECK(status[0].late == 1);
+    CHECK(status[1].late == 0);
+    // the worker marks the fast modem idle just after its job returns
+    for (int i = 0; i < 100 && pool.get_summary().busy > 1; ++i) {
+        usleep(1000);
+    }
+    CHECK(pool.get_summary().busy == 1);
+
+    // removing the busy modem waits for its job
+    auto removed = std::async(std::launch::async, [&] {
+        return pool.remove(ids[0]);
+    });
+    CHECK(removed.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    CHECK(pool.remove(ids[0]) == false);    // already being removed
+    release_slow.set_value();
+    CHECK(removed.get() == true);
+    CHECK(slow_done == true);
+    CHECK(pool.get_summary().modems == 1);
+}
+
+
 TEST_CASE("DCE commands", "[esp_modem]")
 {
     auto term = std::make_unique<LoopbackTerm>();
@@ -218,6 +1153,395 @@ TEST_CASE("DCE CMUX test", "[esp_modem]")
     CHECK(ret == command_result::OK);
 }
 
+TEST_CASE("DTE and CMUX statistics", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto dte = std::make_shared<DTE>(std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+    CHECK(dce->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    dte->reset_stats();
+
+    auto find = [](const dte_stats & s, const char *name) -> const esp_modem_command_stats * {
+        for (size_t i = 0; i < s.commands_num; ++i) {
+            if (strcmp(s.commands[i].name, name) == 0) {
+                return &s.commands[i];
+            }
+        }
+        return nullptr;
+    };
+    auto reply = [](command_result result) {
+        return [result](uint8_t *data, size_t len) {
+            return result;
+        };
+    };
+    CHECK(dte->command("AT+CSQ\r", reply(command_result::OK), 1000) == command_result::OK);
+    CHECK(dte->command("AT+CSQ\r", reply(command_result::OK), 1000) == command_result::OK);
+    CHECK(dte->command("AT+CGDCONT=1,\"IP\",\"APN\"\r", reply(command_result::FAIL), 1000) == command_result::FAIL);
+    CHECK(dte->command("AT+CPIN?\r", reply(command_result::TIMEOUT), 10) == command_result::TIMEOUT);
+    auto stats = dce->get_dte_stats();
+    CHECK(stats.command.tx_bytes == 7 + 7 + 24 + 9);
+    CHECK(stats.command.rx_bytes > 0);
+    auto csq = find(stats, "AT+CSQ");
+    REQUIRE(csq != nullptr);
+    CHECK(csq->count == 2);
+    CHECK(csq->failures == 0);
+    CHECK(csq->latency[0] + csq->latency[1] + csq->latency[2] + csq->latency[3] == 2);    // both within 8ms
+    auto cgdcont = find(stats, "AT+CGDCONT");
+    REQUIRE(cgdcont != nullptr);
+    CHECK(cgdcont->failures == 1);
+    auto cpin = find(stats, "AT+CPIN");
+    REQUIRE(cpin != nullptr);
+    CHECK(cpin->timeouts == 1);
+    CHECK(cpin->max_ms >= 10);
+    CHECK(cpin->latency[0] == 0);
+
+    // many distinct commands: the rest is counted as "other"
+    for (int i = 0; i < 20; ++i) {
+        CHECK(dte->command("AT+X" + std::to_string(i) + "\r", reply(command_result::OK), 1000) == command_result::OK);
+    }
+    stats = dte->get_stats();
+    CHECK(stats.commands_num == ESP_MODEM_STATS_COMMANDS_NUM);
+    REQUIRE(find(stats, "other") != nullptr);
+    CHECK(find(stats, "other")->count == 20 - (ESP_MODEM_STATS_COMMANDS_NUM - 4));
+
+    // CMUX traffic per DLCI and recoveries, kept after exiting CMUX mode
+    CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
+    CHECK(dte->command("AT+CSQ\r", reply(command_result::OK), 1000) == command_result::OK);
+    CHECK(dte->recover() == true);
+    CHECK(dce->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    auto cmux = dce->get_cmux_stats();
+    CHECK(cmux.channels[0].tx_frames >= 1);     // SABM of the control channel
+    CHECK(cmux.channels[1].tx_bytes >= 7);
+    CHECK(cmux.channels[1].tx_frames >= 2);     // SABM and the command
+    CHECK(cmux.channels[1].rx_bytes >= 7);
+    CHECK(cmux.channels[1].rx_frames >= 1);
+    CHECK(cmux.recoveries[static_cast<size_t>(protocol_mismatch_reason::UNKNOWN)] == 1);
+    CHECK(dte->get_stats().recoveries == 1);
+    CHECK(find(dte->get_stats(), "AT+CSQ")->count == 3);
+
+    dte->reset_stats();
+    CHECK(dte->get_stats().commands_num == 0);
+    CHECK(dte->get_cmux_stats().channels[1].tx_bytes == 0);
+}
+
+TEST_CASE("Signal group and lock primitives", "[esp_modem]")
+{
+    SignalGroup signal;
+    // waiting for all the bits clears them, waiting for any keeps them
+    signal.set(SignalGroup::bit0 | SignalGroup::bit1);
+    CHECK(signal.wait_any(SignalGroup::bit1, 0) == true);
+    CHECK(signal.wait(SignalGroup::bit0 | SignalGroup::bit1, 0) == true);
+    CHECK(signal.is_any(SignalGroup::bit0 | SignalGroup::bit1) == false);
+    CHECK(signal.wait(SignalGroup::bit0, 10) == false);
+
+    // a waiter is not released by other bits
+    auto waiter = std::async(std::launch::async, [&signal] {
+        return signal.wait(SignalGroup::bit2 | SignalGroup::bit3, 5000);
+    });
+    signal.set(SignalGroup::bit0);
+    signal.set(SignalGroup::bit2);
+    CHECK(waiter.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    signal.set(SignalGroup::bit3);
+    CHECK(waiter.get() == true);
+    CHECK(signal.is_any(SignalGroup::bit2 | SignalGroup::bit3) == false);
+    CHECK(signal.is_any(SignalGroup::bit0) == true);
+
+    // recursive lock keeps out other threads until fully unlocked
+    Lock lock;
+    int counter = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&lock, &counter] {
+            for (int j = 0; j < 10000; ++j) {
+                Scoped<Lock> l1(lock);
+                Scoped<Lock> l2(lock);
+                counter++;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    CHECK(counter == 40000);
+}
+
+TEST_CASE("Linux UART honours baud rate and flow control", "[esp_modem]")
+{
+    // pseudo terminal keeps the attributes as a serial device would
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    REQUIRE(master >= 0);
+    REQUIRE(grantpt(master) == 0);
+    REQUIRE(unlockpt(master) == 0);
+
+    esp_modem_dte_config_t dte_config = {};
+    struct esp_modem_vfs_uart_creator uart_config = {
+        .dev_name = ptsname(master),
+        .uart = {}
+    };
+    uart_config.uart.baud_rate = 3000000;
+    uart_config.uart.flow_control = ESP_MODEM_FLOW_CONTROL_HW;
+    REQUIRE(vfs_create_uart(&uart_config, &dte_config.vfs_config) == true);
+    struct termios2 tty = {};
+    REQUIRE(ioctl(dte_config.vfs_config.fd, TCGETS2, &tty) == 0);
+    CHECK(tty.c_ospeed == 3000000);
+    CHECK(tty.c_ispeed == 3000000);
+    CHECK((tty.c_cflag & CRTSCTS) != 0);
+    CHECK((tty.c_cflag & CSIZE) == CS8);
+    dte_config.vfs_config.deleter(dte_config.vfs_config.fd, dte_config.vfs_config.resource);
+
+    // defaults: 115200 without flow control
+    uart_config.uart = {};
+    REQUIRE(vfs_create_uart(&uart_config, &dte_config.vfs_config) == true);
+    REQUIRE(ioctl(dte_config.vfs_config.fd, TCGETS2, &tty) == 0);
+    CHECK(tty.c_ospeed == 115200);
+    CHECK((tty.c_cflag & CRTSCTS) == 0);
+    CHECK((tty.c_iflag & IXON) == 0);
+    dte_config.vfs_config.deleter(dte_config.vfs_config.fd, dte_config.vfs_config.resource);
+    close(master);
+}
+
+TEST_CASE("TUN packets are gathered and scattered", "[esp_modem]")
+{
+    // sequenced packets keep the boundaries, as the TUN device does
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) == 0);
+    const uint8_t ip4_header[TUN_HEADER_LEN] = { 0, 0, 0x08, 0 };
+    std::string first = "IPv4 packet ", second = "in three ", third = "buffers";
+    struct iovec out[] = { { first.data(), first.size() }, { second.data(), second.size() }, { third.data(), third.size() } };
+    CHECK(tun_write_packet(fds[0], ip4_header, out, 3) == 0);
+    CHECK(tun_write_packet(fds[0], ip4_header, out, 0) == 0);      // header only
+
+    uint8_t header[TUN_HEADER_LEN] = {};
+    char small[8], large[64] = {};
+    struct iovec in[] = { { small, sizeof(small) }, { large, sizeof(large) } };
+    auto len = tun_read_packet(fds[1], header, in, 2);
+    REQUIRE(len == static_cast<ssize_t>(first.size() + second.size() + third.size()));
+    CHECK(memcmp(header, ip4_header, TUN_HEADER_LEN) == 0);
+    CHECK(std::string(small, sizeof(small)) + std::string(large, len - sizeof(small)) == first + second + third);
+    CHECK(tun_read_packet(fds[1], header, in, 2) == 0);             // too short
+    CHECK(tun_read_packet(fds[1], header, in, 2) == -1);            // nothing pending
+    CHECK(errno == EAGAIN);
+    CHECK(tun_write_packet(fds[0], ip4_header, out, TUN_MAX_IOV) == -1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("CMUX sends a packet in one terminal write", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto loopback = term.get();
+    auto dte = std::make_shared<DTE>(std::move(term));
+    CHECK(term == nullptr);
+
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+
+    CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
+    // command longer than a short CMUX frame (127 bytes) needs to be split into more frames
+    std::string long_command(300, 'A');
+    long_command.back() = '\n';
+    auto writes_before = loopback->write_count();
+    auto ret = dce->command(long_command, [&](uint8_t *data, size_t len) {
+        return data[len - 1] == '\n' ? command_result::OK : command_result::TIMEOUT;
+    }, 1000);
+    CHECK(ret == command_result::OK);
+    CHECK(loopback->write_count() - writes_before == 1);
+}
+
+TEST_CASE("CMUX long frames with configured N1", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto loopback = term.get();
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 2048,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {},
+        .cmux_config = { .max_frame_size = 1509 }
+    };
+    auto dte = std::make_shared<DTE>(&dte_config, std::move(term));
+    CHECK(term == nullptr);
+
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+
+    CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
+    // the whole command fits into one long frame (2-byte length), so we receive it back in one piece
+    std::string long_command(1000, 'A');
+    long_command.back() = '\n';
+    auto writes_before = loopback->write_count();
+    auto ret = dce->command(long_command, [&](uint8_t *data, size_t len) {
+        std::string response((char *) data, len);
+        CHECK(response == long_command);
+        return command_result::OK;
+    }, 1000);
+    CHECK(ret == command_result::OK);
+    CHECK(loopback->write_count() - writes_before == 1);
+}
+
+TEST_CASE("CMUX negotiates frame size with the device", "[esp_modem]")
+{
+    auto term = std::make_shared<LoopbackTerm>();
+    esp_modem_cmux_config config = { .max_frame_size = 1509, .negotiate_params = true };
+    auto cmux = std::make_shared<CMux>(term, unique_buffer(2048), &config);
+    CHECK(cmux->init() == true);
+    // our loopback device supports frames up to 512 bytes
+    for (int i = 0; i < cmux->terminals_num(); ++i) {
+        auto params = cmux->get_params(i);
+        CHECK(params.frame_size == 512);
+        CHECK(params.priority == 7);
+    }
+    // so the command is sent (and echoed back) in two frames
+    std::string received;
+    cmux->set_read_cb(0, [&](uint8_t *data, size_t len) {
+        received.append((char *) data, len);
+        return false;
+    });
+    std::string long_command(1000, 'A');
+    auto writes_before = term->write_count();
+    CHECK(cmux->write(0, (uint8_t *) long_command.data(), long_command.size()) == 1000);
+    for (int timeout = 0; received.size() < long_command.size() && timeout < 100; ++timeout) {
+        usleep(10'000);
+    }
+    CHECK(received == long_command);
+    CHECK(term->write_count() - writes_before == 1);
+    CHECK(cmux->deinit() == true);
+}
+
+TEST_CASE("CMUX with more virtual terminals", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 512,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {},
+        .cmux_config = { .terminals_num = 3 }
+    };
+    auto dte = std::make_shared<DTE>(&dte_config, std::move(term));
+    CHECK(dte->open_cmux_terminal(2) == nullptr);   // not in CMUX mode
+
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+    CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
+    CHECK(dte->open_cmux_terminal(1) == nullptr);   // used by DTE
+    CHECK(dte->open_cmux_terminal(3) == nullptr);   // not configured
+    auto extra = dte->open_cmux_terminal(2);
+    REQUIRE(extra != nullptr);
+
+    // the extra terminal works independently of the command terminal
+    SignalGroup signal;
+    std::string received;
+    extra->set_read_cb([&](uint8_t *data, size_t len) {
+        received.assign((char *) data, len);
+        signal.set(1);
+        return false;
+    });
+    std::string gnss_command = "AT+CGNSINF\r";
+    CHECK(extra->write((uint8_t *) gnss_command.data(), gnss_command.size()) == gnss_command.size());
+    CHECK(signal.wait(1, 1000) == true);
+    CHECK(received.find("OK") == 0);
+    CHECK(dce->set_echo(false) == command_result::OK);
+    CHECK(dce->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+}
+
+TEST_CASE("CMUX flow control", "[esp_modem]")
+{
+    auto term = std::make_unique<LoopbackTerm>();
+    auto dte = std::make_shared<DTE>(std::move(term));
+    CHECK(dte->set_cmux_flow(false) == false);  // not in CMUX mode
+
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce != nullptr);
+    CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
+
+    // Our loopback device mirrors the flow-off, so it stops us from sending
+    CHECK(dte->set_cmux_flow(false) == true);
+    usleep(10'000);
+    auto ret = std::async(std::launch::async, [&] {
+        return dce->command("AT\r", [&](uint8_t *data, size_t len) {
+            return command_result::OK;
+        }, 5000);
+    });
+    CHECK(ret.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+    // until we enable the flow again (the blocked command is sent and answered)
+    CHECK(dte->set_cmux_flow(true) == true);
+    CHECK(ret.get() == command_result::OK);
+}
+
+TEST_CASE("CMUX flow is stopped while the streamed reply is not consumed", "[esp_modem]")
+{
+    esp_modem_dte_config_t dte_config = {
+        .dte_buffer_size = 512,
+        .task_stack_size = 0,
+        .task_priority = 0,
+        .vfs_config = {},
+        .cmux_config = {},
+        .reply_buffer_size = 0
+    };
+    auto term = std::make_unique<LoopbackTerm>();
+    auto loopback = term.get();
+    auto dte = std::make_shared<DTE>(&dte_config, std::move(term));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
+
+    auto control_frames = [&dte]() {
+        return dte->get_cmux_stats().channels[0].tx_frames;
+    };
+    auto until_ok = [](uint8_t *data, size_t len) {
+        std::string_view reply((char *)data, len);
+        return reply.find("\r\nOK\r\n") != std::string_view::npos ? command_result::OK : command_result::TIMEOUT;
+    };
+    // the device stops on flow-off and the replies come in more frames
+    loopback->set_honour_flow(true);
+    loopback->set_fragment_size(64);
+    loopback->set_reply_frame_size(64);
+    // replies processed once complete don't stop the flow, even above the watermark
+    auto frames = control_frames();
+    CHECK(dce->command("AT+READBIN=450\r", until_ok, 1000) == command_result::OK);
+    CHECK(control_frames() == frames);
+    // replies which don't fit in the ring fail without waiting for the timeout
+    auto start = std::chrono::steady_clock::now();
+    CHECK(dce->command("AT+READBIN=600\r", until_ok, 5000) == command_result::FAIL);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+    CHECK(control_frames() == frames);
+    CHECK(dce->command("AT+READBIN=10\r", until_ok, 1000) == command_result::OK);
+
+    // streamed reply kept by the callback above the watermark: FCoff, and FCon once the reply has been processed
+    // (our loopback keeps sending, as if the rest were in flight, and mirrors the flow commands, which we acknowledge)
+    loopback->set_honour_flow(false);
+    frames = control_frames();
+    const std::string read = "AT+READBIN=450\r";
+    auto keep_until_ok = [](uint8_t *data, size_t len, stream_state & state) {
+        std::string_view reply((char *)data, len);
+        if (reply.find("\r\nOK\r\n") != std::string_view::npos) {
+            return command_result::OK;
+        }
+        state.consumed = 0;
+        return command_result::TIMEOUT;
+    };
+    CHECK(dte->stream_command(read.c_str(), read.size(), keep_until_ok, 1000) == command_result::OK);
+    for (int i = 0; i < 100 && control_frames() < frames + 4; ++i) {
+        usleep(1000);
+    }
+    CHECK(control_frames() == frames + 4);
+    CHECK(dce->command("AT+READBIN=10\r", until_ok, 1000) == command_result::OK);
+    CHECK(dce->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+}
+
 TEST_CASE("Test CMUX protocol by injecting payloads", "[esp_modem]")
 {
     auto term = std::make_unique<LoopbackTerm>();
@@ -233,7 +1557,7 @@ TEST_CASE("Test CMUX protocol by injecting payloads", "[esp_modem]")
     CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
     const auto test_command = "Test\n";
     // 1 byte payload size
-    uint8_t test_payload[] = {0xf9, 0x09, 0xff, 0x0b, 0x54, 0x65, 0x73, 0x74, 0x0a, 0xbb, 0xf9 };
+    uint8_t test_payload[] = {0xf9, 0x09, 0xff, 0x0b, 0x54, 0x65, 0x73, 0x74, 0x0a, 0x29, 0xf9 };
     loopback->inject(&test_payload[0], sizeof(test_payload), 1);
     auto ret = dce->command(test_command, [&](uint8_t *data, size_t len) {
         std::string response((char *) data, len);
@@ -247,7 +1571,7 @@ TEST_CASE("Test CMUX protocol by injecting payloads", "[esp_modem]")
     long_payload[5]   = 0x7e;   // payload to validate
     long_payload[449] = 0x7e;
     long_payload[450] = '\n';
-    long_payload[451] = 0x53;   // footer
+    long_payload[451] = 0xc6;   // footer (FCS over the 2-byte length, too)
     long_payload[452] = 0xf9;
     for (int i = 0; i < 5; ++i) {
         // inject the whole payload (i=0) and then per 1,2,3,4 bytes (i)
@@ -262,6 +1586,64 @@ TEST_CASE("Test CMUX protocol by injecting payloads", "[esp_modem]")
     }
 }
 
+TEST_CASE("CMUX FCS and UI frames", "[esp_modem]")
+{
+    uint8_t sabm[] = { 0x03, 0x3f, 0x01 };
+    CHECK(0xFF - CMux::fcs_crc(sabm, sizeof(sabm)) == 0x1c);
+    uint8_t data[256];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = i * 7;
+    }
+    CHECK(CMux::fcs_crc(data, sizeof(data)) == fcs_crc_bitwise(data, sizeof(data)));
+    // continue calculation over more chunks
+    CHECK(CMux::fcs_crc(data + 100, 156, CMux::fcs_crc(data, 100)) == fcs_crc_bitwise(data, sizeof(data)));
+
+    auto term = std::make_shared<CMuxCodecTerm>();
+    esp_modem_cmux_config config = { .max_frame_size = 127, .negotiate_params = false, .ui_frames = true };
+    auto cmux = std::make_shared<CMux>(term, unique_buffer(1024), &config);
+    CHECK(cmux->init() == true);
+    std::string command = "AT+CSQ\r";
+    CHECK(cmux->write(0, (uint8_t *)command.data(), command.size()) == command.size());
+    // UI frame with FCS over the header and the payload
+    auto &frame = term->written;
+    REQUIRE(frame.size() == command.size() + 6);
+    CHECK(frame[2] == 0x03);
+    CHECK(frame[frame.size() - 2] == 0xFF - fcs_crc_bitwise(&frame[1], frame.size() - 3));
+    // and decode it back
+    std::string received;
+    cmux->set_read_cb(0, [&](uint8_t *data, size_t len) {
+        received.append((char *) data, len);
+        return false;
+    });
+    term->feed(frame.data(), frame.size());
+    CHECK(received == command);
+
+    // corrupted UI frame is dropped (FCS covers the payload)
+    received.clear();
+    auto corrupted = frame;
+    corrupted[4] ^= 0x20;
+    term->feed(corrupted.data(), corrupted.size());
+    CHECK(received.empty());
+    CHECK(cmux->get_stats().fcs_errors == 1);
+    // and the following frames are received again
+    term->feed(frame.data(), frame.size());
+    CHECK(received == command);
+
+    // long UIH frame (2-byte length) with a wrong FCS is dropped, too
+    received.clear();
+    std::vector<uint8_t> long_frame = { 0xf9, 0x07, 0xef, (200 & 0x7f) << 1, 200 >> 7 };
+    long_frame.insert(long_frame.end(), 200, 'x');
+    long_frame.push_back(0xFF - CMux::fcs_crc(&long_frame[1], 4));
+    long_frame.push_back(0xf9);
+    term->feed(long_frame.data(), long_frame.size());
+    CHECK(received.size() == 200);
+    received.clear();
+    long_frame[long_frame.size() - 2] ^= 0x01;
+    term->feed(long_frame.data(), long_frame.size());
+    CHECK(received.empty());
+    CHECK(cmux->get_stats().fcs_errors == 2);
+}
+
 TEST_CASE("Command and Data mode transitions", "[esp_modem][transitions]")
 {
     auto term = std::make_unique<LoopbackTerm>();
@@ -346,3 +1728,58 @@ TEST_CASE("CMUX manual mode transitions", "[esp_modem][transitions]")
     CHECK(dce->set_mode(esp_modem::modem_mode::UNDEF) == true);             // Succeeds from any state
 
 }
+
+TEST_CASE("CMUX codec benchmark", "[.][benchmark]")
+{
+    using clock = std::chrono::steady_clock;
+    constexpr int iterations = 100'000;
+    auto frames_per_sec = [](int frames, clock::duration elapsed) {
+        return frames / std::chrono::duration<double>(elapsed).count();
+    };
+    uint8_t frame[3 + 127];     // header and payload of a short frame
+    for (size_t i = 0; i < sizeof(frame); ++i) {
+        frame[i] = i;
+    }
+    volatile uint8_t sink = 0;
+    for (size_t fcs_len : { size_t(3), sizeof(frame) }) {   // UIH (header only) and UI (entire frame)
+        auto start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            sink = sink + fcs_crc_bitwise(frame, fcs_len);
+        }
+        auto bitwise = clock::now() - start;
+        start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            sink = sink + CMux::fcs_crc(frame, fcs_len);
+        }
+        auto table = clock::now() - start;
+        printf("FCS over %zu bytes: bitwise %.0f frames/s, table %.0f frames/s\n", fcs_len,
+               frames_per_sec(iterations, bitwise), frames_per_sec(iterations, table));
+    }
+
+    // encode and decode of entire frames
+    for (bool ui : { false, true }) {
+        auto term = std::make_shared<CMuxCodecTerm>();
+        esp_modem_cmux_config config = { .max_frame_size = 127, .negotiate_params = false, .ui_frames = ui };
+        auto cmux = std::make_shared<CMux>(term, unique_buffer(1024), &config);
+        REQUIRE(cmux->init() == true);
+        int decoded = 0;
+        cmux->set_read_cb(0, [&](uint8_t *data, size_t len) {
+            decoded++;
+            return false;
+        });
+        auto start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            cmux->write(0, frame, 127);
+        }
+        auto encode = clock::now() - start;
+        auto encoded = term->written;
+        start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            term->feed(encoded.data(), encoded.size());
+        }
+        auto decode = clock::now() - start;
+        CHECK(decoded == iterations);
+        printf("%s frames: encode %.0f frames/s, decode %.0f frames/s\n", ui ? "UI" : "UIH",
+               frames_per_sec(iterations, encode), frames_per_sec(iterations, decode));
+    }
+}
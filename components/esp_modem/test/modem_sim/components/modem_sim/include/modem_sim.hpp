@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Simulated modems on pseudo terminals, to test DTE/DCE (and applications) against many devices on host
+ *
+ * Each modem is exposed as a pty, which could be opened by the UART or VFS terminal of esp_modem.
+ * The modems reply to the AT commands of the esp_modem command library (in command mode and on CMUX
+ * virtual terminals), support CMUX framing with any number of DLCIs, and bridge PPP sessions to a peer.
+ * All modems are served by one thread, with configurable latency and error injection.
+ */
+namespace modem_sim {
+
+/**
+ * @brief Peer of PPP sessions (started by ATD*99#)
+ */
+enum class ppp_peer {
+    RAW_ECHO,       /*!< Echoes the data back (raw data throughput, no PPP negotiation) */
+    LOOPBACK,       /*!< Built-in minimal PPP peer: negotiates LCP/IPCP, answers pings and echoes UDP datagrams */
+    PPPD,           /*!< Spawns pppd on a pty per session (usually needs root) */
+};
+
+struct config {
+    std::string model = "SIM7600";                  /*!< Module name (AT+CGMM), selects the format of model specific replies */
+    std::string pin;                                /*!< SIM PIN, empty if the SIM is not locked */
+    bool echo = false;                              /*!< Initial echo of commands (ATE) */
+    size_t max_frame_size = 127;                    /*!< Maximum CMUX frame size (N1) accepted in DLC parameter negotiation */
+    ppp_peer peer = ppp_peer::LOOPBACK;             /*!< Peer of PPP sessions */
+    std::string subnet = "192.168.11";              /*!< PPP addresses: the peer is .1, modem i gets .(2 + i) */
+    std::string pppd_path = "/usr/sbin/pppd";       /*!< pppd executable (ppp_peer::PPPD) */
+    std::vector<std::string> pppd_options = { "115200", "nodetach", "local", "noauth", "nocrtscts" };
+    std::chrono::milliseconds latency{0};           /*!< Delay of all writes to the DTE */
+    std::chrono::milliseconds jitter{0};            /*!< Random delay (up to) added to the latency */
+    size_t fragment_size = 0;                       /*!< Writes in fragments of this size, 0 to write them at once */
+    double error_rate = 0;                          /*!< Probability of replying ERROR to a command */
+    double drop_rate = 0;                           /*!< Probability of not replying to a command at all */
+    double corrupt_rate = 0;                        /*!< Probability of corrupting one byte of a write (replies, CMUX frames, PPP data) */
+    std::chrono::milliseconds urc_period{0};        /*!< Period of unsolicited +CREG reports, 0 to disable */
+    uint32_t seed = 1;                              /*!< Seed of the random generator (injection and jitter) */
+};
+
+/**
+ * @brief Counters of a simulated modem
+ */
+struct stats {
+    uint64_t commands;          /*!< AT commands received */
+    uint64_t errors;            /*!< Commands answered with injected ERROR */
+    uint64_t drops;             /*!< Commands not answered (injected) */
+    uint64_t corruptions;       /*!< Writes with an injected corrupted byte */
+    uint64_t frames;            /*!< Valid CMUX frames received */
+    uint64_t bad_frames;        /*!< CMUX frames dropped due to wrong FCS or framing */
+    uint64_t sessions;          /*!< PPP sessions started */
+    uint64_t bytes_rx;          /*!< Bytes written by the DTE */
+    uint64_t bytes_tx;          /*!< Bytes written to the DTE */
+};
+
+class Simulator {
+public:
+    /**
+     * @brief Creates the modems and starts serving them
+     * @throws std::runtime_error if the pseudo terminals cannot be created
+     */
+    Simulator(size_t count, const config &cfg);
+    ~Simulator();
+
+    Simulator(const Simulator &) = delete;
+    Simulator &operator=(const Simulator &) = delete;
+
+    size_t size() const;
+
+    /**
+     * @brief Path of the modem's device (pty slave), to be opened by the DTE
+     */
+    const std::string &device(size_t i) const;
+
+    /**
+     * @brief Opens the modem's device (for VFS terminals)
+     * @return File descriptor, or -1 on failure
+     */
+    int open(size_t i) const;
+
+    stats get_stats(size_t i) const;
+
+private:
+    struct modem;
+    void run();
+
+    config cfg;
+    std::vector<std::unique_ptr<modem>> modems;
+    int wake[2];
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+} // namespace modem_sim
@@ -0,0 +1,234 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <deque>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "modem_sim_device.hpp"
+
+namespace modem_sim {
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr auto max_poll_period = std::chrono::milliseconds(100);    /*!< Checks the pppd processes */
+
+struct Simulator::modem {
+    int master = -1;
+    int slave = -1;             /*!< Kept open, so the master doesn't hang up while the DTE isn't connected */
+    std::string path;
+    std::mt19937 rng;
+    counters cnt;
+    std::unique_ptr<Device> device;
+    std::deque<std::pair<clock_type::time_point, std::string>> out;   /*!< Writes to the DTE, in order of their due time */
+    clock_type::time_point last_due;
+    clock_type::time_point next_urc;
+
+    ~modem()
+    {
+        device.reset();
+        if (slave >= 0) {
+            close(slave);
+        }
+        if (master >= 0) {
+            close(master);
+        }
+    }
+
+    /**
+     * @brief Queues a write to the DTE, applying the latency, jitter, corruption and fragmentation
+     */
+    void schedule(const config &cfg, std::string data, std::chrono::milliseconds delay)
+    {
+        if (data.empty()) {
+            return;
+        }
+        auto due = clock_type::now() + cfg.latency + delay;
+        if (cfg.jitter.count() > 0) {
+            due += std::chrono::milliseconds(rng() % (cfg.jitter.count() + 1));
+        }
+        due = std::max(due, last_due);  // keep the order of the writes
+        last_due = due;
+        if (cfg.corrupt_rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < cfg.corrupt_rate) {
+            data[rng() % data.size()] ^= 1 << (rng() % 8);
+            cnt.corruptions++;
+        }
+        if (cfg.fragment_size == 0 || data.size() <= cfg.fragment_size) {
+            out.emplace_back(due, std::move(data));
+            return;
+        }
+        for (size_t pos = 0; pos < data.size(); pos += cfg.fragment_size) {
+            out.emplace_back(due, data.substr(pos, cfg.fragment_size));
+        }
+    }
+
+    /**
+     * @brief Writes the due data, as long as the pty accepts them
+     */
+    void flush(clock_type::time_point now)
+    {
+        while (!out.empty() && out.front().first <= now) {
+            auto &data = out.front().second;
+            auto len = ::write(master, data.data(), data.size());
+            if (len < 0) {
+                return;     // EAGAIN: the DTE doesn't read, poll for POLLOUT
+            }
+            cnt.bytes_tx += len;
+            if (static_cast<size_t>(len) < data.size()) {
+                data.erase(0, len);
+                return;
+            }
+            out.pop_front();
+        }
+    }
+};
+
+Simulator::Simulator(size_t count, const config &cfg): cfg(cfg), wake{-1, -1}
+{
+    if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+        throw std::runtime_error("modem_sim: cannot create the wake-up pipe");
+    }
+    auto now = clock_type::now();
+    for (size_t i = 0; i < count; ++i) {
+        auto m = std::make_unique<modem>();
+        m->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (m->master < 0 || grantpt(m->master) != 0 || unlockpt(m->master) != 0) {
+            throw std::runtime_error("modem_sim: cannot open a pseudo terminal");
+        }
+        m->path = ptsname(m->master);
+        m->slave = ::open(m->path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (m->slave < 0) {
+            throw std::runtime_error("modem_sim: cannot open " + m->path);
+        }
+        termios tio{};
+        tcgetattr(m->slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(m->slave, TCSANOW, &tio);
+        fcntl(m->master, F_SETFL, fcntl(m->master, F_GETFL) | O_NONBLOCK);
+        m->rng.seed(cfg.seed + i);
+        m->next_urc = now + cfg.urc_period;
+        auto *raw = m.get();
+        m->device = std::make_unique<Device>(this->cfg, i, m->rng, m->cnt, [this, raw](std::string data, std::chrono::milliseconds delay) {
+            raw->schedule(this->cfg, std::move(data), delay);
+        });
+        modems.push_back(std::move(m));
+    }
+    thread = std::thread([this] {
+        run();
+    });
+}
+
+Simulator::~Simulator()
+{
+    stopping = true;
+    if (::write(wake[1], "x", 1) < 0) {
+        // the thread still wakes up on its poll period
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+    modems.clear();
+    close(wake[0]);
+    close(wake[1]);
+}
+
+size_t Simulator::size() const
+{
+    return modems.size();
+}
+
+const std::string &Simulator::device(size_t i) const
+{
+    return modems.at(i)->path;
+}
+
+int Simulator::open(size_t i) const
+{
+    return ::open(device(i).c_str(), O_RDWR | O_NOCTTY);
+}
+
+stats Simulator::get_stats(size_t i) const
+{
+    auto &c = modems.at(i)->cnt;
+    return { c.commands, c.errors, c.drops, c.corruptions, c.frames, c.bad_frames, c.sessions, c.bytes_rx, c.bytes_tx };
+}
+
+void Simulator::run()
+{
+    std::vector<pollfd> fds;
+    std::vector<std::pair<modem *, size_t>> peers;     // polled peers: modem and channel
+    uint8_t buffer[4096];
+    while (!stopping) {
+        auto now = clock_type::now();
+        auto next = now + max_poll_period;
+        fds.clear();
+        peers.clear();
+        fds.push_back({ wake[0], POLLIN, 0 });
+        for (auto &m : modems) {
+            short events = POLLIN;
+            if (!m->out.empty()) {
+                if (m->out.front().first <= now) {
+                    events |= POLLOUT;
+                } else {
+                    next = std::min(next, m->out.front().first);
+                }
+            }
+            if (cfg.urc_period.count() > 0) {
+                next = std::min(next, m->next_urc);
+            }
+            fds.push_back({ m->master, events, 0 });
+        }
+        for (auto &m : modems) {
+            for (size_t ch = 0; ch < Device::max_channels; ++ch) {
+                auto *peer = m->device->peer(ch);
+                if (peer && peer->fd() >= 0) {
+                    fds.push_back({ peer->fd(), POLLIN, 0 });
+                    peers.emplace_back(m.get(), ch);
+                }
+            }
+        }
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+        if (poll(fds.data(), fds.size(), std::max<long>(timeout, 0)) < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            while (::read(wake[0], buffer, sizeof(buffer)) > 0) {
+            }
+        }
+        now = clock_type::now();
+        for (size_t i = 0; i < modems.size(); ++i) {
+            auto &m = *modems[i];
+            if (fds[i + 1].revents & POLLIN) {
+                auto len = ::read(m.master, buffer, sizeof(buffer));
+                if (len > 0) {
+                    m.device->feed(buffer, len);
+                }
+            }
+            if (cfg.urc_period.count() > 0 && m.next_urc <= now) {
+                m.next_urc = now + cfg.urc_period;
+                m.device->unsolicited("+CREG: 1");
+            }
+        }
+        // peers could be removed while feeding the data (or while polling the other peers)
+        for (size_t i = 0; i < peers.size(); ++i) {
+            auto [m, ch] = peers[i];
+            auto *peer = m->device->peer(ch);
+            if (peer && peer->fd() == fds[modems.size() + 1 + i].fd &&
+                    !peer->poll(fds[modems.size() + 1 + i].revents & POLLIN)) {
+                m->device->hangup(ch);
+            }
+        }
+        for (auto &m : modems) {
+            m->flush(now);
+        }
+    }
+}
+
+} // namespace modem_sim
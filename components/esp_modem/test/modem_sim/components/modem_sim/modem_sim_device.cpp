@@ -0,0 +1,616 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+#include "modem_sim_device.hpp"
+
+namespace modem_sim {
+
+/* CMUX (3GPP TS 27.010) framing, see also esp_modem_cmux.cpp */
+#define EA 0x01  /* Extension bit      */
+#define CR 0x02  /* Command / Response */
+#define PF 0x10  /* Poll / Final       */
+
+#define FT_DM      0x0F  /* Disconnected Mode                        */
+#define FT_SABM    0x2F  /* Set Asynchronous Balanced Mode           */
+#define FT_DISC    0x43  /* Disconnect                               */
+#define FT_UA      0x63  /* Unnumbered Acknowledgement               */
+#define FT_UI      0x03  /* Unnumbered Information                   */
+#define FT_UIH     0xEF  /* Unnumbered Information with Header check */
+
+#define CMD_NSC    0x08  /* Non Supported Command Response           */
+#define CMD_TEST   0x10  /* Test Command                             */
+#define CMD_FCOFF  0x30  /* Flow Control Off Command                 */
+#define CMD_PN     0x40  /* DLC parameter negotiation                */
+#define CMD_FCON   0x50  /* Flow Control On Command                  */
+#define CMD_CLD    0x60  /* Multiplexer close down                   */
+#define CMD_MSC    0x70  /* Modem Status Command                     */
+
+#define MSC_FC     0x02  /* Flow Control                             */
+#define MSC_RTC    0x04  /* Ready To Communicate                     */
+#define MSC_RTR    0x08  /* Ready To Receive                         */
+
+#define SOF_MARKER 0xF9
+
+static constexpr size_t max_line = 1024;
+static constexpr size_t max_backlog = 64 * 1024;
+static constexpr size_t max_payload = 0x7FFF;
+
+static uint8_t fcs_crc(const uint8_t *data, size_t len, uint8_t crc = 0xFF)
+{
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xe0 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static std::string to_upper(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+        return std::toupper(c);
+    });
+    return s;
+}
+
+static uint32_t ipv4(const std::string &address)
+{
+    in_addr addr{};
+    inet_pton(AF_INET, address.c_str(), &addr);
+    return ntohl(addr.s_addr);
+}
+
+/**
+ * @brief Values of the commands, which are simply stored (AT+X=value) and reported (AT+X? -> +X: value)
+ */
+static std::map<std::string, std::string> default_settings()
+{
+    return {
+        { "CFUN", "1" }, { "CGATT", "1" }, { "CMGF", "0" }, { "CSCS", "\"IRA\"" }, { "CMEE", "0" },
+        { "CNMP", "2" }, { "CMNB", "1" }, { "CBANDCFG", "\"CAT-M\",1" }, { "CNBP", "0x0000000000000000" },
+        { "CNSMOD", "0,8" }, { "CGNSPWR", "0" }, { "CGPS", "0" },
+        { "CREG", "0,1" }, { "CGREG", "0,1" }, { "CEREG", "0,1" }, { "IPR", "115200" }, { "IFC", "0,0" },
+        { "COPS", "0,0,\"Simulated\",7" }, { "CGDCONT", "1,\"IP\",\"internet\"" },
+    };
+}
+
+Device::Device(const config &cfg, size_t index, std::mt19937 &rng, counters &cnt, sender send):
+    cfg(cfg), index(index), rng(rng), cnt(cnt), send(std::move(send)),
+    echo(cfg.echo), pin_ok(cfg.pin.empty()), settings(default_settings())
+{
+    channels[0].open = true;
+}
+
+bool Device::chance(double rate)
+{
+    return rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < rate;
+}
+
+void Device::feed(const uint8_t *data, size_t len)
+{
+    cnt.bytes_rx += len;
+    if (!cmux) {
+        input(0, data, len);
+        return;
+    }
+    rx.insert(rx.end(), data, data + len);
+    parse_frames();
+}
+
+void Device::input(size_t ch, const uint8_t *data, size_t len)
+{
+    auto &c = channels[ch];
+    for (size_t i = 0; i < len;) {
+        if (c.data) {
+            // escape sequence received on its own (the guard time is not simulated)
+            if (len - i == 3 && memcmp(data + i, "+++", 3) == 0) {
+                c.data = false;
+                reply(ch, "\r\nOK\r\n");
+            } else if (c.peer && !c.peer->write(data + i, len - i)) {
+                hangup(ch);
+            }
+            return;
+        }
+        char b = data[i++];
+        if (c.sms) {
+            if (b == 0x1A) {            // Ctrl-Z sends the message
+                c.sms = false;
+                reply(ch, "\r\n+CMGS: " + std::to_string(++sms_ref) + "\r\n\r\nOK\r\n");
+            } else if (b == 0x1B) {     // ESC cancels it
+                c.sms = false;
+                reply(ch, "\r\nOK\r\n");
+            }
+            continue;
+        }
+        if (b == '\r') {
+            std::string line;
+            line.swap(c.line);
+            command(ch, line);
+        } else if (b != '\n' && c.line.size() < max_line) {
+            c.line.push_back(b);
+        }
+    }
+    if (c.line == "+++") {              // escape sequence in command mode
+        c.line.clear();
+        reply(ch, "\r\nNO CARRIER\r\n");
+    }
+}
+
+void Device::command(size_t ch, const std::string &line)
+{
+    if (echo) {
+        reply(ch, line + "\r");
+    }
+    if (to_upper(line.substr(0, 2)) != "AT") {
+        if (!line.empty()) {
+            reply(ch, "\r\nERROR\r\n");
+        }
+        return;
+    }
+    cnt.commands++;
+    if (chance(cfg.drop_rate)) {
+        cnt.drops++;
+        return;
+    }
+    if (chance(cfg.error_rate)) {
+        cnt.errors++;
+        reply(ch, "\r\nERROR\r\n");
+        return;
+    }
+    // concatenated commands (AT+CSQ;+CGATT?;+COPS?) reply with all the information and one final result
+    std::string info;
+    auto ret = result::OK;
+    bool quoted = false;
+    for (size_t i = 2, start = 2; i <= line.size() && ret == result::OK; ++i) {
+        if (i < line.size() && line[i] == '"') {
+            quoted = !quoted;
+        } else if (i == line.size() || (line[i] == ';' && !quoted)) {
+            ret = execute(ch, line.substr(start, i - start), info);
+            start = i + 1;
+        }
+    }
+    if (ret == result::OK) {
+        reply(ch, info + "\r\nOK\r\n");
+    } else if (ret == result::ERROR) {
+        reply(ch, "\r\nERROR\r\n");
+    }
+}
+
+Device::result Device::execute(size_t ch, const std::string &cmd, std::string &info)
+{
+    auto upper = to_upper(cmd);
+    if (upper.empty() || upper == "&W" || upper == "&F" || upper == "S0=0") {
+        return result::OK;
+    }
+    if (upper[0] == '+') {
+        auto end = upper.find_first_of("=?");
+        auto name = upper.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+        std::string op, arg;
+        if (end != std::string::npos) {
+            op = upper.compare(end, 2, "=?") == 0 ? "=?" : upper.substr(end, 1);
+            if (op == "=") {
+                arg = cmd.substr(end + 1);
+            }
+        }
+        return extended(ch, name, op, arg, info);
+    }
+    if (upper == "E0" || upper == "E1") {
+        echo = upper == "E1";
+        return result::OK;
+    }
+    if (upper == "Z") {
+        echo = cfg.echo;
+        return result::OK;
+    }
+    if (upper == "I") {
+        info += "\r\n" + cfg.model + "\r\n";
+        return result::OK;
+    }
+    if (upper == "H" || upper == "H0") {    // hangs up the suspended sessions
+        for (size_t i = 0; i < max_channels; ++i) {
+            if (!channels[i].data) {
+                end_session(i);
+            }
+        }
+        return result::OK;
+    }
+    if (upper == "O") {                     // resumes the suspended session
+        if (channels[ch].peer) {
+            channels[ch].data = true;
+            reply(ch, "\r\nCONNECT 150000000\r\n");
+        } else {
+            reply(ch, "\r\nNO CARRIER\r\n");
+        }
+        return result::NONE;
+    }
+    if (upper[0] == 'D') {
+        if (upper.find("*99") == std::string::npos) {
+            return result::OK;              // voice call
+        }
+        reply(ch, start_session(ch) ? "\r\nCONNECT 150000000\r\n" : "\r\nNO CARRIER\r\n");
+        return result::NONE;
+    }
+    return result::ERROR;
+}
+
+Device::result Device::extended(size_t ch, const std::string &name, const std::string &op, const std::string &arg, std::string &info)
+{
+    char number[32];
+    if (op == "=?") {
+        return result::OK;
+    }
+    if (op.empty()) {
+        if (name == "CSQ") {
+            info += "\r\n+CSQ: " + std::to_string(15 + rng() % 10) + ",99\r\n";
+        } else if (name == "CBC") {
+            info += cfg.model.compare(0, 4, "SIM7") == 0 ? "\r\n+CBC: 3.800V\r\n" : "\r\n+CBC: 0,80,3800\r\n";
+        } else if (name == "CGMM") {
+            info += "\r\n" + cfg.model + "\r\n";
+        } else if (name == "CGMR") {
+            info += "\r\nMODEM_SIM_1.0\r\n";
+        } else if (name == "CGSN") {
+            snprintf(number, sizeof(number), "35%013zu", index);
+            info += std::string("\r\n") + number + "\r\n";
+        } else if (name == "CIMI") {
+            snprintf(number, sizeof(number), "00101%010zu", index);
+            info += std::string("\r\n") + number + "\r\n";
+        } else if (name == "CPOF") {
+            return result::OK;
+        } else if (name == "CRESET") {
+            reply(ch, "\r\nOK\r\n");
+            reset();
+            reply(0, "\r\nRDY\r\n\r\n+CPIN: READY\r\n\r\nSMS DONE\r\n\r\nPB DONE\r\n", std::chrono::milliseconds(100));
+            return result::NONE;
+        } else {
+            return result::ERROR;
+        }
+        return result::OK;
+    }
+    if (name == "CPIN") {
+        if (op == "?") {
+            info += pin_ok ? "\r\n+CPIN: READY\r\n" : "\r\n+CPIN: SIM PIN\r\n";
+            return result::OK;
+        }
+        auto pin = arg;
+        pin.erase(std::remove(pin.begin(), pin.end(), '"'), pin.end());
+        if (pin_ok || pin != cfg.pin) {
+            return result::ERROR;
+        }
+        pin_ok = true;
+        return result::OK;
+    }
+    if (op == "=") {
+        if (name == "CMUX") {
+            if (cmux) {
+                return result::ERROR;
+            }
+            reply(ch, "\r\nOK\r\n");
+            cmux = true;
+            return result::NONE;
+        }
+        if (name == "CMGS") {
+            channels[ch].sms = true;
+            reply(ch, "\r\n> ");
+            return result::NONE;
+        }
+        if (name == "CPOWD") {
+            reply(ch, "\r\nNORMAL POWER DOWN\r\n");
+            return result::NONE;
+        }
+        if (name == "QPOWD") {
+            reply(ch, "\r\nOK\r\n\r\nPOWERED DOWN\r\n");
+            return result::NONE;
+        }
+    }
+    auto it = settings.find(name);
+    if (it == settings.end()) {
+        return result::ERROR;
+    }
+    if (op == "?") {
+        info += "\r\n+" + name + ": " + it->second + "\r\n";
+    } else {
+        it->second = arg;
+    }
+    return result::OK;
+}
+
+bool Device::start_session(size_t ch)
+{
+    auto out = [this, ch](const uint8_t *data, size_t len) {
+        if (channels[ch].data) {        // the peer's data are dropped while the session is suspended
+            reply(ch, std::string(reinterpret_cast<const char *>(data), len));
+        }
+    };
+    auto local = cfg.subnet + ".1";
+    auto remote = cfg.subnet + "." + std::to_string(2 + index % 253);
+    std::unique_ptr<Peer> peer;
+    switch (cfg.peer) {
+    case ppp_peer::RAW_ECHO:
+        peer = create_echo_peer(out);
+        break;
+    case ppp_peer::LOOPBACK:
+        peer = create_loopback_peer(out, ipv4(local), ipv4(remote));
+        break;
+    case ppp_peer::PPPD: {
+        auto options = cfg.pppd_options;
+        options.push_back(local + ":" + remote);
+        peer = create_pppd_peer(out, cfg.pppd_path, options);
+        break;
+    }
+    }
+    if (peer == nullptr) {
+        return false;
+    }
+    channels[ch].peer = std::move(peer);
+    channels[ch].data = true;
+    cnt.sessions++;
+    return true;
+}
+
+void Device::end_session(size_t ch)
+{
+    channels[ch].peer.reset();
+    channels[ch].data = false;
+}
+
+Peer *Device::peer(size_t ch)
+{
+    return channels[ch].peer.get();
+}
+
+void Device::hangup(size_t ch)
+{
+    if (channels[ch].peer == nullptr) {
+        return;
+    }
+    end_session(ch);
+    reply(ch, "\r\nNO CARRIER\r\n");
+}
+
+void Device::unsolicited(const std::string &urc)
+{
+    for (size_t ch = cmux ? 1 : 0; ch < (cmux ? max_channels : 1); ++ch) {
+        auto &c = channels[ch];
+        if (c.open && !c.data && !c.sms) {
+            reply(ch, "\r\n" + urc + "\r\n");
+            return;
+        }
+    }
+}
+
+void Device::reset()
+{
+    if (cmux) {
+        exit_cmux();
+    }
+    end_session(0);
+    channels[0] = channel();
+    channels[0].open = true;
+    echo = cfg.echo;
+    pin_ok = cfg.pin.empty();
+    settings = default_settings();
+}
+
+void Device::reply(size_t ch, const std::string &data, std::chrono::milliseconds delay)
+{
+    if (!cmux) {
+        send(data, delay);
+        return;
+    }
+    auto &c = channels[ch];
+    if (!flow || c.stopped) {
+        if (c.backlog.size() + data.size() <= max_backlog) {
+            c.backlog += data;
+        }
+        return;
+    }
+    for (size_t pos = 0; pos < data.size(); pos += c.frame_size) {
+        send_frame((ch << 2) | EA, FT_UIH, reinterpret_cast<const uint8_t *>(data.data()) + pos,
+                   std::min(c.frame_size, data.size() - pos));
+    }
+}
+
+void Device::parse_frames()
+{
+    size_t pos = 0;
+    while (true) {
+        while (pos < rx.size() && rx[pos] != SOF_MARKER) {
+            pos++;
+        }
+        while (pos + 1 < rx.size() && rx[pos + 1] == SOF_MARKER) {  // empty frames (or shared flags)
+            pos++;
+        }
+        if (rx.size() - pos < 6) {
+            break;
+        }
+        const uint8_t *frame = rx.data() + pos;
+        size_t header_len = (frame[3] & EA) ? 4 : 5;
+        size_t payload_len = (frame[3] >> 1) + (header_len == 5 ? frame[4] << 7 : 0);
+        if (payload_len > max_payload) {
+            cnt.bad_frames++;
+            pos++;
+            continue;
+        }
+        size_t total = header_len + payload_len + 2;
+        if (rx.size() - pos < total) {
+            break;
+        }
+        uint8_t crc = fcs_crc(frame + 1, header_len - 1);
+        if ((frame[2] & ~PF) == FT_UI) {
+            crc = fcs_crc(frame + header_len, payload_len, crc);
+        }
+        if (frame[total - 2] != 0xFF - crc || frame[total - 1] != SOF_MARKER) {
+            cnt.bad_frames++;
+            pos++;
+            continue;
+        }
+        cnt.frames++;
+        on_frame(frame[1], frame[2], frame + header_len, payload_len);
+        pos += total - 1;   // the closing flag could also open the next frame
+        if (!cmux) {        // exited CMUX, the rest is the command stream
+            std::vector<uint8_t> rest(rx.begin() + pos + 1, rx.end());
+            rx.clear();
+            input(0, rest.data(), rest.size());
+            return;
+        }
+    }
+    rx.erase(rx.begin(), rx.begin() + pos);
+}
+
+void Device::on_frame(uint8_t address, uint8_t control, const uint8_t *payload, size_t len)
+{
+    size_t dlci = address >> 2;
+    uint8_t type = control & ~PF;
+    if (dlci >= max_channels) {
+        send_frame(address, FT_DM | PF, nullptr, 0);
+        return;
+    }
+    auto &c = channels[dlci];
+    switch (type) {
+    case FT_SABM:
+        c.open = true;
+        send_frame(address, FT_UA | PF, nullptr, 0);
+        if (dlci > 0) {     // report the modem status on the new DLCI, as devices do
+            send_control({ (CMD_MSC << 1) | CR | EA, (2 << 1) | EA, static_cast<uint8_t>((dlci << 2) | CR | EA), MSC_RTC | MSC_RTR | EA });
+        }
+        break;
+    case FT_DISC:
+        send_frame(address, FT_UA | PF, nullptr, 0);
+        if (dlci == 0) {
+            exit_cmux();
+        } else {
+            end_session(dlci);
+            c = channel();
+        }
+        break;
+    case FT_UIH:
+    case FT_UI:
+        if (dlci == 0) {
+            on_control(payload, len);
+        } else if (c.open) {
+            input(dlci, payload, len);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void Device::on_control(const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+    while (pos + 2 <= len) {
+        uint8_t type = data[pos];
+        size_t value_len = data[pos + 1] >> 1;
+        size_t header_len = 2;
+        if ((data[pos + 1] & EA) == 0) {
+            if (pos + 3 > len) {
+                return;
+            }
+            value_len |= data[pos + 2] << 7;
+            header_len = 3;
+        }
+        if (pos + header_len + value_len > len) {
+            return;
+        }
+        const uint8_t *value = data + pos + header_len;
+        pos += header_len + value_len;
+        if ((type & CR) == 0) {     // responses to our commands (MSC)
+            continue;
+        }
+        std::vector<uint8_t> response = { static_cast<uint8_t>(type & ~CR), static_cast<uint8_t>((value_len << 1) | EA) };
+        response.insert(response.end(), value, value + value_len);
+        switch (type >> 2) {
+        case CMD_PN >> 1:
+            if (value_len >= 8 && (value[0] & 0x3F) < max_channels) {
+                size_t frame_size = std::min<size_t>(value[4] | (value[5] << 8), cfg.max_frame_size);
+                channels[value[0] & 0x3F].frame_size = frame_size ? frame_size : 127;
+                response[2 + 4] = frame_size & 0xFF;
+                response[2 + 5] = frame_size >> 8;
+            }
+            break;
+        case CMD_MSC >> 1:
+            if (value_len >= 2 && (value[0] >> 2) < max_channels) {
+                channels[value[0] >> 2].stopped = value[1] & MSC_FC;
+                flush_backlog();
+            }
+            break;
+        case CMD_FCON >> 1:
+        case CMD_FCOFF >> 1:
+            flow = (type >> 2) == (CMD_FCON >> 1);
+            flush_backlog();
+            break;
+        case CMD_TEST >> 1:
+            break;
+        case CMD_CLD >> 1:
+            send_control(response);
+            exit_cmux();
+            return;
+        default:
+            response = { (CMD_NSC << 1) | EA, (1 << 1) | EA, type };
+            break;
+        }
+        send_control(response);
+    }
+}
+
+void Device::send_frame(uint8_t address, uint8_t control, const uint8_t *data, size_t len)
+{
+    std::string frame;
+    frame.reserve(len + 7);
+    frame.push_back(SOF_MARKER);
+    frame.push_back(address);
+    frame.push_back(control);
+    if (len > 127) {
+        frame.push_back((len & 0x7F) << 1);
+        frame.push_back(len >> 7);
+    } else {
+        frame.push_back((len << 1) | EA);
+    }
+    uint8_t crc = fcs_crc(reinterpret_cast<const uint8_t *>(frame.data()) + 1, frame.size() - 1);
+    if ((control & ~PF) == FT_UI) {
+        crc = fcs_crc(data, len, crc);
+    }
+    frame.append(reinterpret_cast<const char *>(data), len);
+    frame.push_back(0xFF - crc);
+    frame.push_back(SOF_MARKER);
+    send(std::move(frame), std::chrono::milliseconds(0));
+}
+
+void Device::send_control(const std::vector<uint8_t> &msg)
+{
+    send_frame(0x03, FT_UIH, msg.data(), msg.size());
+}
+
+void Device::flush_backlog()
+{
+    for (size_t ch = 1; ch < max_channels && flow; ++ch) {
+        auto &c = channels[ch];
+        if (!c.stopped && !c.backlog.empty()) {
+            std::string backlog;
+            backlog.swap(c.backlog);
+            reply(ch, backlog);
+        }
+    }
+}
+
+void Device::exit_cmux()
+{
+    cmux = false;
+    flow = true;
+    for (size_t ch = 0; ch < max_channels; ++ch) {
+        end_session(ch);
+        channels[ch] = channel();
+    }
+    channels[0].open = true;
+}
+
+} // namespace modem_sim
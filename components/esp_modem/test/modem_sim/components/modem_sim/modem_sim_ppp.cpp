@@ -0,0 +1,442 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "modem_sim_device.hpp"
+
+namespace modem_sim {
+
+namespace {
+
+class EchoPeer : public Peer {
+public:
+    explicit EchoPeer(output out): out(std::move(out)) {}
+
+    bool write(const uint8_t *data, size_t len) override
+    {
+        out(data, len);
+        return true;
+    }
+
+private:
+    output out;
+};
+
+/* PPP (RFC 1661, 1662, 1332) */
+#define PPP_FLAG        0x7E
+#define PPP_ESCAPE      0x7D
+#define PPP_TRANS       0x20
+#define PPP_IP          0x0021
+#define PPP_IPCP        0x8021
+#define PPP_LCP         0xC021
+#define PPP_GOOD_FCS    0xF0B8
+
+#define CP_CONF_REQ     1
+#define CP_CONF_ACK     2
+#define CP_CONF_NAK     3
+#define CP_CONF_REJ     4
+#define CP_TERM_REQ     5
+#define CP_TERM_ACK     6
+#define LCP_PROTO_REJ   8
+#define LCP_ECHO_REQ    9
+#define LCP_ECHO_REP    10
+
+#define IPCP_ADDRESS    3
+#define IPCP_DNS1       129
+#define IPCP_DNS2       131
+
+static uint16_t fcs16(const uint8_t *data, size_t len)
+{
+    uint16_t fcs = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        fcs ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            fcs = (fcs & 0x01) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+        }
+    }
+    return fcs;
+}
+
+static uint16_t ip_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (len & 1) {
+        sum += data[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+/**
+ * @brief Minimal PPP peer: acknowledges the DTE's LCP options, assigns it the remote address in IPCP,
+ * replies to LCP echo and ICMP echo requests, and echoes UDP datagrams back to the sender
+ */
+class LoopbackPeer : public Peer {
+public:
+    LoopbackPeer(output out, uint32_t local_ip, uint32_t remote_ip): out(std::move(out)), local_ip(local_ip), remote_ip(remote_ip) {}
+
+    bool write(const uint8_t *data, size_t len) override
+    {
+        for (size_t i = 0; i < len && !terminated; ++i) {
+            uint8_t b = data[i];
+            if (b == PPP_FLAG) {
+                if (frame.size() >= 4) {
+                    on_frame();
+                }
+                frame.clear();
+                escaped = false;
+            } else if (b == PPP_ESCAPE) {
+                escaped = true;
+            } else if (frame.size() < max_frame) {
+                frame.push_back(escaped ? b ^ PPP_TRANS : b);
+                escaped = false;
+            }
+        }
+        return !terminated;
+    }
+
+private:
+    static constexpr size_t max_frame = 1600;
+
+    void on_frame()
+    {
+        if (fcs16(frame.data(), frame.size()) != PPP_GOOD_FCS) {
+            return;
+        }
+        frame.resize(frame.size() - 2);
+        size_t pos = 0;
+        if (frame.size() >= 2 && frame[0] == 0xFF && frame[1] == 0x03) {
+            pos = 2;    // address and control (unless compressed)
+        }
+        if (pos >= frame.size()) {
+            return;
+        }
+        uint16_t protocol = frame[pos++];
+        if ((protocol & 0x01) == 0) {   // uncompressed protocol field
+            if (pos >= frame.size()) {
+                return;
+            }
+            protocol = (protocol << 8) | frame[pos++];
+        }
+        const uint8_t *packet = frame.data() + pos;
+        size_t len = frame.size() - pos;
+        switch (protocol) {
+        case PPP_LCP:
+            on_lcp(packet, len);
+            break;
+        case PPP_IPCP:
+            on_ipcp(packet, len);
+            break;
+        case PPP_IP:
+            on_ip(packet, len);
+            break;
+        default: {
+            std::vector<uint8_t> data = { static_cast<uint8_t>(protocol >> 8), static_cast<uint8_t>(protocol) };
+            data.insert(data.end(), packet, packet + len);
+            send_cp(PPP_LCP, LCP_PROTO_REJ, ++id, data);
+            break;
+        }
+        }
+    }
+
+    static bool parse_cp(const uint8_t *packet, size_t &len)
+    {
+        if (len < 4) {
+            return false;
+        }
+        size_t cp_len = (packet[2] << 8) | packet[3];
+        if (cp_len < 4 || cp_len > len) {
+            return false;
+        }
+        len = cp_len;
+        return true;
+    }
+
+    void on_lcp(const uint8_t *packet, size_t len)
+    {
+        if (!parse_cp(packet, len)) {
+            return;
+        }
+        std::vector<uint8_t> data(packet + 4, packet + len);
+        switch (packet[0]) {
+        case CP_CONF_REQ:
+            send_cp(PPP_LCP, CP_CONF_ACK, packet[1], data);     // accept all the DTE's options
+            if (!lcp_requested) {
+                lcp_requested = true;
+                send_cp(PPP_LCP, CP_CONF_REQ, ++id, {});        // and request none of ours
+            }
+            break;
+        case CP_TERM_REQ:
+            send_cp(PPP_LCP, CP_TERM_ACK, packet[1], {});
+            terminated = true;
+            break;
+        case LCP_ECHO_REQ:
+            if (data.size() >= 4) {
+                std::fill(data.begin(), data.begin() + 4, 0);   // magic number
+                send_cp(PPP_LCP, LCP_ECHO_REP, packet[1], data);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void on_ipcp(const uint8_t *packet, size_t len)
+    {
+        if (!parse_cp(packet, len)) {
+            return;
+        }
+        if (packet[0] == CP_TERM_REQ) {
+            send_cp(PPP_IPCP, CP_TERM_ACK, packet[1], {});
+            return;
+        }
+        if (packet[0] != CP_CONF_REQ) {
+            return;
+        }
+        std::vector<uint8_t> naks, rejects;
+        for (size_t pos = 4; pos + 2 <= len;) {
+            uint8_t type = packet[pos];
+            size_t opt_len = packet[pos + 1];
+            if (opt_len < 2 || pos + opt_len > len) {
+                break;
+            }
+            const uint8_t *opt = packet + pos;
+            pos += opt_len;
+            if ((type != IPCP_ADDRESS && type != IPCP_DNS1 && type != IPCP_DNS2) || opt_len != 6) {
+                rejects.insert(rejects.end(), opt, opt + opt_len);
+                continue;
+            }
+            uint32_t expected = type == IPCP_ADDRESS ? remote_ip : local_ip;
+            uint32_t value = (opt[2] << 24) | (opt[3] << 16) | (opt[4] << 8) | opt[5];
+            if (value != expected) {
+                append_address(naks, type, expected);
+            }
+        }
+        std::vector<uint8_t> options(packet + 4, packet + len);
+        if (!rejects.empty()) {
+            send_cp(PPP_IPCP, CP_CONF_REJ, packet[1], rejects);
+        } else if (!naks.empty()) {
+            send_cp(PPP_IPCP, CP_CONF_NAK, packet[1], naks);
+        } else {
+            send_cp(PPP_IPCP, CP_CONF_ACK, packet[1], options);
+        }
+        if (!ipcp_requested) {
+            ipcp_requested = true;
+            std::vector<uint8_t> ours;
+            append_address(ours, IPCP_ADDRESS, local_ip);
+            send_cp(PPP_IPCP, CP_CONF_REQ, ++id, ours);
+        }
+    }
+
+    void on_ip(const uint8_t *packet, size_t len)
+    {
+        if (len < 20 || (packet[0] >> 4) != 4) {
+            return;
+        }
+        size_t header_len = (packet[0] & 0x0F) * 4;
+        size_t total_len = (packet[2] << 8) | packet[3];
+        if (header_len < 20 || total_len < header_len || total_len > len) {
+            return;
+        }
+        std::vector<uint8_t> reply(packet, packet + total_len);
+        uint8_t *ip = reply.data();
+        uint8_t *payload = ip + header_len;
+        size_t payload_len = total_len - header_len;
+        // swapping the addresses (and ports) keeps the checksums valid
+        std::swap_ranges(ip + 12, ip + 16, ip + 16);
+        if (ip[9] == 1 && payload_len >= 8 && payload[0] == 8) {            // ICMP echo request
+            payload[0] = 0;
+            payload[2] = payload[3] = 0;
+            uint16_t sum = ip_checksum(payload, payload_len);
+            payload[2] = sum >> 8;
+            payload[3] = sum & 0xFF;
+        } else if (ip[9] == 17 && payload_len >= 8) {                       // UDP
+            std::swap_ranges(payload, payload + 2, payload + 2);
+        } else {
+            return;
+        }
+        send(PPP_IP, reply);
+    }
+
+    static void append_address(std::vector<uint8_t> &options, uint8_t type, uint32_t address)
+    {
+        uint8_t opt[] = { type, 6, static_cast<uint8_t>(address >> 24), static_cast<uint8_t>(address >> 16),
+                          static_cast<uint8_t>(address >> 8), static_cast<uint8_t>(address)
+                        };
+        options.insert(options.end(), opt, opt + sizeof(opt));
+    }
+
+    void send_cp(uint16_t protocol, uint8_t code, uint8_t cp_id, const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> packet = { code, cp_id, static_cast<uint8_t>((data.size() + 4) >> 8), static_cast<uint8_t>(data.size() + 4) };
+        packet.insert(packet.end(), data.begin(), data.end());
+        send(protocol, packet);
+    }
+
+    void send(uint16_t protocol, const std::vector<uint8_t> &packet)
+    {
+        std::vector<uint8_t> raw = { 0xFF, 0x03, static_cast<uint8_t>(protocol >> 8), static_cast<uint8_t>(protocol) };
+        raw.insert(raw.end(), packet.begin(), packet.end());
+        uint16_t fcs = ~fcs16(raw.data(), raw.size());
+        raw.push_back(fcs & 0xFF);
+        raw.push_back(fcs >> 8);
+        // escape the flags and all control characters (we don't negotiate the ACCM)
+        std::vector<uint8_t> encoded = { PPP_FLAG };
+        for (auto b : raw) {
+            if (b == PPP_FLAG || b == PPP_ESCAPE || b < 0x20) {
+                encoded.push_back(PPP_ESCAPE);
+                b ^= PPP_TRANS;
+            }
+            encoded.push_back(b);
+        }
+        encoded.push_back(PPP_FLAG);
+        out(encoded.data(), encoded.size());
+    }
+
+    output out;
+    uint32_t local_ip;
+    uint32_t remote_ip;
+    std::vector<uint8_t> frame;
+    bool escaped = false;
+    bool lcp_requested = false;
+    bool ipcp_requested = false;
+    bool terminated = false;
+    uint8_t id = 0;
+};
+
+/**
+ * @brief pppd process on a pty, started per session and terminated when the session ends
+ */
+class PppdPeer : public Peer {
+public:
+    PppdPeer(output out, int master, int slave, pid_t pid): out(std::move(out)), master(master), slave(slave), pid(pid) {}
+
+    ~PppdPeer() override
+    {
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            for (int i = 0; i < 100 && waitpid(pid, nullptr, WNOHANG) == 0; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (waitpid(pid, nullptr, WNOHANG) == 0) {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+            }
+        }
+        close(slave);
+        close(master);
+    }
+
+    bool write(const uint8_t *data, size_t len) override
+    {
+        while (len > 0) {
+            auto ret = ::write(master, data, len);
+            if (ret <= 0) {
+                break;  // pppd doesn't keep up, drop the data as a lossy link would
+            }
+            data += ret;
+            len -= ret;
+        }
+        return pid > 0;
+    }
+
+    int fd() const override
+    {
+        return master;
+    }
+
+    bool poll(bool readable) override
+    {
+        if (readable) {
+            uint8_t data[2048];
+            auto len = ::read(master, data, sizeof(data));
+            if (len > 0) {
+                out(data, len);
+            }
+        }
+        if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid) {
+            pid = -1;
+        }
+        return pid > 0;
+    }
+
+private:
+    output out;
+    int master;
+    int slave;      /*!< Kept open, so the master doesn't hang up before pppd opens the tty */
+    pid_t pid;
+};
+
+} // namespace
+
+std::unique_ptr<Peer> create_echo_peer(Peer::output out)
+{
+    return std::make_unique<EchoPeer>(std::move(out));
+}
+
+std::unique_ptr<Peer> create_loopback_peer(Peer::output out, uint32_t local_ip, uint32_t remote_ip)
+{
+    return std::make_unique<LoopbackPeer>(std::move(out), local_ip, remote_ip);
+}
+
+std::unique_ptr<Peer> create_pppd_peer(Peer::output out, const std::string &path, const std::vector<std::string> &options)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        if (master >= 0) {
+            close(master);
+        }
+        return nullptr;
+    }
+    std::string tty = ptsname(master);
+    int slave = ::open(tty.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slave < 0 || access(path.c_str(), X_OK) != 0) {
+        if (slave >= 0) {
+            close(slave);
+        }
+        close(master);
+        return nullptr;
+    }
+    termios tio{};
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    std::vector<std::string> args = { path, tty };
+    args.insert(args.end(), options.begin(), options.end());
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setsid();
+        execv(path.c_str(), argv.data());
+        _exit(127);
+    }
+    if (pid < 0) {
+        close(slave);
+        close(master);
+        return nullptr;
+    }
+    return std::make_unique<PppdPeer>(std::move(out), master, slave, pid);
+}
+
+} // namespace modem_sim
@@ -0,0 +1,155 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "modem_sim.hpp"
+
+namespace modem_sim {
+
+/**
+ * @brief Counters updated by the simulator thread, read by the application
+ */
+struct counters {
+    std::atomic<uint64_t> commands{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> drops{0};
+    std::atomic<uint64_t> corruptions{0};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> bad_frames{0};
+    std::atomic<uint64_t> sessions{0};
+    std::atomic<uint64_t> bytes_rx{0};
+    std::atomic<uint64_t> bytes_tx{0};
+};
+
+/**
+ * @brief Peer of a PPP session
+ */
+class Peer {
+public:
+    using output = std::function<void(const uint8_t *data, size_t len)>;
+
+    virtual ~Peer() = default;
+
+    /**
+     * @brief Data of the session written by the DTE
+     * @return false if the peer closed the session
+     */
+    virtual bool write(const uint8_t *data, size_t len) = 0;
+
+    /**
+     * @brief File descriptor to be polled by the simulator, -1 if the peer doesn't need polling
+     */
+    virtual int fd() const
+    {
+        return -1;
+    }
+
+    /**
+     * @brief Serves the peer after polling (readable if the fd() has data)
+     * @return false if the peer closed the session
+     */
+    virtual bool poll(bool readable)
+    {
+        return true;
+    }
+};
+
+std::unique_ptr<Peer> create_echo_peer(Peer::output out);
+std::unique_ptr<Peer> create_loopback_peer(Peer::output out, uint32_t local_ip, uint32_t remote_ip);
+std::unique_ptr<Peer> create_pppd_peer(Peer::output out, const std::string &path, const std::vector<std::string> &options);
+
+/**
+ * @brief Protocol part of a simulated modem: AT commands, CMUX and PPP sessions (no I/O, no threads)
+ */
+class Device {
+public:
+    static constexpr size_t max_channels = 8;   /*!< Channel 0 is the command stream (or CMUX control), 1..7 the DLCIs */
+
+    /**
+     * @brief Writes data to the DTE, after the given delay (on top of the configured latency)
+     */
+    using sender = std::function<void(std::string data, std::chrono::milliseconds delay)>;
+
+    Device(const config &cfg, size_t index, std::mt19937 &rng, counters &cnt, sender send);
+
+    /**
+     * @brief Data written by the DTE
+     */
+    void feed(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Sends an unsolicited result code on the first channel in command mode
+     */
+    void unsolicited(const std::string &urc);
+
+    /**
+     * @brief Peer of the session on the channel, nullptr if there's no session
+     */
+    Peer *peer(size_t ch);
+
+    /**
+     * @brief Ends the session on the channel, reporting NO CARRIER
+     */
+    void hangup(size_t ch);
+
+private:
+    enum class result { OK, ERROR, NONE };
+
+    struct channel {
+        bool open = false;          /*!< CMUX: established by SABM (the command stream is always open) */
+        bool data = false;          /*!< In data mode: the input goes to the peer */
+        bool sms = false;           /*!< Collecting the SMS text after AT+CMGS */
+        bool stopped = false;       /*!< CMUX: the DTE disabled the flow on this DLCI (MSC) */
+        std::string line;
+        std::string backlog;        /*!< CMUX: output held while the flow is disabled */
+        size_t frame_size = 127;
+        std::unique_ptr<Peer> peer;
+    };
+
+    void input(size_t ch, const uint8_t *data, size_t len);
+    void command(size_t ch, const std::string &line);
+    result execute(size_t ch, const std::string &cmd, std::string &info);
+    result extended(size_t ch, const std::string &name, const std::string &op, const std::string &arg, std::string &info);
+    bool start_session(size_t ch);
+    void end_session(size_t ch);
+    void reset();
+    void reply(size_t ch, const std::string &data, std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+    bool chance(double rate);
+
+    // CMUX
+    void parse_frames();
+    void on_frame(uint8_t address, uint8_t control, const uint8_t *payload, size_t len);
+    void on_control(const uint8_t *data, size_t len);
+    void send_frame(uint8_t address, uint8_t control, const uint8_t *data, size_t len);
+    void send_control(const std::vector<uint8_t> &msg);
+    void flush_backlog();
+    void exit_cmux();
+
+    const config &cfg;
+    size_t index;
+    std::mt19937 &rng;
+    counters &cnt;
+    sender send;
+    bool cmux = false;
+    bool flow = true;               /*!< CMUX: the DTE enabled the flow on all DLCIs (FCon/FCoff) */
+    std::vector<uint8_t> rx;        /*!< CMUX: unprocessed frames */
+    std::array<channel, max_channels> channels;
+    bool echo;
+    bool pin_ok;
+    unsigned sms_ref = 0;
+    std::map<std::string, std::string> settings;
+};
+
+} // namespace modem_sim
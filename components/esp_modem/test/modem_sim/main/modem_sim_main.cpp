@@ -0,0 +1,125 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <pthread.h>
+#include <unistd.h>
+#include "modem_sim.hpp"
+
+using namespace modem_sim;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n modems] [-m model] [-k pin] [-p echo|loopback|pppd] [-P pppd_path] [-N subnet]\n"
+            "          [-l latency_ms] [-j jitter_ms] [-F fragment] [-e error_rate] [-d drop_rate] [-c corrupt_rate]\n"
+            "          [-u urc_period_ms] [-s seed] [-L link_dir]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    config cfg;
+    size_t count = 1;
+    std::string link_dir;
+    int c;
+    while ((c = getopt(argc, argv, "n:m:k:p:P:N:l:j:F:e:d:c:u:s:L:h")) != -1) {
+        switch (c) {
+        case 'n':
+            count = std::max(1, atoi(optarg));
+            break;
+        case 'm':
+            cfg.model = optarg;
+            break;
+        case 'k':
+            cfg.pin = optarg;
+            break;
+        case 'p':
+            if (strcmp(optarg, "echo") == 0) {
+                cfg.peer = ppp_peer::RAW_ECHO;
+            } else if (strcmp(optarg, "pppd") == 0) {
+                cfg.peer = ppp_peer::PPPD;
+            } else {
+                cfg.peer = ppp_peer::LOOPBACK;
+            }
+            break;
+        case 'P':
+            cfg.pppd_path = optarg;
+            break;
+        case 'N':
+            cfg.subnet = optarg;
+            break;
+        case 'l':
+            cfg.latency = std::chrono::milliseconds(atoi(optarg));
+            break;
+        case 'j':
+            cfg.jitter = std::chrono::milliseconds(atoi(optarg));
+            break;
+        case 'F':
+            cfg.fragment_size = atoi(optarg);
+            break;
+        case 'e':
+            cfg.error_rate = atof(optarg);
+            break;
+        case 'd':
+            cfg.drop_rate = atof(optarg);
+            break;
+        case 'c':
+            cfg.corrupt_rate = atof(optarg);
+            break;
+        case 'u':
+            cfg.urc_period = std::chrono::milliseconds(atoi(optarg));
+            break;
+        case 's':
+            cfg.seed = strtoul(optarg, nullptr, 0);
+            break;
+        case 'L':
+            link_dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    // handle the termination signals synchronously (blocked in all threads)
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    Simulator sim(count, cfg);
+    for (size_t i = 0; i < sim.size(); ++i) {
+        if (!link_dir.empty()) {
+            auto link = link_dir + "/modem" + std::to_string(i);
+            unlink(link.c_str());
+            if (symlink(sim.device(i).c_str(), link.c_str()) != 0) {
+                fprintf(stderr, "Cannot create %s\n", link.c_str());
+            }
+        }
+        printf("modem %zu: %s\n", i, sim.device(i).c_str());
+    }
+    fflush(stdout);
+
+    int sig;
+    sigwait(&signals, &sig);
+
+    for (size_t i = 0; i < sim.size(); ++i) {
+        auto s = sim.get_stats(i);
+        printf("modem %zu: commands %llu (errors %llu, drops %llu), corruptions %llu, frames %llu (bad %llu), "
+               "sessions %llu, rx %llu, tx %llu bytes\n", i,
+               (unsigned long long)s.commands, (unsigned long long)s.errors, (unsigned long long)s.drops,
+               (unsigned long long)s.corruptions, (unsigned long long)s.frames, (unsigned long long)s.bad_frames,
+               (unsigned long long)s.sessions, (unsigned long long)s.bytes_rx, (unsigned long long)s.bytes_tx);
+        if (!link_dir.empty()) {
+            unlink((link_dir + "/modem" + std::to_string(i)).c_str());
+        }
+    }
+    return 0;
+}